@@ -38,10 +38,27 @@ struct igmphdr
  */
 
 #ifdef __KERNEL__
+
+/*
+ *	One socket's membership of one group, also on the group hash so
+ *	that a datagram for a group finds its members directly.
+ */
+
+struct ip_mc_member
+{
+	struct ip_mc_member *next;		/* Group hash chain */
+	struct sock *sk;
+	unsigned long multiaddr;
+	struct device *multidev;
+};
+
+#define IP_MC_HASH_SIZE	64
+
 struct ip_mc_socklist
 {
 	unsigned long multiaddr[IP_MAX_MEMBERSHIPS];	/* This is a speed trade off */
 	struct device *multidev[IP_MAX_MEMBERSHIPS];
+	struct ip_mc_member member[IP_MAX_MEMBERSHIPS];	/* Hashed copy of the above */
 };
 
 struct ip_mc_list 
@@ -63,5 +80,6 @@ extern void ip_mc_drop_device(struct device *dev);
 extern int ip_mc_join_group(struct sock *sk, struct device *dev, unsigned long addr);
 extern int ip_mc_leave_group(struct sock *sk, struct device *dev,unsigned long addr);
 extern void ip_mc_drop_socket(struct sock *sk);
+extern struct ip_mc_member *ip_mc_members(unsigned long addr);
 #endif
 #endif
@@ -43,6 +43,9 @@
 #define SYS_SHUTDOWN	13		/* sys_shutdown(2)		*/
 #define SYS_SETSOCKOPT	14		/* sys_setsockopt(2)		*/
 #define SYS_GETSOCKOPT	15		/* sys_getsockopt(2)		*/
+#define SYS_SENDFILE	16		/* sys_sendfile(2)		*/
+#define SYS_RECVMMSG	17		/* sys_recvmmsg(2)		*/
+#define SYS_SENDMMSG	18		/* sys_sendmmsg(2)		*/
 
 
 typedef enum {
@@ -85,6 +88,8 @@ struct socket {
 
 #define SOCK_INODE(S)	((S)->inode)
 
+struct file;
+
 struct proto_ops {
   int	family;
 
@@ -124,6 +129,12 @@ struct proto_ops {
 			 char *optval, int *optlen);
   int	(*fcntl)	(struct socket *sock, unsigned int cmd,
 			 unsigned long arg);	
+  int	(*sendfile)	(struct socket *sock, struct file *file, int size,
+			 int nonblock);
+  int	(*recvmmsg)	(struct socket *sock, struct mmsghdr *vec, int vlen,
+			 int nonblock, unsigned flags);
+  int	(*sendmmsg)	(struct socket *sock, struct mmsghdr *vec, int vlen,
+			 int nonblock, unsigned flags);
 };
 
 struct net_proto {
@@ -184,7 +184,24 @@ extern volatile char in_bh;
 
 extern struct device	loopback_dev;
 extern struct device	*dev_base;
-extern struct packet_type *ptype_base;
+/*
+ *	Receive handlers are hashed on their (host order) protocol ID.
+ *	ETH_P_ALL taps live on their own list and see every frame.
+ */
+
+#define PTYPE_HASH_SIZE	16
+#define PTYPE_HASH(type)	(((type) ^ ((type) >> 8)) & (PTYPE_HASH_SIZE - 1))
+
+extern struct packet_type *ptype_base[PTYPE_HASH_SIZE];
+extern struct packet_type *ptype_all;
+
+/*
+ *	Default number of received frames net_bh() handles per run.
+ */
+
+#define NET_BH_BUDGET	64
+
+extern int		net_bh_budget;
 
 
 extern int		ip_addr_match(unsigned long addr1, unsigned long addr2);
@@ -193,6 +210,7 @@ extern struct device	*ip_dev_check(unsigned long daddr);
 extern unsigned long	ip_my_addr(void);
 extern unsigned long	ip_get_mask(unsigned long addr);
 
+extern int		net_bh_get_info(char *buffer);
 extern void		dev_add_pack(struct packet_type *pt);
 extern void		dev_remove_pack(struct packet_type *pt);
 extern struct device	*dev_get(char *name);
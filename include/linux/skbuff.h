@@ -70,12 +70,16 @@ struct sk_buff {
 				free,
 				arp;
   unsigned char			tries,lock,localroute,pkt_type;
+  unsigned char			sacked;		/* TCP: the receiver has this one (SACK) */
+  unsigned char			csum_ok;	/* TCP: csum holds the sum of the payload */
+  unsigned long			csum;
 #define PACKET_HOST		0		/* To us */
 #define PACKET_BROADCAST	1
 #define PACKET_MULTICAST	2
 #define PACKET_OTHERHOST	3		/* Unmatched promiscuous */
   unsigned short		users;		/* User count - see datagram.c (and soon seqpacket.c/stream.c) */
   unsigned short		pkt_class;	/* For drivers that need to cache the packet type with the skbuff (new PPP) */
+  unsigned char			pool;		/* Free list class + 1, or 0 if kmalloc()ed to size */
 #ifdef CONFIG_SLAVE_BALANCING
   unsigned short		in_dev_queue;
 #endif  
@@ -85,6 +89,8 @@ struct sk_buff {
 
 #define SK_WMEM_MAX	32767
 #define SK_RMEM_MAX	32767
+#define SK_WMEM_LIMIT	262144		/* Largest SO_SNDBUF allowed */
+#define SK_RMEM_LIMIT	262144		/* Largest SO_RCVBUF allowed */
 
 #ifdef CONFIG_SKB_CHECK
 #define SK_FREED_SKB	0x0DE2C0DE
@@ -118,6 +124,7 @@ extern void			skb_device_lock(struct sk_buff *skb);
 extern void			skb_device_unlock(struct sk_buff *skb);
 extern void			dev_kfree_skb(struct sk_buff *skb, int mode);
 extern int			skb_device_locked(struct sk_buff *skb);
+extern int			skb_pool_get_info(char *buffer);
 /*
  *	Peek an sk_buff. Unlike most other operations you _MUST_
  *	be careful with this one. A peek leaves the buffer on the
@@ -280,6 +287,7 @@ extern __inline__ void skb_unlink(struct sk_buff *skb)
 #endif
 
 extern struct sk_buff *		skb_recv_datagram(struct sock *sk,unsigned flags,int noblock, int *err);
+extern int			skb_recv_datagrams(struct sock *sk, struct sk_buff **skbs, int max, unsigned flags, int noblock, int *err);
 extern int			datagram_select(struct sock *sk, int sel_type, select_table *wait);
 extern void			skb_copy_datagram(struct sk_buff *from, int offset, char *to,int size);
 extern void			skb_free_datagram(struct sk_buff *skb);
@@ -14,6 +14,15 @@ struct linger {
   int			l_linger;	/* How long to linger for	*/
 };
 
+/* One datagram of a recvmmsg(2) or sendmmsg(2) vector. */
+struct mmsghdr {
+  void			*msg_base;	/* Data buffer			*/
+  int			msg_size;	/* ...and its size		*/
+  struct sockaddr	*msg_name;	/* Peer address or NULL		*/
+  int			msg_namelen;	/* ...and its size		*/
+  int			msg_len;	/* Bytes received or sent	*/
+};
+
 /* Socket types. */
 #define SOCK_STREAM	1		/* stream (connection) socket	*/
 #define SOCK_DGRAM	2		/* datagram (conn.less) socket	*/
@@ -46,6 +55,9 @@ struct linger {
 
 #define PF_MAX		AF_MAX
 
+/* Maximum queue length specifiable by listen. */
+#define SOMAXCONN	1024
+
 /* Flags we can use with send/ and recv. */
 #define MSG_OOB		1
 #define MSG_PEEK	2
@@ -92,6 +104,7 @@ struct linger {
 #define IP_MULTICAST_LOOP 		34
 #define IP_ADD_MEMBERSHIP		35
 #define IP_DROP_MEMBERSHIP		36
+#define IP_MULTICAST_ALL		37
 
 
 /* These need to appear somewhere around here */
@@ -105,6 +118,8 @@ struct linger {
 /* TCP options - this way around because someone left a set in the c library includes */
 #define TCP_NODELAY	1
 #define TCP_MAXSEG	2
+#define TCP_CORK	3	/* Send only full segments until cleared */
+#define TCP_LOSS_STATS	16	/* Read only, struct tcp_loss_stats */
 
 /* The various priorities. */
 #define SOPRI_INTERACTIVE	0
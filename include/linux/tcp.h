@@ -54,6 +54,16 @@ struct tcphdr {
 	__u16	urg_ptr;
 };
 
+/*
+ *	Loss recovery counters of a connection, for getsockopt(TCP_LOSS_STATS).
+ */
+
+struct tcp_loss_stats {
+	unsigned long	dupacks;	/* Duplicate acks received	*/
+	unsigned long	fast_retrans;	/* Fast retransmits done	*/
+	unsigned long	timeouts;	/* Retransmit timeouts		*/
+};
+
 
 enum {
   TCP_ESTABLISHED = 1,
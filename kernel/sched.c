@@ -306,16 +306,98 @@ void sleep_on(struct wait_queue **p)
 }
 
 /*
- * The head for the timer-list has a "expires" field of MAX_UINT,
- * and the sorting routine counts on this..
+ * Pending timers are kept in a cascading timer wheel, so that adding
+ * and deleting one is O(1) however many are pending. tv1 has a slot
+ * for each of the next 256 jiffies; tv2..tv5 each have 64 slots that
+ * cover 64 times the range of the level below. A timer goes in the
+ * finest level that reaches its expiry. Each time tv1 comes round, the
+ * next slot of tv2 is emptied back into the wheel, and so on up.
+ *
+ * timer_jiffies is the next jiffy whose slot has not been run. Every
+ * slot is a circular list whose head is a dummy timer, so a pending
+ * timer always has next and prev set and can unlink itself.
  */
-static struct timer_list timer_head = { &timer_head, &timer_head, ~0, 0, NULL };
+#define TVN_BITS 6
+#define TVR_BITS 8
+#define TVN_SIZE (1 << TVN_BITS)
+#define TVR_SIZE (1 << TVR_BITS)
+#define TVN_MASK (TVN_SIZE - 1)
+#define TVR_MASK (TVR_SIZE - 1)
+
+static struct timer_list tv1[TVR_SIZE];
+static struct timer_list tv2[TVN_SIZE];
+static struct timer_list tv3[TVN_SIZE];
+static struct timer_list tv4[TVN_SIZE];
+static struct timer_list tv5[TVN_SIZE];
+static unsigned long timer_jiffies = 0;
+
 #define SLOW_BUT_DEBUGGING_TIMERS 1
 
+static void init_timervecs(void)
+{
+	int i;
+
+	for (i = 0; i < TVR_SIZE; i++)
+		tv1[i].next = tv1[i].prev = &tv1[i];
+	for (i = 0; i < TVN_SIZE; i++) {
+		tv2[i].next = tv2[i].prev = &tv2[i];
+		tv3[i].next = tv3[i].prev = &tv3[i];
+		tv4[i].next = tv4[i].prev = &tv4[i];
+		tv5[i].next = tv5[i].prev = &tv5[i];
+	}
+}
+
+/*
+ * File a timer (expires is absolute) in its slot. Interrupts must be off.
+ */
+static inline void internal_add_timer(struct timer_list *timer)
+{
+	unsigned long expires = timer->expires;
+	unsigned long idx = expires - timer_jiffies;
+	struct timer_list *head;
+
+	if (idx < TVR_SIZE)
+		head = tv1 + (expires & TVR_MASK);
+	else if (idx < 1 << (TVR_BITS + TVN_BITS))
+		head = tv2 + ((expires >> TVR_BITS) & TVN_MASK);
+	else if (idx < 1 << (TVR_BITS + 2 * TVN_BITS))
+		head = tv3 + ((expires >> (TVR_BITS + TVN_BITS)) & TVN_MASK);
+	else if (idx < 1 << (TVR_BITS + 3 * TVN_BITS))
+		head = tv4 + ((expires >> (TVR_BITS + 2 * TVN_BITS)) & TVN_MASK);
+	else if ((long) idx < 0)
+		/* Already due: the next slot to be run */
+		head = tv1 + (timer_jiffies & TVR_MASK);
+	else
+		head = tv5 + ((expires >> (TVR_BITS + 3 * TVN_BITS)) & TVN_MASK);
+	timer->next = head;
+	timer->prev = head->prev;
+	head->prev->next = timer;
+	head->prev = timer;
+}
+
+static inline void detach_timer(struct timer_list *timer)
+{
+	timer->next->prev = timer->prev;
+	timer->prev->next = timer->next;
+	timer->next = timer->prev = NULL;
+}
+
+/*
+ * Move the timers in one slot of an outer level down the wheel.
+ */
+static inline void cascade_timers(struct timer_list *head)
+{
+	struct timer_list *timer;
+
+	while ((timer = head->next) != head) {
+		detach_timer(timer);
+		internal_add_timer(timer);
+	}
+}
+
 void add_timer(struct timer_list * timer)
 {
 	unsigned long flags;
-	struct timer_list *p;
 
 #if SLOW_BUT_DEBUGGING_TIMERS
 	if (timer->next || timer->prev) {
@@ -324,58 +406,79 @@ void add_timer(struct timer_list * timer)
 		return;
 	}
 #endif
-	p = &timer_head;
 	timer->expires += jiffies;
 	save_flags(flags);
 	cli();
-	do {
-		p = p->next;
-	} while (timer->expires > p->expires);
-	timer->next = p;
-	timer->prev = p->prev;
-	p->prev = timer;
-	timer->prev->next = timer;
+	internal_add_timer(timer);
 	restore_flags(flags);
 }
 
 int del_timer(struct timer_list * timer)
 {
 	unsigned long flags;
-#if SLOW_BUT_DEBUGGING_TIMERS
-	struct timer_list * p;
 
-	p = &timer_head;
 	save_flags(flags);
 	cli();
-	while ((p = p->next) != &timer_head) {
-		if (p == timer) {
-			timer->next->prev = timer->prev;
-			timer->prev->next = timer->next;
-			timer->next = timer->prev = NULL;
+	if (timer->next) {
+#if SLOW_BUT_DEBUGGING_TIMERS
+		if (timer->next->prev != timer || timer->prev->next != timer) {
+			printk("del_timer() called from %p with corrupt timer list\n",
+				__builtin_return_address(0));
 			restore_flags(flags);
-			timer->expires -= jiffies;
-			return 1;
+			return 0;
 		}
-	}
-	if (timer->next || timer->prev)
-		printk("del_timer() called from %p with timer not initialized\n",
-			__builtin_return_address(0));
-	restore_flags(flags);
-	return 0;
-#else	
-	save_flags(flags);
-	cli();
-	if (timer->next) {
-		timer->next->prev = timer->prev;
-		timer->prev->next = timer->next;
-		timer->next = timer->prev = NULL;
+#endif
+		detach_timer(timer);
 		restore_flags(flags);
 		timer->expires -= jiffies;
 		return 1;
 	}
+#if SLOW_BUT_DEBUGGING_TIMERS
+	if (timer->prev)
+		printk("del_timer() called from %p with timer not initialized\n",
+			__builtin_return_address(0));
+#endif
 	restore_flags(flags);
 	return 0;
-#endif
+}
+
+/*
+ * Run the timers that have expired: as before, a timer runs once
+ * jiffies has passed its expiry. Called from timer_bh() with
+ * interrupts off; they are turned on around each handler.
+ */
+static inline void run_timer_list(void)
+{
+	struct timer_list *head, *timer;
+	int index;
+
+	while ((long) (jiffies - timer_jiffies) > 0) {
+		index = timer_jiffies & TVR_MASK;
+		if (!index) {
+			int n = (timer_jiffies >> TVR_BITS) & TVN_MASK;
+			if (!n) {
+				int n3 = (timer_jiffies >> (TVR_BITS + TVN_BITS)) & TVN_MASK;
+				if (!n3) {
+					int n4 = (timer_jiffies >> (TVR_BITS + 2 * TVN_BITS)) & TVN_MASK;
+					if (!n4)
+						cascade_timers(tv5 + ((timer_jiffies >> (TVR_BITS + 3 * TVN_BITS)) & TVN_MASK));
+					cascade_timers(tv4 + n4);
+				}
+				cascade_timers(tv3 + n3);
+			}
+			cascade_timers(tv2 + n);
+		}
+		head = tv1 + index;
+		while ((timer = head->next) != head) {
+			void (*fn)(unsigned long) = timer->function;
+			unsigned long data = timer->data;
+			detach_timer(timer);
+			sti();
+			fn(data);
+			cli();
+		}
+		timer_jiffies++;
+	}
 }
 
 unsigned long timer_active = 0;
@@ -487,19 +590,9 @@ static void timer_bh(void * unused)
 {
 	unsigned long mask;
 	struct timer_struct *tp;
-	struct timer_list * timer;
 
 	cli();
-	while ((timer = timer_head.next) != &timer_head && timer->expires < jiffies) {
-		void (*fn)(unsigned long) = timer->function;
-		unsigned long data = timer->data;
-		timer->next->prev = timer->prev;
-		timer->prev->next = timer->next;
-		timer->next = timer->prev = NULL;
-		sti();
-		fn(data);
-		cli();
-	}
+	run_timer_list();
 	sti();
 	
 	for (mask = 1, tp = timer_table+0 ; mask ; tp++,mask += mask) {
@@ -668,8 +761,8 @@ static void do_timer(int irq, struct pt_regs * regs)
 	itimer_ticks++;
 	if (itimer_ticks > itimer_next)
 		need_resched = 1;
-	if (timer_head.next->expires < jiffies)
-		mark_bh(TIMER_BH);
+	/* The wheel has to be turned every tick, due timers or not */
+	mark_bh(TIMER_BH);
 	if (tq_timer != &tq_last)
 		mark_bh(TQUEUE_BH);
 	sti();
@@ -779,6 +872,7 @@ void show_state(void)
 
 void sched_init(void)
 {
+	init_timervecs();
 	bh_base[TIMER_BH].routine = timer_bh;
 	bh_base[TQUEUE_BH].routine = tqueue_bh;
 	bh_base[IMMEDIATE_BH].routine = immediate_bh;
@@ -162,6 +162,80 @@ unsigned short get_new_socknum(struct proto *prot, unsigned short base)
 	return(best+base+1);
 }
 
+/*
+ *	Put a socket on the lookup hash that matches its binding. Sockets
+ *	with a full 4-tuple go on the connected table so that get_sock()
+ *	finds them with a single probe, everything else goes on the
+ *	listener table keyed by local port. The slot is remembered so the
+ *	socket can be unhashed after its addresses have been changed.
+ *	Caller must hold cli().
+ */
+
+static void hash_sock(struct sock *sk)
+{
+	struct sock **skp;
+
+	if (sk->saddr && sk->daddr && sk->dummy_th.dest)
+	{
+		sk->hash_slot = sock_ehashfn(sk->saddr, sk->num,
+					sk->daddr, sk->dummy_th.dest);
+		skp = &sk->prot->sock_ehash[sk->hash_slot];
+		sk->hashed = SOCK_EHASHED;
+	}
+	else
+	{
+		sk->hash_slot = sk->num & (SOCK_ARRAY_SIZE - 1);
+		skp = &sk->prot->sock_lhash[sk->hash_slot];
+		sk->hashed = SOCK_LHASHED;
+	}
+	sk->hash_next = *skp;
+	*skp = sk;
+}
+
+/*
+ *	Take a socket off its lookup hash. Caller must hold cli().
+ */
+
+void unhash_sock(struct sock *sk)
+{
+	struct sock **skp;
+
+	if (sk->hashed == SOCK_EHASHED)
+		skp = &sk->prot->sock_ehash[sk->hash_slot];
+	else if (sk->hashed == SOCK_LHASHED)
+		skp = &sk->prot->sock_lhash[sk->hash_slot];
+	else
+		return;
+	sk->hashed = SOCK_UNHASHED;
+	for(; *skp != NULL; skp = &(*skp)->hash_next)
+	{
+		if (*skp == sk)
+		{
+			*skp = sk->hash_next;
+			break;
+		}
+	}
+	sk->hash_next = NULL;
+}
+
+/*
+ *	Called when the addresses or ports of a bound socket change (connect,
+ *	source address selection) so that it is filed under its new 4-tuple.
+ */
+
+void rehash_sock(struct sock *sk)
+{
+	unsigned long flags;
+
+	if (sk->hashed == SOCK_UNHASHED)
+		return;
+	save_flags(flags);
+	cli();
+	unhash_sock(sk);
+	hash_sock(sk);
+	restore_flags(flags);
+}
+
 /*
  *	Add a socket into the socket tables by number.
  */
@@ -180,8 +254,11 @@ void put_sock(unsigned short num, struct sock *sk)
 	/* We can't have an interrupt re-enter here. */
 	save_flags(flags);
 	cli();
+	hash_sock(sk);
 	// 使用的socket数
 	sk->prot->inuse += 1;
+	if (sk->ip_mc_all)
+		sk->prot->mc_all_inuse[num] += 1;
 	// 最多使用的socket数
 	if (sk->prot->highestinuse < sk->prot->inuse)
 		sk->prot->highestinuse = sk->prot->inuse;
@@ -250,11 +327,14 @@ static void remove_sock(struct sock *sk1)
 	/* We can't have this changing out from under us. */
 	save_flags(flags);
 	cli();
+	unhash_sock(sk1);
 	sk2 = sk1->prot->sock_array[sk1->num &(SOCK_ARRAY_SIZE -1)];
 	// 是队列的第一个节点
 	if (sk2 == sk1) 
 	{
 		sk1->prot->inuse -= 1;
+		if (sk1->ip_mc_all)
+			sk1->prot->mc_all_inuse[sk1->num &(SOCK_ARRAY_SIZE -1)] -= 1;
 		sk1->prot->sock_array[sk1->num &(SOCK_ARRAY_SIZE -1)] = sk1->next;
 		restore_flags(flags);
 		return;
@@ -268,6 +348,8 @@ static void remove_sock(struct sock *sk1)
 	if (sk2) 
 	{
 		sk1->prot->inuse -= 1;
+		if (sk1->ip_mc_all)
+			sk1->prot->mc_all_inuse[sk1->num &(SOCK_ARRAY_SIZE -1)] -= 1;
 		sk2->next = sk1->next;
 		restore_flags(flags);
 		return;
@@ -275,6 +357,34 @@ static void remove_sock(struct sock *sk1)
 	restore_flags(flags);
 }
 
+/*
+ *	Set sk->ip_mc_all. A socket already on sock_array moves in or out
+ *	of the count of sockets on its slot that take port-wide multicasts,
+ *	which lets udp_rcv() skip the port walk when there are none.
+ */
+
+void set_sock_mc_all(struct sock *sk, int on)
+{
+	struct sock *sk1;
+	unsigned long flags;
+
+	save_flags(flags);
+	cli();
+	if (sk->ip_mc_all != on)
+	{
+		for(sk1 = sk->prot->sock_array[sk->num &(SOCK_ARRAY_SIZE -1)]; sk1 != NULL; sk1 = sk1->next)
+		{
+			if (sk1 == sk)
+			{
+				sk->prot->mc_all_inuse[sk->num &(SOCK_ARRAY_SIZE -1)] += on ? 1 : -1;
+				break;
+			}
+		}
+		sk->ip_mc_all = on;
+	}
+	restore_flags(flags);
+}
+
 /*
  *	Destroy an AF_INET socket
  */
@@ -308,6 +418,12 @@ void destroy_sock(struct sock *sk)
   	}
   	
   	/*
+	 *	Reordered TCP data is of no use to anyone now.
+	 */
+
+	tcp_ofo_purge(sk);
+
+	/*
   	 *	Don't discard received data until the user side kills its
   	 *	half of the socket.
   	 */
@@ -489,23 +605,13 @@ static int inet_listen(struct socket *sock, int backlog)
 	if(inet_autobind(sk)!=0)
 		return -EAGAIN;
 
-	/* We might as well re use these. */ 
-	/*
-	 * note that the backlog is "unsigned char", so truncate it
-	 * somewhere. We might as well truncate it to what everybody
-	 * else does..
-	 */
-	if ((unsigned) backlog > 128)
-		backlog = 128;
-	// 设置syn+已连接队列的最大长度，在tcp.c中用到
-	sk->max_ack_backlog = backlog;
+	if ((unsigned) backlog > SOMAXCONN)
+		backlog = SOMAXCONN;
+	// 设置已连接队列的最大长度，在tcp.c中用到
+	sk->max_accept_backlog = backlog;
 	// 防止多次调用listen
 	if (sk->state != TCP_LISTEN)
-	{	
-		// syn+已连接队列长度
-		sk->ack_backlog = 0;
 		sk->state = TCP_LISTEN;
-	}
 	return(0);
 }
 
@@ -556,6 +662,8 @@ static int inet_create(struct socket *sock, int protocol)
 		return(-ENOBUFS);
 	sk->num = 0;
 	sk->reuse = 0;
+	sk->hashed = SOCK_UNHASHED;
+	sk->hash_next = NULL;
 	switch(sock->type) 
 	{
 		case SOCK_STREAM:
@@ -633,6 +741,7 @@ static int inet_create(struct socket *sock, int protocol)
 #else    
 	sk->nonagle = 0;
 #endif  
+	sk->cork = 0;
 	sk->type = sock->type;
 	sk->stamp.tv_sec=0;
 	sk->protocol = protocol;
@@ -670,6 +779,21 @@ static int inet_create(struct socket *sock, int protocol)
 	sk->ack_backlog = 0;
 	sk->window = 0;
 	sk->bytes_rcv = 0;
+	sk->snd_wscale = 0;
+	sk->rcv_wscale = 0;
+	sk->wscale_ok = 0;
+	sk->tstamp_ok = 0;
+	sk->saw_tstamp = 0;
+	sk->ts_recent = 0;
+	sk->ts_recent_stamp = 0;
+	sk->sack_ok = 0;
+	sk->sack_last = 0;
+	sk->dup_acks = 0;
+	sk->in_recovery = 0;
+	sk->high_seq = 0;
+	sk->nr_dupacks = 0;
+	sk->nr_fast_retrans = 0;
+	sk->nr_timeouts = 0;
 	sk->state = TCP_CLOSE;
 	sk->dead = 0;
 	sk->ack_timed = 0;
@@ -683,10 +807,18 @@ static int inet_create(struct socket *sock, int protocol)
 	/* how many packets we should send before forcing an ack. 
 	   if this is set to zero it is the same as sk->delay_acks = 0 */
 	sk->max_ack_backlog = 0;
+	sk->syn_backlog = 0;
+	sk->accept_backlog = 0;
+	sk->max_accept_backlog = 0;
+	sk->accept_head = NULL;
+	sk->accept_tail = NULL;
+	sk->accept_next = NULL;
 	sk->inuse = 0;
 	sk->delay_acks = 0;
 	skb_queue_head_init(&sk->write_queue);
 	skb_queue_head_init(&sk->receive_queue);
+	skb_queue_head_init(&sk->out_of_order_queue);
+	sk->ofo_mem = 0;
 	sk->mtu = 576;
 	// 下层的操作函数集
 	sk->prot = prot;
@@ -702,6 +834,7 @@ static int inet_create(struct socket *sock, int protocol)
 	sk->timeout = 0;
 	sk->broadcast = 0;
 	sk->localroute = 0;
+	sk->ip_cache_rt = NULL;
 	init_timer(&sk->timer);
 	init_timer(&sk->retransmit_timer);
 	sk->timer.data = (unsigned long)sk;
@@ -726,6 +859,7 @@ static int inet_create(struct socket *sock, int protocol)
 	sk->ip_ttl=64;
 #ifdef CONFIG_IP_MULTICAST
 	sk->ip_mc_loop=1;
+	sk->ip_mc_all=1;
 	sk->ip_mc_ttl=1;
 	*sk->ip_mc_name=0;
 	sk->ip_mc_list=NULL;
@@ -929,15 +1063,21 @@ static int inet_bind(struct socket *sock, struct sockaddr *uaddr,
 				return(-EADDRINUSE);
 			}
 		}
+		/* Connections in TIME_WAIT hold the port too */
+		if (sk->prot == &tcp_prot && tcp_tw_port_busy(snum, sk->saddr, sk->reuse))
+		{
+			sti();
+			return(-EADDRINUSE);
+		}
 		sti();
 		// 保证该sk不在sock_array队列里
 		remove_sock(sk);
+		sk->daddr = 0;
+		sk->dummy_th.dest = 0;
 		// 挂载到sock_array里
 		put_sock(snum, sk);
 		// tcp头中的源端口
 		sk->dummy_th.source = ntohs(sk->num);
-		sk->daddr = 0;
-		sk->dummy_th.dest = 0;
 	}
 	return(0);
 }
@@ -1196,6 +1336,21 @@ static int inet_recvfrom(struct socket *sock, void *ubuf, int size, int noblock,
 			     (struct sockaddr_in*)sin, addr_len));
 }
 
+static int inet_recvmmsg(struct socket *sock, struct mmsghdr *vec, int vlen,
+	int noblock, unsigned flags)
+{
+	struct sock *sk = (struct sock *) sock->data;
+
+	if (sk->prot->recvmmsg == NULL)
+		return(-EOPNOTSUPP);
+	if(sk->err)
+		return inet_error(sk);
+	/* We may need to bind the socket. */
+	if(inet_autobind(sk)!=0)
+		return(-EAGAIN);
+	return(sk->prot->recvmmsg(sk, vec, vlen, noblock, flags));
+}
+
 
 static int inet_recv(struct socket *sock, void *ubuf, int size, int noblock,
 	  unsigned flags)
@@ -1238,6 +1393,44 @@ static int inet_write(struct socket *sock, char *ubuf, int size, int noblock)
 	return inet_send(sock,ubuf,size,noblock,0);
 }
 
+static int inet_sendfile(struct socket *sock, struct file *file, int size, int noblock)
+{
+	struct sock *sk = (struct sock *) sock->data;
+	if (sk->prot->sendfile == NULL)
+		return(-EINVAL);
+	if (sk->shutdown & SEND_SHUTDOWN) 
+	{
+		send_sig(SIGPIPE, current, 1);
+		return(-EPIPE);
+	}
+	if(sk->err)
+		return inet_error(sk);
+	/* We may need to bind the socket. */
+	if(inet_autobind(sk)!=0)
+		return(-EAGAIN);
+	return(sk->prot->sendfile(sk, file, size, noblock));
+}
+
+static int inet_sendmmsg(struct socket *sock, struct mmsghdr *vec, int vlen,
+	int noblock, unsigned flags)
+{
+	struct sock *sk = (struct sock *) sock->data;
+
+	if (sk->prot->sendmmsg == NULL)
+		return(-EOPNOTSUPP);
+	if (sk->shutdown & SEND_SHUTDOWN) 
+	{
+		send_sig(SIGPIPE, current, 1);
+		return(-EPIPE);
+	}
+	if(sk->err)
+		return inet_error(sk);
+	/* We may need to bind the socket. */
+	if(inet_autobind(sk)!=0)
+		return(-EAGAIN);
+	return(sk->prot->sendmmsg(sk, vec, vlen, noblock, flags));
+}
+
 static int inet_sendto(struct socket *sock, void *ubuf, int size, int noblock, 
 	    unsigned flags, struct sockaddr *sin, int addr_len)
 {
@@ -1402,6 +1595,11 @@ static int inet_ioctl(struct socket *sock, unsigned int cmd, unsigned long arg)
  * We give priority to more closely bound ports: if some socket
  * is bound to a particular foreign address, it will get the packet
  * rather than somebody listening to any address..
+ *
+ * Connected sockets are found with one probe of the 4-tuple hash, so
+ * the cost no longer grows with the number of connections sharing a
+ * local port. Only if that misses do we score the (short) chain of
+ * wildcard bound sockets on the port.
  */
 
 struct sock *get_sock(struct proto *prot, unsigned short num,
@@ -1415,6 +1613,17 @@ struct sock *get_sock(struct proto *prot, unsigned short num,
 
 	hnum = ntohs(num);
 
+	for(s = prot->sock_ehash[sock_ehashfn(laddr, hnum, raddr, rnum)];
+			s != NULL; s = s->hash_next)
+	{
+		if (s->num != hnum || s->saddr != laddr ||
+		    s->daddr != raddr || s->dummy_th.dest != rnum)
+			continue;
+		if(s->dead && (s->state == TCP_CLOSE))
+			continue;
+		return s;
+	}
+
 	/*
 	 * SOCK_ARRAY_SIZE must be a power of two.  This will work better
 	 * than a prime unless 3 or more sockets end up using the same
@@ -1424,8 +1633,8 @@ struct sock *get_sock(struct proto *prot, unsigned short num,
 	 * socket number when we choose an arbitrary one.
 	 */
 
-	for(s = prot->sock_array[hnum & (SOCK_ARRAY_SIZE - 1)];
-			s != NULL; s = s->next) 
+	for(s = prot->sock_lhash[hnum & (SOCK_ARRAY_SIZE - 1)];
+			s != NULL; s = s->hash_next) 
 	{
 		int score = 0;
 
@@ -1452,10 +1661,6 @@ struct sock *get_sock(struct proto *prot, unsigned short num,
 				continue;
 			score++;
 		}
-		/* perfect match? */
-		// 全匹配，直接返回
-		if (score == 3)
-			return s;
 		/* no, check if this is the best so far.. */
 		if (score <= badness)
 			continue;
@@ -1537,6 +1742,62 @@ struct sock *get_sock_mcast(struct sock *sk,
   	return(NULL);
 }
 
+/*
+ *	Deliver a datagram for a multicast group (laddr) to the sockets that
+ *	joined it on the device it came in on. m is a chain from
+ *	ip_mc_members(), so sockets that are not members are never looked
+ *	at. The other tests are those of get_sock_mcast().
+ *
+ *	Our own multicasts come back through the loopback device: then any
+ *	membership of the group will do, but only the socket's first one
+ *	so it gets the datagram once, even if it also joined on loopback.
+ */
+
+static int mc_member_dev_ok(struct ip_mc_member *m, struct device *dev)
+{
+	struct ip_mc_socklist *ml;
+	int i;
+
+	if (!(dev->flags & IFF_LOOPBACK))
+		return m->multidev == dev;
+	ml = m->sk->ip_mc_list;
+	for (i = 0; &ml->member[i] != m; i++)
+		if (ml->multidev[i] && ml->multiaddr[i] == m->multiaddr)
+			return 0;
+	return 1;
+}
+
+struct ip_mc_member *get_mc_member(struct ip_mc_member *m, struct proto *prot,
+				unsigned short num,
+				unsigned long raddr,
+				unsigned short rnum, unsigned long laddr,
+				struct device *dev)
+{
+	struct sock *s;
+	unsigned short hnum;
+
+	hnum = ntohs(num);
+
+	for(; m != NULL; m = m->next)
+	{
+		if (m->multiaddr != laddr || !mc_member_dev_ok(m, dev))
+			continue;
+		s = m->sk;
+		if (s->prot != prot || s->num != hnum)
+			continue;
+		if(s->dead && (s->state == TCP_CLOSE))
+			continue;
+		if(s->daddr && s->daddr!=raddr)
+			continue;
+		if (s->dummy_th.dest != rnum && s->dummy_th.dest != 0) 
+			continue;
+ 		if(s->saddr  && s->saddr!=laddr)
+			continue;
+		return(m);
+	}
+	return(NULL);
+}
+
 #endif
 
 static struct proto_ops inet_proto_ops = {
@@ -1563,6 +1824,9 @@ static struct proto_ops inet_proto_ops = {
 	inet_setsockopt,
 	inet_getsockopt,
 	inet_fcntl,
+	inet_sendfile,
+	inet_recvmmsg,
+	inet_sendmmsg,
 };
 
 extern unsigned long seq_offset;
@@ -1596,7 +1860,16 @@ void inet_proto_init(struct net_proto *pro)
 		tcp_prot.sock_array[i] = NULL;
 		udp_prot.sock_array[i] = NULL;
 		raw_prot.sock_array[i] = NULL;
+		tcp_prot.sock_lhash[i] = NULL;
+		udp_prot.sock_lhash[i] = NULL;
+		raw_prot.sock_lhash[i] = NULL;
   	}
+	for(i = 0; i < SOCK_EHASH_SIZE; i++)
+	{
+		tcp_prot.sock_ehash[i] = NULL;
+		udp_prot.sock_ehash[i] = NULL;
+		raw_prot.sock_ehash[i] = NULL;
+	}
 	tcp_prot.inuse = 0;
 	tcp_prot.highestinuse = 0;
 	udp_prot.inuse = 0;
@@ -130,6 +130,14 @@ struct arp_table
 
 #define ARP_CHECK_INTERVAL	(60 * HZ)
 
+/*
+ *	The expiry check is spread over ARP_CHECK_INTERVAL: every
+ *	ARP_CHECK_STEP a slice of the hash buckets is checked, so we never
+ *	keep interrupts off for more than one chain.
+ */
+
+#define ARP_CHECK_STEP		(HZ)
+
 enum proxy {
    PROXY_EXACT=0,
    PROXY_ANY,
@@ -142,7 +150,7 @@ static struct arp_table *arp_lookup(unsigned long paddr, enum proxy proxy);
 
 
 static struct timer_list arp_timer =
-	{ NULL, NULL, ARP_CHECK_INTERVAL, 0L, &arp_check_expire };
+	{ NULL, NULL, ARP_CHECK_STEP, 0L, &arp_check_expire };
 
 /*
  * The default arp netmask is just 255.255.255.255 which means it's
@@ -154,34 +162,160 @@ static struct timer_list arp_timer =
 
 
 /*
- * 	The size of the hash table. Must be a power of two.
- * 	Maybe we should remove hashing in the future for arp and concentrate
- * 	on Patrick Schaaf's Host-Cache-Lookup...
+ * 	The hash table starts with 2^ARP_TABLE_MIN_SHIFT buckets and is
+ *	doubled whenever the average chain gets longer than two entries,
+ *	up to 2^ARP_TABLE_MAX_SHIFT buckets. It is halved again by the
+ *	expiry check once it is mostly empty. The boot table is used
+ *	whenever we are at the minimum size, so we never allocate for the
+ *	common small LAN.
  */
 
+#define ARP_TABLE_MIN_SHIFT	4
+#define ARP_TABLE_MAX_SHIFT	12
 
-#define ARP_TABLE_SIZE  16
+static struct arp_table *arp_table_boot[1 << ARP_TABLE_MIN_SHIFT] =
+{
+	NULL,
+};
 
-/* The ugly +1 here is to cater for proxy entries. They are put in their 
-   own list for efficiency of lookup. If you don't want to find a proxy
-   entry then don't look in the last entry, otherwise do 
-*/
+static struct arp_table **arp_tables = arp_table_boot;
+static int arp_table_shift = ARP_TABLE_MIN_SHIFT;
 
-#define FULL_ARP_TABLE_SIZE (ARP_TABLE_SIZE+1)
+#define ARP_TABLE_SIZE		(1 << arp_table_shift)
 
-struct arp_table *arp_tables[FULL_ARP_TABLE_SIZE] =
+/*
+ *	Proxy entries are put in their own list. If you don't want to find
+ *	a proxy entry then don't look there, otherwise do.
+ */
+
+static struct arp_table *arp_proxies = NULL;
+
+static int arp_entries = 0;		/* Entries in the table and proxy list	*/
+static int arp_resizes = 0;		/* Times the table was rebuilt		*/
+static int arp_check_pos = 0;		/* Next bucket for the expiry check	*/
+
+/*
+ *	Multiplicative (Fibonacci) hash of the whole address. Taking the low
+ *	bits alone puts a flat subnet into very few buckets once the table
+ *	is bigger than the host part varies.
+ */
+
+#define HASH(paddr) \
+	(((ntohl(paddr) * 0x9E3779B1UL) & 0xFFFFFFFFUL) >> (32 - arp_table_shift))
+
+/*
+ *	Chain i of the table, with i == ARP_TABLE_SIZE being the proxy list.
+ *	Only valid with interrupts off.
+ */
+
+#define ARP_CHAIN(i)	((i) < ARP_TABLE_SIZE ? &arp_tables[i] : &arp_proxies)
+
+/*
+ *	Put a new entry into its chain. Called with interrupts off.
+ */
+
+static void arp_link(struct arp_table *entry, int proxy)
 {
-	NULL,
-};
+	struct arp_table **head;
 
+	if (proxy)
+		head = &arp_proxies;
+	else
+		head = &arp_tables[HASH(entry->ip)];
+	entry->next = *head;
+	*head = entry;
+	arp_entries++;
+}
 
 /*
- *	The last bits in the IP address are used for the cache lookup.
- *      A special entry is used for proxy arp entries
+ *	Rebuild the hash with 2^shift buckets. The new table is allocated
+ *	before we lock and the entries are moved with interrupts off. The
+ *	old table is read under the lock, so a resize that interrupted us
+ *	is simply rehashed again. Must be called with interrupts enabled.
  */
 
-#define HASH(paddr) 		(htonl(paddr) & (ARP_TABLE_SIZE - 1))
-#define PROXY_HASH ARP_TABLE_SIZE
+static void arp_resize(int shift)
+{
+	struct arp_table **new, **old;
+	struct arp_table *entry;
+	unsigned long flags;
+	unsigned long hash;
+	int i, oldsize;
+
+	if (shift == ARP_TABLE_MIN_SHIFT)
+		new = arp_table_boot;
+	else
+	{
+		new = (struct arp_table **) kmalloc(sizeof(struct arp_table *) << shift,
+					GFP_ATOMIC);
+		if (new == NULL)
+			return;
+		memset(new, 0, sizeof(struct arp_table *) << shift);
+	}
+
+	save_flags(flags);
+	cli();
+	old = arp_tables;
+	if (old == new)
+	{
+		restore_flags(flags);
+		return;
+	}
+	oldsize = ARP_TABLE_SIZE;
+	arp_tables = new;
+	arp_table_shift = shift;
+	for (i = 0; i < oldsize; i++)
+	{
+		while ((entry = old[i]) != NULL)
+		{
+			old[i] = entry->next;
+			hash = HASH(entry->ip);
+			entry->next = new[hash];
+			new[hash] = entry;
+		}
+	}
+	arp_check_pos = 0;
+	arp_resizes++;
+	restore_flags(flags);
+
+	if (old != arp_table_boot)
+		kfree_s(old, sizeof(struct arp_table *) * oldsize);
+}
+
+/*
+ *	Grow the table if the chains got too long. Called with interrupts
+ *	enabled after an entry was added.
+ */
+
+static void arp_grow(void)
+{
+	if (arp_entries > 2 * ARP_TABLE_SIZE && arp_table_shift < ARP_TABLE_MAX_SHIFT)
+		arp_resize(arp_table_shift + 1);
+}
+
+/*
+ *	Remove the too old entries from one chain. Called with interrupts off.
+ */
+
+static void arp_expire_chain(struct arp_table **pentry, unsigned long now)
+{
+	struct arp_table *entry;
+
+	while ((entry = *pentry) != NULL)
+	{
+		if ((now - entry->last_used) > ARP_TIMEOUT
+			&& !(entry->flags & ATF_PERM))
+		{
+			*pentry = entry->next;	/* remove from list */
+			del_timer(&entry->timer);	/* Paranoia */
+			kfree_s(entry, sizeof(struct arp_table));
+			arp_entries--;
+			ip_rt_gen++;
+		}
+		else
+			pentry = &entry->next;	/* go to next entry */
+	}
+}
 
 /*
  *	Check if there are too old entries and remove them. If the ATF_PERM
@@ -189,42 +323,55 @@ struct arp_table *arp_tables[FULL_ARP_TABLE_SIZE] =
  *	Note: Only fully resolved entries, which don't have any packets in
  *	the queue, can be deleted, since ARP_TIMEOUT is much greater than
  *	ARP_MAX_TRIES*ARP_RES_TIME.
+ *
+ *	Each run checks the next slice of the table, one chain at a time, so
+ *	that the whole table is covered once per ARP_CHECK_INTERVAL.
  */
 
 static void arp_check_expire(unsigned long dummy)
 {
-	int i;
+	int n;
 	unsigned long now = jiffies;
 	unsigned long flags;
 	save_flags(flags);
-	cli();
 
-	for (i = 0; i < FULL_ARP_TABLE_SIZE; i++)
+	if (arp_check_pos == 0)
 	{
-		struct arp_table *entry;
-		struct arp_table **pentry = &arp_tables[i];
+		cli();
+		arp_expire_chain(&arp_proxies, now);
+		restore_flags(flags);
+	}
 
-		while ((entry = *pentry) != NULL)
+	n = (ARP_TABLE_SIZE * ARP_CHECK_STEP + ARP_CHECK_INTERVAL - 1) / ARP_CHECK_INTERVAL;
+	while (n-- > 0)
+	{
+		cli();
+		if (arp_check_pos >= ARP_TABLE_SIZE)
 		{
-			if ((now - entry->last_used) > ARP_TIMEOUT
-				&& !(entry->flags & ATF_PERM))
-			{
-				*pentry = entry->next;	/* remove from list */
-				del_timer(&entry->timer);	/* Paranoia */
-				kfree_s(entry, sizeof(struct arp_table));
-			}
-			else
-				pentry = &entry->next;	/* go to next entry */
+			restore_flags(flags);
+			break;
 		}
+		arp_expire_chain(&arp_tables[arp_check_pos++], now);
+		restore_flags(flags);
+	}
+
+	/*
+	 *	End of a pass. Give the memory back if the table is mostly empty.
+	 */
+
+	if (arp_check_pos >= ARP_TABLE_SIZE)
+	{
+		arp_check_pos = 0;
+		if (arp_entries < ARP_TABLE_SIZE / 4 && arp_table_shift > ARP_TABLE_MIN_SHIFT)
+			arp_resize(arp_table_shift - 1);
 	}
-	restore_flags(flags);
 
 	/*
 	 *	Set the timer again.
 	 */
 
 	del_timer(&arp_timer);
-	arp_timer.expires = ARP_CHECK_INTERVAL;
+	arp_timer.expires = ARP_CHECK_STEP;
 	add_timer(&arp_timer);
 }
 
@@ -271,10 +418,10 @@ int arp_device_event(unsigned long event, void *ptr)
 	 
 	save_flags(flags);
 	cli();
-	for (i = 0; i < FULL_ARP_TABLE_SIZE; i++)
+	for (i = 0; i <= ARP_TABLE_SIZE; i++)
 	{
 		struct arp_table *entry;
-		struct arp_table **pentry = &arp_tables[i];
+		struct arp_table **pentry = ARP_CHAIN(i);
 
 		while ((entry = *pentry) != NULL)
 		{
@@ -283,6 +430,8 @@ int arp_device_event(unsigned long event, void *ptr)
 				*pentry = entry->next;	/* remove from list */
 				del_timer(&entry->timer);	/* Paranoia */
 				kfree_s(entry, sizeof(struct arp_table));
+				arp_entries--;
+				ip_rt_gen++;
 			}
 			else
 				pentry = &entry->next;	/* go to next entry */
@@ -373,7 +522,6 @@ static void arp_expire_request (unsigned long arg)
 {
 	struct arp_table *entry = (struct arp_table *) arg;
 	struct arp_table **pentry;
-	unsigned long hash;
 	unsigned long flags;
 
 	save_flags(flags);
@@ -413,20 +561,19 @@ static void arp_expire_request (unsigned long arg)
 	 *	I will look at it later.
 	 */
 
-	hash = HASH(entry->ip);
-
 	/* proxy entries shouldn't really time out so this is really
 	   only here for completeness
 	*/
 	if (entry->flags & ATF_PUBL)
-	  pentry = &arp_tables[PROXY_HASH];
+	  pentry = &arp_proxies;
 	else
-	  pentry = &arp_tables[hash];
+	  pentry = &arp_tables[HASH(entry->ip)];
 	while (*pentry != NULL)
 	{
 		if (*pentry == entry)
 		{
 			*pentry = entry->next;	/* delete from linked list */
+			arp_entries--;
 			del_timer(&entry->timer);
 			restore_flags(flags);
 			arp_release_entry(entry);
@@ -501,13 +648,12 @@ void arp_destroy(unsigned long ip_addr, int force)
         int checked_proxies = 0;
 	struct arp_table *entry;
 	struct arp_table **pentry;
-	unsigned long hash = HASH(ip_addr);
 
 ugly:
 	cli();
-	pentry = &arp_tables[hash];
+	pentry = &arp_tables[HASH(ip_addr)];
 	if (! *pentry) /* also check proxy entries */
-	  pentry = &arp_tables[PROXY_HASH];
+	  pentry = &arp_proxies;
 
 	while ((entry = *pentry) != NULL)
 	{
@@ -517,6 +663,8 @@ ugly:
 				return;
 			*pentry = entry->next;
 			del_timer(&entry->timer);
+			arp_entries--;
+			ip_rt_gen++;
 			sti();
 			arp_release_entry(entry);
 			/* this would have to be cleaned up */
@@ -531,7 +679,7 @@ ugly:
 		  { /* ugly. we have to make sure we check proxy
 		       entries as well */
 		    checked_proxies = 1;
-		    pentry = &arp_tables[PROXY_HASH];
+		    pentry = &arp_proxies;
 		  }
 	}
 	sti();
@@ -555,7 +703,6 @@ int arp_rcv(struct sk_buff *skb, struct device *dev, struct packet_type *pt)
 	struct arp_table *entry;
 	struct arp_table *proxy_entry;
 	int addr_hint,hlen,htype;
-	unsigned long hash;
 	unsigned char ha[MAX_ADDR_LEN];	/* So we can enable ints again. */
 	long sip,tip;
 	unsigned char *sha,*tha;
@@ -681,7 +828,7 @@ int arp_rcv(struct sk_buff *skb, struct device *dev, struct packet_type *pt)
  * 	we can toss it.
  */
 			cli();
-			for(proxy_entry=arp_tables[PROXY_HASH];
+			for(proxy_entry=arp_proxies;
 			    proxy_entry;
 			    proxy_entry = proxy_entry->next)
 			{
@@ -729,17 +876,19 @@ int arp_rcv(struct sk_buff *skb, struct device *dev, struct packet_type *pt)
  * there.
  */
 
-	hash = HASH(sip);
 	cli();
-	for(entry=arp_tables[hash];entry;entry=entry->next)
+	for(entry=arp_tables[HASH(sip)];entry;entry=entry->next)
 		if(entry->ip==sip && entry->htype==htype)
 			break;
 
 	if(entry)
 	{
 /*
- *	Entry found; update it.
+ *	Entry found; update it. If the station moved, cached headers
+ *	are stale.
  */
+		if (memcmp(entry->ha, sha, hlen))
+			ip_rt_gen++;
 		memcpy(entry->ha, sha, hlen);
 		entry->hlen = hlen;
 		entry->last_used = jiffies;
@@ -789,9 +938,9 @@ int arp_rcv(struct sk_buff *skb, struct device *dev, struct packet_type *pt)
 		entry->last_used = jiffies;
 		entry->dev = skb->dev;
 		skb_queue_head_init(&entry->skb);
-		entry->next = arp_tables[hash];
-		arp_tables[hash] = entry;
+		arp_link(entry, 0);
 		sti();
+		arp_grow();
 	}
 
 /*
@@ -810,7 +959,6 @@ int arp_find(unsigned char *haddr, unsigned long paddr, struct device *dev,
 	   unsigned long saddr, struct sk_buff *skb)
 {
 	struct arp_table *entry;
-	unsigned long hash;
 #ifdef CONFIG_IP_MULTICAST
 	unsigned long taddr;
 #endif	
@@ -848,7 +996,6 @@ int arp_find(unsigned char *haddr, unsigned long paddr, struct device *dev,
 			return 0;
 	}
 
-	hash = HASH(paddr);
 	cli();
 
 	/*
@@ -906,8 +1053,7 @@ int arp_find(unsigned char *haddr, unsigned long paddr, struct device *dev,
 		entry->timer.function = arp_expire_request;
 		entry->timer.data = (unsigned long)entry;
 		entry->timer.expires = ARP_RES_TIME;
-		entry->next = arp_tables[hash];
-		arp_tables[hash] = entry;
+		arp_link(entry, 0);
 		add_timer(&entry->timer);
 		entry->retries = ARP_MAX_TRIES;
 		skb_queue_head_init(&entry->skb);
@@ -923,6 +1069,8 @@ int arp_find(unsigned char *haddr, unsigned long paddr, struct device *dev,
 			kfree_skb(skb, FREE_WRITE);
   	}
 	sti();
+	if (entry != NULL)
+		arp_grow();
 
 	/*
 	 *	If we didn't find an entry, we will try to send an ARP packet.
@@ -935,6 +1083,33 @@ int arp_find(unsigned char *haddr, unsigned long paddr, struct device *dev,
 }
 
 
+/*
+ *	Look for a resolved mapping without any side effects: nothing is
+ *	queued and no request is sent if we don't have one. Used to fill
+ *	the socket header caches. Returns 1 and the hardware address if
+ *	the entry is complete.
+ */
+
+int arp_find_cache(unsigned char *haddr, unsigned long paddr, struct device *dev)
+{
+	struct arp_table *entry;
+	unsigned long flags;
+	int found = 0;
+
+	save_flags(flags);
+	cli();
+	entry = arp_lookup(paddr, PROXY_NONE);
+	if (entry != NULL && (entry->flags & ATF_COM) && entry->dev == dev)
+	{
+		entry->last_used = jiffies;
+		memcpy(haddr, entry->ha, dev->addr_len);
+		found = 1;
+	}
+	restore_flags(flags);
+	return found;
+}
+
+
 /*
  *	Write the contents of the ARP cache to a PROCfs file.
  */
@@ -958,9 +1133,9 @@ int arp_get_info(char *buffer, char **start, off_t offset, int length)
 	len+=size;
 	  
 	cli();
-	for(i=0; i<FULL_ARP_TABLE_SIZE; i++)
+	for(i=0; i<=ARP_TABLE_SIZE; i++)
 	{
-		for(entry=arp_tables[i]; entry!=NULL; entry=entry->next)
+		for(entry=*ARP_CHAIN(i); entry!=NULL; entry=entry->next)
 		{
 /*
  *	Convert hardware address to XX:XX:XX:XX ... form.
@@ -1016,6 +1191,59 @@ int arp_get_info(char *buffer, char **start, off_t offset, int length)
 }
 
 
+/*
+ *	Report the table size and a histogram of the hash chain lengths
+ *	(0, 1, 2, 3, 4-7, 8-15 and 16 or more entries) for /proc/net/sockstat.
+ *	Each chain is counted with interrupts off on its own.
+ */
+
+#define ARP_HIST	7
+
+int arp_get_stats(char *buffer)
+{
+	int hist[ARP_HIST];
+	struct arp_table *entry;
+	unsigned long flags;
+	int i, n, slot, longest = 0;
+	int len;
+
+	memset(hist, 0, sizeof(hist));
+	save_flags(flags);
+	for (i = 0; ; i++)
+	{
+		cli();
+		if (i >= ARP_TABLE_SIZE)
+		{
+			restore_flags(flags);
+			break;
+		}
+		n = 0;
+		for (entry = arp_tables[i]; entry != NULL; entry = entry->next)
+			n++;
+		restore_flags(flags);
+		if (n > longest)
+			longest = n;
+		if (n < 4)
+			slot = n;
+		else if (n < 8)
+			slot = 4;
+		else if (n < 16)
+			slot = 5;
+		else
+			slot = 6;
+		hist[slot]++;
+	}
+
+	len = sprintf(buffer, "ARP: entries %d buckets %d resizes %d longest %d\n",
+		arp_entries, ARP_TABLE_SIZE, arp_resizes, longest);
+	len += sprintf(buffer+len, "ARP_HIST:");
+	for (i = 0; i < ARP_HIST; i++)
+		len += sprintf(buffer+len, " %d", hist[i]);
+	len += sprintf(buffer+len, "\n");
+	return len;
+}
+
+
 /*
  *	This will find an entry in the ARP table by looking at the IP address.
  *      If proxy is PROXY_EXACT then only exact IP matches will be allowed
@@ -1025,14 +1253,13 @@ int arp_get_info(char *buffer, char **start, off_t offset, int length)
 static struct arp_table *arp_lookup(unsigned long paddr, enum proxy proxy)
 {
 	struct arp_table *entry;
-	unsigned long hash = HASH(paddr);
 	
-	for (entry = arp_tables[hash]; entry != NULL; entry = entry->next)
+	for (entry = arp_tables[HASH(paddr)]; entry != NULL; entry = entry->next)
 		if (entry->ip == paddr) break;
 
 	/* it's possibly a proxy entry (with a netmask) */
 	if (!entry && proxy != PROXY_NONE)
-	for (entry=arp_tables[PROXY_HASH]; entry != NULL; entry = entry->next)
+	for (entry=arp_proxies; entry != NULL; entry = entry->next)
 	  if ((proxy==PROXY_EXACT) ? (entry->ip==paddr)
 	                           : !((entry->ip^paddr)&entry->mask)) 
 	    break;	  
@@ -1127,10 +1354,6 @@ static int arp_req_set(struct arpreq *req)
 	
 	if (entry == NULL)
 	{
-	        unsigned long hash = HASH(ip);
-		if (r.arp_flags & ATF_PUBL)
-		  hash = PROXY_HASH;
-
 		entry = (struct arp_table *) kmalloc(sizeof(struct arp_table),
 					GFP_ATOMIC);
 		if (entry == NULL)
@@ -1142,8 +1365,7 @@ static int arp_req_set(struct arpreq *req)
 		entry->hlen = hlen;
 		entry->htype = htype;
 		init_timer(&entry->timer);
-		entry->next = arp_tables[hash];
-		arp_tables[hash] = entry;
+		arp_link(entry, r.arp_flags & ATF_PUBL);
 		skb_queue_head_init(&entry->skb);
 	}
 	/*
@@ -1153,6 +1375,7 @@ static int arp_req_set(struct arpreq *req)
 	memcpy(&entry->ha, &r.arp_ha.sa_data, hlen);
 	entry->last_used = jiffies;
 	entry->flags = r.arp_flags | ATF_COM;
+	ip_rt_gen++;
 	if ((entry->flags & ATF_PUBL) && (entry->flags & ATF_NETMASK))
 	  {
 	    si = (struct sockaddr_in *) &r.arp_netmask;
@@ -1162,6 +1385,7 @@ static int arp_req_set(struct arpreq *req)
 	  entry->mask = DEF_ARP_NETMASK;
 	entry->dev = rt->rt_dev;
 	sti();
+	arp_grow();
 
 	return 0;
 }
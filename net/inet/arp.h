@@ -9,7 +9,10 @@ extern int	arp_rcv(struct sk_buff *skb, struct device *dev,
 			struct packet_type *pt);
 extern int	arp_find(unsigned char *haddr, unsigned long paddr,
 		struct device *dev, unsigned long saddr, struct sk_buff *skb);
+extern int	arp_find_cache(unsigned char *haddr, unsigned long paddr,
+		struct device *dev);
 extern int	arp_get_info(char *buffer, char **start, off_t origin, int length);
+extern int	arp_get_stats(char *buffer);
 extern int	arp_ioctl(unsigned int cmd, void *arg);
 extern void     arp_send(int type, int ptype, unsigned long dest_ip, 
 			 struct device *dev, unsigned long src_ip, 
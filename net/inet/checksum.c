@@ -0,0 +1,183 @@
+/*
+ * INET		An implementation of the TCP/IP protocol suite for the LINUX
+ *		operating system.  INET is implemented using the  BSD Socket
+ *		interface as the means of communication with the user level.
+ *
+ *		Internet checksum routines (RFC 1071), shared by IP, ICMP,
+ *		IGMP, TCP and UDP. They are plain C so every port gets
+ *		them: the data is summed a 32 bit word at a time into an
+ *		unsigned long with end around carry, and only folded to 16
+ *		bits at the end.
+ *
+ *		The copy variants move the data and sum it in the same pass,
+ *		so the protocols need not walk a buffer twice.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ */
+
+#include <asm/segment.h>
+#include <asm/system.h>
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/in.h>
+#include "checksum.h"
+
+
+/*
+ *	Fetch from the kernel or the user space. 'user' is a constant at every
+ *	call site, so the test goes away when do_csum() is inlined.
+ */
+
+#define LOAD32(p)	(user ? (unsigned int) get_fs_long(p) : *(const unsigned int *)(p))
+#define LOAD16(p)	(user ? (unsigned short) get_fs_word(p) : *(const unsigned short *)(p))
+#define LOAD8(p)	(user ? (unsigned char) get_fs_byte(p) : *(const unsigned char *)(p))
+
+#define CSUM_WORD(n) \
+	w = LOAD32(src + (n)); \
+	if (dst) \
+		*(unsigned int *)(dst + (n)) = w; \
+	result = csum_add(result, w)
+
+/*
+ *	Sum (and copy, if dst is not NULL) len bytes. The sum does not depend
+ *	on where the data starts, but the word loads must be aligned. If src
+ *	starts on an odd address we sum one byte on its own, which shifts the
+ *	rest of the data by a byte; the 16 bit result is then byte swapped
+ *	back (RFC 1071, "byte order independence"). The caller makes sure
+ *	dst has the same alignment as src.
+ */
+
+static inline unsigned long do_csum(const unsigned char *src, unsigned char *dst,
+	int len, int user)
+{
+	unsigned long result = 0;
+	unsigned int w;
+	unsigned short hw;
+	int odd;
+
+	if (len <= 0)
+		return 0;
+
+	odd = 1 & (unsigned long) src;
+	if (odd)
+	{
+		hw = 0;
+		((unsigned char *) &hw)[1] = LOAD8(src);
+		if (dst)
+			*dst++ = ((unsigned char *) &hw)[1];
+		result = hw;
+		src++;
+		len--;
+	}
+	if (len >= 2 && (2 & (unsigned long) src))
+	{
+		hw = LOAD16(src);
+		if (dst)
+		{
+			*(unsigned short *) dst = hw;
+			dst += 2;
+		}
+		result += hw;
+		src += 2;
+		len -= 2;
+	}
+
+	while (len >= 32)
+	{
+		CSUM_WORD(0);
+		CSUM_WORD(4);
+		CSUM_WORD(8);
+		CSUM_WORD(12);
+		CSUM_WORD(16);
+		CSUM_WORD(20);
+		CSUM_WORD(24);
+		CSUM_WORD(28);
+		src += 32;
+		if (dst)
+			dst += 32;
+		len -= 32;
+	}
+	while (len >= 4)
+	{
+		CSUM_WORD(0);
+		src += 4;
+		if (dst)
+			dst += 4;
+		len -= 4;
+	}
+
+	if (len & 2)
+	{
+		hw = LOAD16(src);
+		if (dst)
+		{
+			*(unsigned short *) dst = hw;
+			dst += 2;
+		}
+		result = csum_add(result, hw);
+		src += 2;
+	}
+	if (len & 1)
+	{
+		hw = 0;
+		((unsigned char *) &hw)[0] = LOAD8(src);
+		if (dst)
+			*dst = ((unsigned char *) &hw)[0];
+		result = csum_add(result, hw);
+	}
+
+	while (result >> 16)
+		result = (result & 0xffff) + (result >> 16);
+	if (odd)
+		result = ((result >> 8) & 0xff) | ((result & 0xff) << 8);
+	return result;
+}
+
+
+/*
+ *	Add the sum of len bytes at buff to the partial sum.
+ */
+
+unsigned long csum_partial(const unsigned char *buff, int len, unsigned long sum)
+{
+	return csum_add(sum, do_csum(buff, NULL, len, 0));
+}
+
+
+/*
+ *	Copy len bytes within the kernel and add their sum to the partial sum.
+ *	If the two buffers are not aligned alike, we cannot do word stores
+ *	safely on every machine and fall back to copying first.
+ */
+
+unsigned long csum_partial_copy(const unsigned char *src, unsigned char *dst,
+	int len, unsigned long sum)
+{
+	if (3 & ((unsigned long) src ^ (unsigned long) dst))
+	{
+		memcpy(dst, src, len);
+		return csum_partial(dst, len, sum);
+	}
+	return csum_add(sum, do_csum(src, dst, len, 0));
+}
+
+
+/*
+ *	The same for data coming from the user. The caller has done the
+ *	verify_area() already, as for memcpy_fromfs().
+ */
+
+unsigned long csum_partial_copy_fromuser(const unsigned char *src, unsigned char *dst,
+	int len, unsigned long sum)
+{
+	if (3 & ((unsigned long) src ^ (unsigned long) dst))
+	{
+		memcpy_fromfs(dst, src, len);
+		return csum_partial(dst, len, sum);
+	}
+	return csum_add(sum, do_csum(src, dst, len, 1));
+}
@@ -0,0 +1,99 @@
+/*
+ * INET		An implementation of the TCP/IP protocol suite for the LINUX
+ *		operating system.  INET is implemented using the  BSD Socket
+ *		interface as the means of communication with the user level.
+ *
+ *		Definitions for the Internet checksum routines.
+ *
+ *		A partial checksum is an unsigned long holding a one's
+ *		complement sum that has not been folded to 16 bits yet.
+ *		Partial sums of consecutive pieces can be added with
+ *		csum_add(), as long as each piece but the last has an even
+ *		length. csum_fold() turns a partial sum into the value that
+ *		goes into a header.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ */
+#ifndef _CHECKSUM_H
+#define _CHECKSUM_H
+
+/*
+ *	Add two partial sums with end around carry.
+ */
+
+static inline unsigned long csum_add(unsigned long sum, unsigned long addend)
+{
+	sum += addend;
+	return sum + (sum < addend);
+}
+
+/*
+ *	Fold a partial sum to 16 bits and complement it.
+ */
+
+static inline unsigned short csum_fold(unsigned long sum)
+{
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+	return (~sum) & 0xffff;
+}
+
+/*
+ *	Add the TCP/UDP pseudo header to the partial sum of the segment and
+ *	fold it. The addresses are in network order, len and proto in host
+ *	order.
+ */
+
+static inline unsigned short csum_tcpudp_magic(unsigned long saddr,
+	unsigned long daddr, unsigned short len, unsigned short proto,
+	unsigned long sum)
+{
+	sum = csum_add(sum, saddr);
+	sum = csum_add(sum, daddr);
+	sum = csum_add(sum, htons(len));
+	sum = csum_add(sum, htons(proto));
+	return csum_fold(sum);
+}
+
+/*
+ *	Incremental update (RFC 1624, eqn. 3): HC' = ~(~HC + ~m + m').
+ *	Adjust the checksum check for a 16 bit word that changed from old
+ *	to new. All values are as they are stored in the packet.
+ */
+
+static inline unsigned short csum_replace2(unsigned short check,
+	unsigned short old, unsigned short new)
+{
+	unsigned long sum;
+
+	sum = (~check & 0xffff) + (~old & 0xffff) + new;
+	return csum_fold(sum);
+}
+
+/*
+ *	The same for a 32 bit field such as an address.
+ */
+
+static inline unsigned short csum_replace4(unsigned short check,
+	unsigned long old, unsigned long new)
+{
+	unsigned long sum;
+
+	sum = (~check & 0xffff) + (~old & 0xffff) + ((~old >> 16) & 0xffff);
+	sum += (new & 0xffff) + ((new >> 16) & 0xffff);
+	return csum_fold(sum);
+}
+
+extern unsigned long	csum_partial(const unsigned char *buff, int len,
+				     unsigned long sum);
+extern unsigned long	csum_partial_copy(const unsigned char *src,
+					  unsigned char *dst, int len,
+					  unsigned long sum);
+extern unsigned long	csum_partial_copy_fromuser(const unsigned char *src,
+						   unsigned char *dst, int len,
+						   unsigned long sum);
+
+#endif	/* _CHECKSUM_H */
@@ -143,6 +143,36 @@ restart:
 	  return skb;
 }
 
+/*
+ *	Get up to max datagrams in one go for the batched receive calls.
+ *	Only the first may wait; the rest are whatever is queued behind it.
+ *	Returns how many were put in skbs, each to be freed with
+ *	skb_free_datagram(). As for skb_recv_datagram() the socket is still
+ *	held if any were got, and on 0 *err says why.
+ */
+
+int skb_recv_datagrams(struct sock *sk, struct sk_buff **skbs, int max,
+	unsigned flags, int noblock, int *err)
+{
+	struct sk_buff *skb;
+	int n;
+
+	skb = skb_recv_datagram(sk, flags, noblock, err);
+	if (skb == NULL)
+		return 0;
+	skbs[0] = skb;
+	n = 1;
+	/* Peeking more than one would return the same datagram again */
+	if (flags & MSG_PEEK)
+		return n;
+	while (n < max && (skb = skb_dequeue(&sk->receive_queue)) != NULL)
+	{
+		skb->users++;
+		skbs[n++] = skb;
+	}
+	return n;
+}
+
 void skb_free_datagram(struct sk_buff *skb)
 {
 	unsigned long flags;
@@ -65,11 +65,14 @@
 
 
 /*
- *	The list of packet types we will receive (as opposed to discard)
- *	and the routines to invoke.
+ *	The packet types we will receive (as opposed to discard) and the
+ *	routines to invoke. Protocols are hashed on their ID so a frame
+ *	finds its handler in one probe however many are registered; the
+ *	ETH_P_ALL taps are kept apart as they want everything.
  */
 
-struct packet_type *ptype_base = NULL;
+struct packet_type *ptype_base[PTYPE_HASH_SIZE];
+struct packet_type *ptype_all = NULL;
 
 /*
  *	Our notifier list
@@ -96,6 +99,27 @@ static struct sk_buff_head backlog =
  
 static int backlog_size = 0;
 
+/*
+ *	net_bh() takes the backlog in batches. At most net_bh_budget frames
+ *	are handled per run before we give the rest of the system a go; a
+ *	smaller budget favours latency, a larger one throughput.
+ */
+
+int net_bh_budget = NET_BH_BUDGET;
+
+/*
+ *	Batch statistics. The histogram counts batches of 1, 2-3, 4-7 ...
+ *	frames, the last slot takes everything from 128 up.
+ */
+
+#define NET_BH_HIST	8
+
+static unsigned long net_bh_batches = 0;
+static unsigned long net_bh_frames = 0;
+static unsigned long net_bh_largest = 0;
+static unsigned long net_bh_exhausted = 0;
+static unsigned long net_bh_hist[NET_BH_HIST];
+
 /*
  *	Return the lesser of the two values. 
  */
@@ -113,10 +137,16 @@ static __inline__ unsigned long min(unsigned long a, unsigned long b)
 *******************************************************************************************/
 
 /*
- *	For efficiency
+ *	Find the list a protocol ID is kept on.
  */
 
-static int dev_nit=0;
+static __inline__ struct packet_type **ptype_head(unsigned short type)
+{
+	if(type==htons(ETH_P_ALL))
+		return &ptype_all;
+	type=ntohs(type);
+	return &ptype_base[PTYPE_HASH(type)];
+}
 
 /*
  *	Add a protocol ID to the list. Now that the input handler is
@@ -126,10 +156,14 @@ static int dev_nit=0;
 // 新增一个节点到链表，该链表用于管理上层协议
 void dev_add_pack(struct packet_type *pt)
 {
-	if(pt->type==htons(ETH_P_ALL))
-		dev_nit++;
-	pt->next = ptype_base;
-	ptype_base = pt;
+	struct packet_type **head=ptype_head(pt->type);
+	unsigned long flags;
+
+	save_flags(flags);
+	cli();
+	pt->next = *head;
+	*head = pt;
+	restore_flags(flags);
 }
 
 
@@ -140,16 +174,19 @@ void dev_add_pack(struct packet_type *pt)
 void dev_remove_pack(struct packet_type *pt)
 {
 	struct packet_type **pt1;
-	if(pt->type==htons(ETH_P_ALL))
-		dev_nit--;
-	for(pt1=&ptype_base; (*pt1)!=NULL; pt1=&((*pt1)->next))
+	unsigned long flags;
+
+	save_flags(flags);
+	cli();
+	for(pt1=ptype_head(pt->type); (*pt1)!=NULL; pt1=&((*pt1)->next))
 	{
 		if(pt==(*pt1))
 		{
 			*pt1=pt->next;
-			return;
+			break;
 		}
 	}
+	restore_flags(flags);
 }
 
 /*****************************************************************************************
@@ -300,7 +337,6 @@ int unregister_netdevice_notifier(struct notifier_block *nb)
 void dev_queue_xmit(struct sk_buff *skb, struct device *dev, int pri)
 {
 	unsigned long flags;
-	int nitcount;
 	struct packet_type *ptype;
 	int where = 0;		/* used to say if the packet should go	*/
 				/* at the front or the back of the	*/
@@ -400,14 +436,13 @@ void dev_queue_xmit(struct sk_buff *skb, struct device *dev, int pri)
 	if(!where)
 	{	
 		// 把所有发出去的数据包传一份给其他协议
-		for (nitcount= dev_nit, ptype = ptype_base; nitcount > 0 && ptype != NULL; ptype = ptype->next) 
+		for (ptype = ptype_all; ptype != NULL; ptype = ptype->next) 
 		{
 			/* Never send packets back to the socket
 			 * they originated from - MvS (miquels@drinkel.ow.org)
 			 */
 			// 对所有包都感兴趣的、不是packet协议产生的packet_type节点
-			if (ptype->type == htons(ETH_P_ALL) &&
-			   (ptype->dev == dev || !ptype->dev) &&
+			if ((ptype->dev == dev || !ptype->dev) &&
 			   ((struct sock *)ptype->data != skb->sk))
 			{
 				struct sk_buff *skb2;
@@ -419,7 +454,6 @@ void dev_queue_xmit(struct sk_buff *skb, struct device *dev, int pri)
 				 */
 				skb2->len-=skb->dev->hard_header_len;
 				ptype->func(skb2, skb->dev, ptype);
-				nitcount--;
 			}
 		}
 	}
@@ -638,12 +672,50 @@ int in_net_bh()	/* Used by timer.c */
  *	mark_bh(NET_BH);
  */
  
+/*
+ *	Take the next frame off a private batch list. Nobody else can see
+ *	the list so there is no need to lock it.
+ */
+
+static __inline__ struct sk_buff *net_bh_dequeue(struct sk_buff_head *list_)
+{
+	struct sk_buff *list = (struct sk_buff *)list_;
+	struct sk_buff *skb = list->next;
+
+	if (skb == list)
+		return NULL;
+	list->next = skb->next;
+	skb->next->prev = list;
+	skb->next = NULL;
+	skb->prev = NULL;
+	return skb;
+}
+
+static void net_bh_account(unsigned long frames)
+{
+	int slot = 0;
+
+	net_bh_batches++;
+	net_bh_frames += frames;
+	if (frames > net_bh_largest)
+		net_bh_largest = frames;
+	while (frames > 1 && slot < NET_BH_HIST - 1)
+	{
+		frames >>= 1;
+		slot++;
+	}
+	net_bh_hist[slot]++;
+}
+
 void net_bh(void *tmp)
 {
+	struct sk_buff_head batch;
 	struct sk_buff *skb;
 	struct packet_type *ptype;
 	struct packet_type *pt_prev;
 	unsigned short type;
+	int budget;
+	int count;
 
 	/*
 	 *	Atomically check and mark our BUSY state. 
@@ -659,128 +731,189 @@ void net_bh(void *tmp)
 	 */
 	// 发送缓存的数据包
 	dev_transmit();
-  
-	/*
-	 *	Any data left to process. This may occur because a
-	 *	mark_bh() is done after we empty the queue including
-	 *	that from the device which does a mark_bh() just after
-	 */
 
-	cli();
-	
-	/*
-	 *	While the queue is not empty
-	 */
-	// backlog队列的数据包来源于网卡收到的数据包	 
-	while((skb=skb_dequeue(&backlog))!=NULL)
+	budget = net_bh_budget;
+	if (budget <= 0)
+		budget = 1;
+
+	while (budget > 0)
 	{
 		/*
-		 *	We have a packet. Therefore the queue has shrunk
+		 *	Splice everything the drivers have queued onto our own
+		 *	list with a single interrupt disable. Anything that
+		 *	arrives while we work goes on the backlog as usual and
+		 *	is picked up by the next batch.
 		 */
-  		backlog_size--;
 
+		cli();
+		if (backlog.next == (struct sk_buff *)&backlog)
+		{
+			sti();
+			break;
+		}
+		batch.next = backlog.next;
+		batch.prev = backlog.prev;
+		batch.next->prev = (struct sk_buff *)&batch;
+		batch.prev->next = (struct sk_buff *)&batch;
+		backlog.next = backlog.prev = (struct sk_buff *)&backlog;
+		backlog_size = 0;
 		sti();
-		
-	       /*
-		*	Bump the pointer to the next structure.
-		*	This assumes that the basic 'skb' pointer points to
-		*	the MAC header, if any (as indicated by its "length"
-		*	field).  Take care now!
-		*/
-		// 指向ip头
-		skb->h.raw = skb->data + skb->dev->hard_header_len;
-		// 减去mac头长度
-		skb->len -= skb->dev->hard_header_len;
-
-	       /*
-		* 	Fetch the packet protocol ID.  This is also quite ugly, as
-		* 	it depends on the protocol driver (the interface itself) to
-		* 	know what the type is, or where to get it from.  The Ethernet
-		* 	interfaces fetch the ID from the two bytes in the Ethernet MAC
-		*	header (the h_proto field in struct ethhdr), but other drivers
-		*	may either use the ethernet ID's or extra ones that do not
-		*	clash (eg ETH_P_AX25). We could set this before we queue the
-		*	frame. In fact I may change this when I have time.
-		*/
-		// 判断上层协议
-		type = skb->dev->type_trans(skb, skb->dev);
 
-		/*
-		 *	We got a packet ID.  Now loop over the "known protocols"
-		 *	table (which is actually a linked list, but this will
-		 *	change soon if I get my way- FvK), and forward the packet
-		 *	to anyone who wants it.
-		 *
-		 *	[FvK didn't get his way but he is right this ought to be
-		 *	hashed so we typically get a single hit. The speed cost
-		 *	here is minimal but no doubt adds up at the 4,000+ pkts/second
-		 *	rate we can hit flat out]
-		 */
-		pt_prev = NULL;
-		for (ptype = ptype_base; ptype != NULL; ptype = ptype->next) 
+		count = 0;
+		while (budget > 0 && (skb = net_bh_dequeue(&batch)) != NULL)
 		{
-			if ((ptype->type == type || ptype->type == htons(ETH_P_ALL)) && (!ptype->dev || ptype->dev==skb->dev))
+			budget--;
+			count++;
+
+		       /*
+			*	Bump the pointer to the next structure.
+			*	This assumes that the basic 'skb' pointer points to
+			*	the MAC header, if any (as indicated by its "length"
+			*	field).  Take care now!
+			*/
+			// 指向ip头
+			skb->h.raw = skb->data + skb->dev->hard_header_len;
+			// 减去mac头长度
+			skb->len -= skb->dev->hard_header_len;
+
+		       /*
+			* 	Fetch the packet protocol ID.  This is also quite ugly, as
+			* 	it depends on the protocol driver (the interface itself) to
+			* 	know what the type is, or where to get it from.  The Ethernet
+			* 	interfaces fetch the ID from the two bytes in the Ethernet MAC
+			*	header (the h_proto field in struct ethhdr), but other drivers
+			*	may either use the ethernet ID's or extra ones that do not
+			*	clash (eg ETH_P_AX25). We could set this before we queue the
+			*	frame. In fact I may change this when I have time.
+			*/
+			// 判断上层协议
+			type = skb->dev->type_trans(skb, skb->dev);
+
+			/*
+			 *	We got a packet ID.  Hand the frame to any taps, then to
+			 *	the handlers hashed under its ID. The last match gets the
+			 *	original buffer, everyone before it a clone.
+			 */
+			pt_prev = NULL;
+			for (ptype = ptype_all; ptype != NULL; ptype = ptype->next)
 			{
-				/*
-				 *	We already have a match queued. Deliver
-				 *	to it and then remember the new match
-				 */
-				// 如果有匹配的项则要单独复制一份skb
-				if(pt_prev)
+				if (!ptype->dev || ptype->dev==skb->dev)
+				{
+					if(pt_prev)
+					{
+						struct sk_buff *skb2;
+
+						skb2=skb_clone(skb, GFP_ATOMIC);
+						if(skb2)
+							pt_prev->func(skb2, skb->dev, pt_prev);
+					}
+					pt_prev=ptype;
+				}
+			}
+			for (ptype = ptype_base[PTYPE_HASH(ntohs(type))]; ptype != NULL; ptype = ptype->next) 
+			{
+				if (ptype->type == type && (!ptype->dev || ptype->dev==skb->dev))
 				{
-					struct sk_buff *skb2;
-
-					skb2=skb_clone(skb, GFP_ATOMIC);
-
 					/*
-					 *	Kick the protocol handler. This should be fast
-					 *	and efficient code.
+					 *	We already have a match queued. Deliver
+					 *	to it and then remember the new match
 					 */
-
-					if(skb2)
-						pt_prev->func(skb2, skb->dev, pt_prev);
+					// 如果有匹配的项则要单独复制一份skb
+					if(pt_prev)
+					{
+						struct sk_buff *skb2;
+
+						skb2=skb_clone(skb, GFP_ATOMIC);
+
+						/*
+						 *	Kick the protocol handler. This should be fast
+						 *	and efficient code.
+						 */
+
+						if(skb2)
+							pt_prev->func(skb2, skb->dev, pt_prev);
+					}
+					/* Remember the current last to do */
+					// 记录最近匹配的项
+					pt_prev=ptype;
 				}
-				/* Remember the current last to do */
-				// 记录最近匹配的项
-				pt_prev=ptype;
-			}
-		} /* End of protocol list loop */
-		
-		/*
-		 *	Is there a last item to send to ?
-		 */
-		// 把数据包交给上层协议处理，大于一个匹配项，则把skb复制给最后一项，否则销毁skb
-		if(pt_prev)
-			pt_prev->func(skb, skb->dev, pt_prev);
+			} /* End of protocol list loop */
+			
+			/*
+			 *	Is there a last item to send to ?
+			 */
+			// 把数据包交给上层协议处理，大于一个匹配项，则把skb复制给最后一项，否则销毁skb
+			if(pt_prev)
+				pt_prev->func(skb, skb->dev, pt_prev);
+			/*
+			 * 	Has an unknown packet has been received ?
+			 */
+		 
+			else
+				kfree_skb(skb, FREE_WRITE);
+		}
+
+		net_bh_account(count);
+
 		/*
-		 * 	Has an unknown packet has been received ?
+		 *	Flush anything the batch generated in one go rather
+		 *	than after every frame.
 		 */
-	 
-		else
-			kfree_skb(skb, FREE_WRITE);
+
+		dev_transmit();
 
 		/*
-		 *	Again, see if we can transmit anything now. 
-		 *	[Ought to take this out judging by tests it slows
-		 *	 us down not speeds us up]
+		 *	Out of budget. Put what is left back at the head of the
+		 *	backlog so ordering is kept and come back for it later.
 		 */
 
-		dev_transmit();
-		cli();
-  	}	/* End of queue loop */
-  	
-  	/*
-  	 *	We have emptied the queue
-  	 */
-  	// 处理完毕 
-  	in_bh = 0;
-	sti();
-	
+		if (batch.next != (struct sk_buff *)&batch)
+		{
+			count = 0;
+			for (skb = batch.next; skb != (struct sk_buff *)&batch; skb = skb->next)
+				count++;
+			cli();
+			batch.prev->next = backlog.next;
+			backlog.next->prev = batch.prev;
+			backlog.next = batch.next;
+			batch.next->prev = (struct sk_buff *)&backlog;
+			backlog_size += count;
+			sti();
+		}
+	}
+
 	/*
-	 *	One last output flush.
+	 *	Still work to do: let the rest of the system in and get
+	 *	called again.
 	 */
-	 
-	dev_transmit();
+
+	if (budget <= 0 && backlog.next != (struct sk_buff *)&backlog)
+	{
+		net_bh_exhausted++;
+		mark_bh(NET_BH);
+	}
+
+  	// 处理完毕 
+  	in_bh = 0;
+}
+
+/*
+ *	Batch statistics for /proc/net/sockstat.
+ */
+
+int net_bh_get_info(char *buffer)
+{
+	int len;
+	int i;
+
+	len = sprintf(buffer, "NET_BH: budget %d batches %lu frames %lu largest %lu exhausted %lu\n",
+		net_bh_budget, net_bh_batches, net_bh_frames,
+		net_bh_largest, net_bh_exhausted);
+	len += sprintf(buffer+len, "NET_BH_HIST:");
+	for (i = 0; i < NET_BH_HIST; i++)
+		len += sprintf(buffer+len, " %lu", net_bh_hist[i]);
+	len += sprintf(buffer+len, "\n");
+	return len;
 }
 
 
@@ -304,6 +304,65 @@ void ip_mc_allhost(struct device *dev)
 
 }	
  
+/*
+ *	Socket memberships, hashed by group. Changed with interrupts off,
+ *	walked from the bottom half.
+ */
+
+static struct ip_mc_member *ip_mc_hash[IP_MC_HASH_SIZE];
+
+static inline int ip_mc_hashfn(unsigned long addr)
+{
+	addr = ntohl(addr);
+	return (addr ^ (addr >> 8)) & (IP_MC_HASH_SIZE - 1);
+}
+
+static void ip_mc_hash_member(struct sock *sk, int i)
+{
+	struct ip_mc_member *m = &sk->ip_mc_list->member[i];
+	struct ip_mc_member **mp;
+	unsigned long flags;
+
+	m->sk = sk;
+	m->multiaddr = sk->ip_mc_list->multiaddr[i];
+	m->multidev = sk->ip_mc_list->multidev[i];
+	mp = &ip_mc_hash[ip_mc_hashfn(m->multiaddr)];
+	save_flags(flags);
+	cli();
+	m->next = *mp;
+	*mp = m;
+	restore_flags(flags);
+}
+
+static void ip_mc_unhash_member(struct sock *sk, int i)
+{
+	struct ip_mc_member *m = &sk->ip_mc_list->member[i];
+	struct ip_mc_member **mp;
+	unsigned long flags;
+
+	save_flags(flags);
+	cli();
+	for (mp = &ip_mc_hash[ip_mc_hashfn(m->multiaddr)]; *mp != NULL; mp = &(*mp)->next)
+	{
+		if (*mp == m)
+		{
+			*mp = m->next;
+			break;
+		}
+	}
+	restore_flags(flags);
+	m->next = NULL;
+}
+
+/*
+ *	The chain a group's members are on. It holds other groups too.
+ */
+
+struct ip_mc_member *ip_mc_members(unsigned long addr)
+{
+	return ip_mc_hash[ip_mc_hashfn(addr)];
+}
+
 /*
  *	Join a socket to a group
  */
@@ -334,6 +393,7 @@ int ip_mc_join_group(struct sock *sk , struct device *dev, unsigned long addr)
 		return -ENOBUFS;
 	sk->ip_mc_list->multiaddr[unused]=addr;
 	sk->ip_mc_list->multidev[unused]=dev;
+	ip_mc_hash_member(sk,unused);
 	ip_mc_inc_group(dev,addr);
 	return 0;
 }
@@ -356,6 +416,7 @@ int ip_mc_leave_group(struct sock *sk, struct device *dev, unsigned long addr)
 	{
 		if(sk->ip_mc_list->multiaddr[i]==addr && sk->ip_mc_list->multidev[i]==dev)
 		{
+			ip_mc_unhash_member(sk,i);
 			sk->ip_mc_list->multidev[i]=NULL;
 			ip_mc_dec_group(dev,addr);
 			return 0;
@@ -379,6 +440,7 @@ void ip_mc_drop_socket(struct sock *sk)
 	{
 		if(sk->ip_mc_list->multidev[i])
 		{
+			ip_mc_unhash_member(sk,i);
 			ip_mc_dec_group(sk->ip_mc_list->multidev[i], sk->ip_mc_list->multiaddr[i]);
 			sk->ip_mc_list->multidev[i]=NULL;
 		}
@@ -236,6 +236,7 @@ int ip_build_header(struct sk_buff *skb, unsigned long saddr, unsigned long dadd
 	static struct options optmem;
 	struct iphdr *iph;
 	struct rtable *rt;
+	struct sock *sk = skb->sk;
 	unsigned char *buff;
 	unsigned long raddr;
 	int tmp;
@@ -251,6 +252,38 @@ int ip_build_header(struct sk_buff *skb, unsigned long saddr, unsigned long dadd
 	if(MULTICAST(daddr) && *dev==NULL && skb->sk && *skb->sk->ip_mc_name)
 		*dev=dev_get(skb->sk->ip_mc_name);
 #endif
+
+	/*
+	 *	Sockets keep the result of the last lookup. If nothing in the
+	 *	routing or ARP tables changed since, and we are going the same
+	 *	way, skip both the route lookup and ARP.
+	 */
+
+	if (sk != NULL && sk->ip_cache_rt != NULL && sk->ip_cache_gen == ip_rt_gen &&
+	    sk->ip_cache_daddr == daddr && sk->ip_cache_local == skb->localroute &&
+	    (*dev == NULL || *dev == sk->ip_cache_dev))
+	{
+		rt = sk->ip_cache_rt;
+		rt->rt_use++;
+		*dev = sk->ip_cache_dev;
+		src = sk->ip_cache_src;
+		if (LOOPBACK(saddr) && !LOOPBACK(daddr))
+			saddr = src;
+		if (saddr == 0)
+			saddr = src;
+		if (sk->ip_cache_hhlen >= 0)
+		{
+			tmp = sk->ip_cache_hhlen;
+			memcpy(buff, sk->ip_cache_hh, tmp);
+			skb->dev = *dev;
+			skb->arp = 1;
+			skb->raddr = sk->ip_cache_raddr;
+		}
+		else
+			tmp = ip_send(skb, sk->ip_cache_raddr, len, *dev, saddr);
+		goto built;
+	}
+
 	// 没有dev则随便找一个能到目的ip的设备和下一跳路由
 	if (*dev == NULL)
 	{
@@ -314,6 +347,40 @@ int ip_build_header(struct sk_buff *skb, unsigned long saddr, unsigned long dadd
 	 */
 	// 构建mac头,返回mac头的大小
 	tmp = ip_send(skb, raddr, len, *dev, saddr);
+
+	/*
+	 *	Remember how we got here. The hardware header can be kept if
+	 *	it does not depend on the frame (no header at all, or an
+	 *	ethernet one once ARP has the address); ARP is only asked if
+	 *	it already knows the answer.
+	 */
+
+	if (sk != NULL && rt != NULL && rt->rt_dev == *dev)
+	{
+		sk->ip_cache_rt = rt;
+		sk->ip_cache_gen = ip_rt_gen;
+		sk->ip_cache_daddr = daddr;
+		sk->ip_cache_src = src;
+		sk->ip_cache_raddr = raddr;
+		sk->ip_cache_dev = *dev;
+		sk->ip_cache_local = skb->localroute;
+		sk->ip_cache_hhlen = -1;
+		if ((*dev)->hard_header == NULL)
+			sk->ip_cache_hhlen = 0;
+		else if ((*dev)->type == ARPHRD_ETHER && tmp <= MAX_HEADER)
+		{
+			if (!skb->arp && ip_chk_addr(raddr) == 0 &&
+			    arp_find_cache(((struct ethhdr *)buff)->h_dest, raddr, *dev))
+				skb->arp = 1;
+			if (skb->arp)
+			{
+				memcpy(sk->ip_cache_hh, buff, tmp);
+				sk->ip_cache_hhlen = tmp;
+			}
+		}
+	}
+
+built:
 	// 更新可写地址
 	buff += tmp;
 	// 更新可写字节大小
@@ -325,8 +392,16 @@ int ip_build_header(struct sk_buff *skb, unsigned long saddr, unsigned long dadd
 
 	skb->dev = *dev;
 	skb->saddr = saddr;
-	if (skb->sk)
+	/*
+	 *	The socket takes on the source address its route picked,
+	 *	except for UDP: that stays bound as it was and passes the
+	 *	socket only so that the route above is cached.
+	 */
+	if (skb->sk && skb->sk->type != SOCK_DGRAM && skb->sk->saddr != saddr)
+	{
 		skb->sk->saddr = saddr;
+		rehash_sock(skb->sk);
+	}
 
 	/*
 	 *	Now build the IP header.
@@ -519,46 +594,7 @@ do_options(struct iphdr *iph, struct options *opt)
 
 unsigned short ip_compute_csum(unsigned char * buff, int len)
 {
-	unsigned long sum = 0;
-
-	/* Do the first multiple of 4 bytes and convert to 16 bits. */
-	if (len > 3)
-	{
-		__asm__("clc\n"
-		"1:\t"
-		"lodsl\n\t"
-		"adcl %%eax, %%ebx\n\t"
-		"loop 1b\n\t"
-		"adcl $0, %%ebx\n\t"
-		"movl %%ebx, %%eax\n\t"
-		"shrl $16, %%eax\n\t"
-		"addw %%ax, %%bx\n\t"
-		"adcw $0, %%bx"
-		: "=b" (sum) , "=S" (buff)
-		: "0" (sum), "c" (len >> 2) ,"1" (buff)
-		: "ax", "cx", "si", "bx" );
-	}
-	if (len & 2)
-	{
-		__asm__("lodsw\n\t"
-		"addw %%ax, %%bx\n\t"
-		"adcw $0, %%bx"
-		: "=b" (sum), "=S" (buff)
-		: "0" (sum), "1" (buff)
-		: "bx", "ax", "si");
-	}
-	if (len & 1)
-	{
-		__asm__("lodsb\n\t"
-		"movb $0, %%ah\n\t"
-		"addw %%ax, %%bx\n\t"
-		"adcw $0, %%bx"
-		: "=b" (sum), "=S" (buff)
-		: "0" (sum), "1" (buff)
-		: "bx", "ax", "si");
-	}
-	sum =~sum;
-	return(sum & 0xffff);
+	return csum_fold(csum_partial(buff, len, 0));
 }
 
 /*
@@ -579,7 +615,29 @@ void ip_send_check(struct iphdr *iph)
  *	happily and handles things quite well.
  */
 
-static struct ipq *ipqueue = NULL;		/* IP fragment queue	*/
+/*
+ *	Incomplete datagrams are hashed on (id, saddr, daddr, protocol).
+ *	All queues are also kept on an age list, oldest first, so we can
+ *	drop the oldest ones when fragments use too much memory.
+ */
+
+static struct ipq *ipq_hash[IPQ_HASHSZ];	/* IP fragment queues	*/
+static struct ipq *ipq_oldest = NULL;
+static struct ipq *ipq_newest = NULL;
+
+static int ip_frag_mem = 0;			/* Memory used by queues	*/
+static int ip_frag_queues = 0;
+static unsigned long ip_frag_evicted = 0;
+
+static inline int ipqhashfn(unsigned short id, unsigned long saddr,
+			    unsigned long daddr, unsigned char prot)
+{
+	unsigned long h = saddr ^ daddr ^ ((unsigned long)id << 16) ^ prot;
+
+	h ^= h >> 16;
+	h ^= h >> 8;
+	return h & (IPQ_HASHSZ - 1);
+}
 
 /*
  *	Create a new fragment entry.
@@ -608,6 +666,22 @@ static struct ipfrag *ip_frag_create(int offset, int end, struct sk_buff *skb, u
 }
 
 
+/*
+ *	Release one fragment and uncharge its memory from the queue.
+ */
+
+static void ip_frag_free(struct ipq *qp, struct ipfrag *fp)
+{
+	int mem = sizeof(struct ipfrag) + fp->skb->mem_len;
+
+	qp->mem -= mem;
+	ip_frag_mem -= mem;
+	IS_SKB(fp->skb);
+	kfree_skb(fp->skb,FREE_READ);
+	kfree_s(fp, sizeof(struct ipfrag));
+}
+
+
 /*
  *	Find the correct entry in the "incomplete datagrams" queue for
  *	this IP datagram, and return the queue entry address if found.
@@ -616,11 +690,10 @@ static struct ipfrag *ip_frag_create(int offset, int end, struct sk_buff *skb, u
 static struct ipq *ip_find(struct iphdr *iph)
 {
 	struct ipq *qp;
-	struct ipq *qplast;
 
 	cli();
-	qplast = NULL;
-	for(qp = ipqueue; qp != NULL; qplast = qp, qp = qp->next)
+	for(qp = ipq_hash[ipqhashfn(iph->id, iph->saddr, iph->daddr, iph->protocol)];
+	    qp != NULL; qp = qp->next)
 	{	// 对比ip头里的几个字段
 		if (iph->id== qp->iph->id && iph->saddr == qp->iph->saddr &&
 			iph->daddr == qp->iph->daddr && iph->protocol == qp->iph->protocol)
@@ -656,14 +729,16 @@ static void ip_free(struct ipq *qp)
 	cli();
 	/* 
 		被删除的节点前面没有节点说明他是第一个节点，因为不是循环链表，
-		修改首指针ipqueue指向被删除节点的下一个，如果下一个不为空，下一个节点的prev节点指向空，
+		修改首指针指向被删除节点的下一个，如果下一个不为空，下一个节点的prev节点指向空，
 		因为这时候他为第一个节点。
 	*/
 	if (qp->prev == NULL)
 	{
-		ipqueue = qp->next;
-		if (ipqueue != NULL)
-			ipqueue->prev = NULL;
+		struct ipq **head = &ipq_hash[ipqhashfn(qp->iph->id, qp->iph->saddr,
+					qp->iph->daddr, qp->iph->protocol)];
+		*head = qp->next;
+		if (*head != NULL)
+			(*head)->prev = NULL;
 	}
 	else
 	{	
@@ -678,6 +753,18 @@ static void ip_free(struct ipq *qp)
 			qp->next->prev = qp->prev;
 	}
 
+	/* And from the age list. */
+
+	if (qp->lru_prev != NULL)
+		qp->lru_prev->lru_next = qp->lru_next;
+	else
+		ipq_oldest = qp->lru_next;
+	if (qp->lru_next != NULL)
+		qp->lru_next->lru_prev = qp->lru_prev;
+	else
+		ipq_newest = qp->lru_prev;
+	ip_frag_queues--;
+
 	/* Release all fragment data. */
 
 	fp = qp->fragments;
@@ -685,11 +772,10 @@ static void ip_free(struct ipq *qp)
 	while (fp != NULL)
 	{
 		xp = fp->next;
-		IS_SKB(fp->skb);
-		kfree_skb(fp->skb,FREE_READ);
-		kfree_s(fp, sizeof(struct ipfrag));
+		ip_frag_free(qp, fp);
 		fp = xp;
 	}
+	ip_frag_mem -= qp->mem;
 	// 删除mac头和ip头，8字节是icmp用的，存放传输层的前8个字节
 	/* Release the MAC header. */
 	kfree_s(qp->mac, qp->maclen);
@@ -733,6 +819,23 @@ static void ip_expire(unsigned long arg)
 }
 
 
+/*
+ *	Memory limit exceeded. Drop the oldest incomplete datagrams until
+ *	we are below the low watermark. No ICMP is sent for these: the
+ *	sender did nothing wrong, we are just short of memory.
+ */
+
+static void ip_evictor(void)
+{
+	while (ip_frag_mem > IPFRAG_LOW_THRESH && ipq_oldest != NULL)
+	{
+		ip_statistics.IpReasmFails++;
+		ip_frag_evicted++;
+		ip_free(ipq_oldest);
+	}
+}
+
+
 /*
  * 	Add an entry to the 'ipq' queue for a newly received IP datagram.
  * 	We will (hopefully :-) receive all other fragments of this datagram
@@ -743,6 +846,7 @@ static void ip_expire(unsigned long arg)
 static struct ipq *ip_create(struct sk_buff *skb, struct iphdr *iph, struct device *dev)
 {
 	struct ipq *qp;
+	struct ipq **head;
 	int maclen;
 	int ihlen;
 	// 分片一个新的表示分片队列的节点
@@ -796,6 +900,9 @@ static struct ipq *ip_create(struct sk_buff *skb, struct iphdr *iph, struct devi
 	qp->ihlen = ihlen;
 	qp->maclen = maclen;
 	qp->fragments = NULL;
+	qp->last = NULL;
+	qp->meat = 0;
+	qp->mem = sizeof(struct ipq) + maclen + ihlen + 8;
 	qp->dev = dev;
 
 	/* Start a timer for this entry. */
@@ -808,13 +915,25 @@ static struct ipq *ip_create(struct sk_buff *skb, struct iphdr *iph, struct devi
 	/* Add this entry to the queue. */
 	qp->prev = NULL;
 	cli();
+	head = &ipq_hash[ipqhashfn(iph->id, iph->saddr, iph->daddr, iph->protocol)];
 	// 头插法插入分片重组的队列
-	qp->next = ipqueue;
+	qp->next = *head;
 	// 如果当前新增的节点不是第一个节点则把当前第一个节点的prev指针指向新增的节点
 	if (qp->next != NULL)
 		qp->next->prev = qp;
-	//更新ipqueue指向新增的节点，新增节点是首节点 
-	ipqueue = qp;
+	//更新链头指向新增的节点，新增节点是首节点 
+	*head = qp;
+
+	/* Newest queue goes at the end of the age list. */
+	qp->lru_next = NULL;
+	qp->lru_prev = ipq_newest;
+	if (ipq_newest != NULL)
+		ipq_newest->lru_next = qp;
+	else
+		ipq_oldest = qp;
+	ipq_newest = qp;
+	ip_frag_queues++;
+	ip_frag_mem += qp->mem;
 	sti();
 	return(qp);
 }
@@ -826,32 +945,16 @@ static struct ipq *ip_create(struct sk_buff *skb, struct iphdr *iph, struct devi
 // 判断分片是否全部到达
 static int ip_done(struct ipq *qp)
 {
-	struct ipfrag *fp;
-	int offset;
-
 	/* Only possible if we received the final fragment. */
 	// 收到最后分片的时候会更新len字段，如果没有收到他就是初始化0，所以为0说明最后一个分片还没到达，直接返回未完成
 	if (qp->len == 0)
 		return(0);
-	// 走到这里说明全部分片已经到达
-	/* Check all fragment offsets to see if they connect. */
-	fp = qp->fragments;
-	offset = 0;
-	// 检查所有分片，每个分片时按照偏移从小到大排序的链表，因为每次分片节点到达时会插入相应的位置
-	while (fp != NULL)
-	{	/*
-			如果当前节点的偏移大于期待的偏移(即上一个节点的最后一个字节的偏移+1，由end字段表示)，
-			说明有中间节点没到达，直接返回未完成
-		*/
-		if (fp->offset > offset)
-			return(0);	/* fragment(s) missing */
-		offset = fp->end;
-		fp = fp->next;
-	}
 
-	/* All fragments are present. */
-	// 分片全部到达并且每个分片的字节连续则重组完成
-	return(1);
+	/*
+	 *	The fragments never overlap once they are in the list, so
+	 *	they connect exactly when they add up to the whole datagram.
+	 */
+	return(qp->meat == qp->len);
 }
 
 
@@ -953,6 +1056,10 @@ static struct sk_buff *ip_defrag(struct iphdr *iph, struct sk_buff *skb, struct
 
 	ip_statistics.IpReasmReqds++;
 
+	/* Start by making room if incomplete datagrams use too much memory. */
+	if (ip_frag_mem > IPFRAG_HIGH_THRESH)
+		ip_evictor();
+
 	/* Find the entry of this IP datagram in the "incomplete datagrams" queue. */
 	qp = ip_find(iph); // 根据ip头找是否已经存在分片队列
 
@@ -1020,22 +1127,42 @@ static struct sk_buff *ip_defrag(struct iphdr *iph, struct sk_buff *skb, struct
 	 *	Is this the final fragment?
 	 */
 	// 是否是最后一个分片，是的话，未分片的ip报文长度为end，即最后一个报文的最后一个字节的偏移+1，因为偏移从0算起
+	/*
+	 *	A final fragment that disagrees with what we already have, or
+	 *	data past the end of the datagram, is bogus. Drop it.
+	 */
 	if ((flags & IP_MF) == 0)
+	{
+		if ((qp->len != 0 && qp->len != end) ||
+			(qp->last != NULL && qp->last->end > end))
+			goto drop;
 		qp->len = end;
+	}
+	else if (qp->len != 0 && end > qp->len)
+		goto drop;
 
 	/*
 	 * 	Find out which fragments are in front and at the back of us
 	 * 	in the chain of fragments so far.  We must know where to put
-	 * 	this fragment, right?
+	 * 	this fragment, right? Fragments mostly arrive in order, so
+	 *	try the tail of the list first.
 	 */
 
-	prev = NULL;
-	// 插入分片队列相应的位置，保证分片的有序
-	for(next = qp->fragments; next != NULL; next = next->next)
-	{	// 找出第一个比当前分片偏移大的节点
-		if (next->offset > offset)
-			break;	/* bingo! */
-		prev = next;
+	if (qp->last == NULL || qp->last->offset <= offset)
+	{
+		prev = qp->last;
+		next = NULL;
+	}
+	else
+	{
+		prev = NULL;
+		// 插入分片队列相应的位置，保证分片的有序
+		for(next = qp->fragments; next != NULL; next = next->next)
+		{	// 找出第一个比当前分片偏移大的节点
+			if (next->offset > offset)
+				break;	/* bingo! */
+			prev = next;
+		}
 	}
 
 	/*
@@ -1056,6 +1183,12 @@ static struct sk_buff *ip_defrag(struct iphdr *iph, struct sk_buff *skb, struct
 		ptr += i;	/* ptr into fragment data */
 	}
 
+	/*
+	 *	Nothing new in this one, we already have all of its data.
+	 */
+	if (offset >= end)
+		goto drop;
+
 	/*
 	 * Look for overlap with succeeding segments.
 	 * If we can merge fragments, do it.
@@ -1069,29 +1202,33 @@ static struct sk_buff *ip_defrag(struct iphdr *iph, struct sk_buff *skb, struct
 			break;		/* no overlaps at all */
 		// 反之发生了重叠，算出重叠大小
 		i = end - next->offset;			/* overlap is 'i' bytes */
-		// 更新和当前节点重叠的节点的字段，往后挪
-		next->len -= i;				/* so reduce size of	*/
-		next->offset += i;			/* next fragment	*/
-		next->ptr += i;
 
 		/*
-		 *	If we get a frag size of <= 0, remove it and the packet
+		 *	If it is covered completely, remove it and the packet
 		 *	that it goes with.
 		 */
 		// 发生了完全重叠，则删除旧的节点
-		if (next->len <= 0)
+		if (i >= next->len)
 		{
+			qp->meat -= next->len;
 			if (next->prev != NULL)
 				next->prev->next = next->next;// 说明旧节点不是第一个节点
 			else
 				qp->fragments = next->next;//  说明旧节点是第一个节点
-			// 这里应该是tfp !=NULL ?
-			if (tfp->next != NULL)
+			if (next->next != NULL)
 				next->next->prev = next->prev;
+			else
+				qp->last = next->prev;
 
-			kfree_skb(next->skb,FREE_READ);
-			kfree_s(next, sizeof(struct ipfrag));
+			ip_frag_free(qp, next);
+			continue;
 		}
+
+		// 更新和当前节点重叠的节点的字段，往后挪
+		qp->meat -= i;
+		next->len -= i;				/* so reduce size of	*/
+		next->offset += i;			/* next fragment	*/
+		next->ptr += i;
 	}
 
 	/*
@@ -1107,11 +1244,7 @@ static struct sk_buff *ip_defrag(struct iphdr *iph, struct sk_buff *skb, struct
 	 */
 
 	if (!tfp)
-	{
-		skb->sk = NULL;
-		kfree_skb(skb, FREE_READ);
-		return NULL;
-	}
+		goto drop;
 	// 插入分片队列
 	tfp->prev = prev;
 	tfp->next = next;
@@ -1122,6 +1255,13 @@ static struct sk_buff *ip_defrag(struct iphdr *iph, struct sk_buff *skb, struct
 
 	if (next != NULL)
 		next->prev = tfp;
+	else
+		qp->last = tfp;
+
+	qp->meat += tfp->len;
+	i = sizeof(struct ipfrag) + skb->mem_len;
+	qp->mem += i;
+	ip_frag_mem += i;
 
 	/*
 	 * 	OK, so we inserted this new fragment into the chain.
@@ -1135,6 +1275,22 @@ static struct sk_buff *ip_defrag(struct iphdr *iph, struct sk_buff *skb, struct
 		return(skb2);
 	}
 	return(NULL);
+
+drop:
+	skb->sk = NULL;
+	kfree_skb(skb, FREE_READ);
+	return(NULL);
+}
+
+
+/*
+ *	Fragment reassembly statistics for /proc/net/sockstat.
+ */
+
+int ip_frag_get_info(char *buffer)
+{
+	return sprintf(buffer, "FRAG: inuse %d memory %d evicted %lu\n",
+		ip_frag_queues, ip_frag_mem, ip_frag_evicted);
 }
 
 
@@ -1374,7 +1530,7 @@ static void ip_forward(struct sk_buff *skb, struct device *dev, int is_frag)
 	 */
 
 	iph = skb->h.iph;
-	iph->ttl--;
+	ip_decrease_ttl(iph);	/* adjusts the header checksum too */
 	if (iph->ttl <= 0)
 	{
 		/* Tell the sender its packet died... */
@@ -1382,14 +1538,6 @@ static void ip_forward(struct sk_buff *skb, struct device *dev, int is_frag)
 		return;
 	}
 
-	/*
-	 *	Re-compute the IP header checksum.
-	 *	This is inefficient. We know what has happened to the header
-	 *	and could thus adjust the checksum as Phil Karn does in KA9Q
-	 */
-
-	ip_send_check(iph);
-
 	/*
 	 * OK, the packet is still valid.  Fetch its destination address,
 	 * and give it to the IP sender for further processing.
@@ -2205,6 +2353,16 @@ int ip_setsockopt(struct sock *sk, int level, int optname, char *optval, int opt
 			sk->ip_mc_loop=(int)ucval;
 			return 0;
 		}
+		case IP_MULTICAST_ALL: 
+		{
+			unsigned char ucval;
+
+			ucval=get_fs_byte((unsigned char *)optval);
+			if(ucval!=0 && ucval!=1)
+				 return -EINVAL;
+			set_sock_mc_all(sk, (int)ucval);
+			return 0;
+		}
 		case IP_MULTICAST_IF: 
 		{
 			/* Not fully tested */
@@ -2451,6 +2609,9 @@ int ip_getsockopt(struct sock *sk, int level, int optname, char *optval, int *op
 		case IP_MULTICAST_LOOP:
 			val=sk->ip_mc_loop;
 			break;
+		case IP_MULTICAST_ALL:
+			val=sk->ip_mc_all;
+			break;
 		case IP_MULTICAST_IF:
 			err=verify_area(VERIFY_WRITE, optlen, sizeof(int));
 			if(err)
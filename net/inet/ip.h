@@ -28,6 +28,7 @@
 #endif
 
 #include "sock.h"	/* struct sock */
+#include "checksum.h"
 
 /* IP flags. */
 #define IP_CE		0x8000		/* Flag: "Congestion"		*/
@@ -37,6 +38,16 @@
 
 #define IP_FRAG_TIME	(30 * HZ)		/* fragment lifetime	*/
 
+/*
+ *	Incomplete datagrams may hold at most IPFRAG_HIGH_THRESH bytes.
+ *	Past that the oldest queues are dropped until we are below
+ *	IPFRAG_LOW_THRESH.
+ */
+
+#define IPFRAG_HIGH_THRESH	(256*1024)
+#define IPFRAG_LOW_THRESH	(192*1024)
+#define IPQ_HASHSZ		64	/* Must be a power of two	*/
+
 #ifdef CONFIG_IP_MULTICAST
 extern void		ip_mc_dropsocket(struct sock *);
 extern void		ip_mc_dropdevice(struct device *dev);
@@ -65,8 +76,13 @@ struct ipq	 {
   short 	maclen;		/* length of the MAC header		*/
   struct timer_list timer;	/* when will this queue expire?		*/
   struct ipfrag		*fragments;	/* linked list of received fragments	*/
-  struct ipq	*next;		/* linked list pointers			*/
+  struct ipfrag		*last;		/* fragment with the highest offset	*/
+  int		meat;		/* bytes of data received so far	*/
+  int		mem;		/* memory charged to this queue		*/
+  struct ipq	*next;		/* hash chain pointers			*/
   struct ipq	*prev;
+  struct ipq	*lru_next;	/* all queues, oldest first		*/
+  struct ipq	*lru_prev;
   struct device *dev;		/* Device - for icmp replies */
 };
 
@@ -94,6 +110,7 @@ extern void		ip_queue_xmit(struct sock *sk,
 extern int 		ip_setsockopt(struct sock *sk, int level, int optname, char *optval, int optlen);
 extern int 		ip_getsockopt(struct sock *sk, int level, int optname, char *optval, int *optlen);
 extern void		ip_init(void);
+extern int		ip_frag_get_info(char *buffer);
 
 extern struct ip_mib	ip_statistics;
 
@@ -108,23 +125,24 @@ static inline unsigned short ip_fast_csum(unsigned char * buff, int wlen)
 {
 	unsigned long sum = 0;
 
-	if (wlen)
+	while (wlen-- > 0)
 	{
-	unsigned long bogus;
-	 __asm__("clc\n"
-		"1:\t"
-		"lodsl\n\t"
-		"adcl %3, %0\n\t"
-		"decl %2\n\t"
-		"jne 1b\n\t"
-		"adcl $0, %0\n\t"
-		"movl %0, %3\n\t"
-		"shrl $16, %3\n\t"
-		"addw %w3, %w0\n\t"
-		"adcw $0, %w0"
-	    : "=r" (sum), "=S" (buff), "=r" (wlen), "=a" (bogus)
-	    : "0"  (sum),  "1" (buff),  "2" (wlen));
+		sum = csum_add(sum, *(unsigned int *) buff);
+		buff += 4;
 	}
-	return (~sum) & 0xffff;
+	return csum_fold(sum);
+}
+
+/*
+ *	Decrement the TTL and adjust the header checksum for it instead of
+ *	summing the whole header again. The TTL is the high byte of its
+ *	16 bit word; the protocol byte next to it does not change.
+ */
+
+static inline void ip_decrease_ttl(struct iphdr *iph)
+{
+	iph->check = csum_replace2(iph->check, htons(iph->ttl << 8),
+		htons((iph->ttl - 1) << 8));
+	iph->ttl--;
 }
 #endif	/* _IP_H */
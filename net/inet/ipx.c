@@ -1885,6 +1885,9 @@ static struct proto_ops ipx_proto_ops = {
 	ipx_setsockopt,
 	ipx_getsockopt,
 	ipx_fcntl,
+	NULL,
+	NULL,
+	NULL,
 };
 
 /* Called by ddi.c on kernel start up */
@@ -409,6 +409,9 @@ struct proto packet_prot =
 	NULL,
 	NULL,			/* No set/get socket options */
 	NULL,
+	NULL,
+	NULL,
+	NULL,
 	128,
 	0,
 	{NULL,},
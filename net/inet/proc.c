@@ -45,6 +45,7 @@
 #include <linux/skbuff.h>
 #include "sock.h"
 #include "raw.h"
+#include "arp.h"
 
 /*
  * Get__netinfo returns the length of that string.
@@ -165,6 +166,10 @@ int afinet_get_info(char *buffer, char **start, off_t offset, int length)
 		       raw_prot.inuse, raw_prot.highestinuse);
 	len += sprintf(buffer+len,"PAC: inuse %d highest %d\n",
 		       packet_prot.inuse, packet_prot.highestinuse);
+	len += skb_pool_get_info(buffer+len);
+	len += net_bh_get_info(buffer+len);
+	len += ip_frag_get_info(buffer+len);
+	len += arp_get_stats(buffer+len);
 	*start = buffer + offset;
 	len -= offset;
 	if (len > length)
@@ -180,6 +185,7 @@ int afinet_get_info(char *buffer, char **start, off_t offset, int length)
 int snmp_get_info(char *buffer, char **start, off_t offset, int length)
 {
 	extern struct tcp_mib tcp_statistics;
+	extern struct tcpext_mib tcpext_statistics;
 	extern struct udp_mib udp_statistics;
 	int len;
 /*
@@ -226,6 +232,25 @@ int snmp_get_info(char *buffer, char **start, off_t offset, int length)
 		    tcp_statistics.TcpAttemptFails, tcp_statistics.TcpEstabResets,
 		    tcp_statistics.TcpCurrEstab, tcp_statistics.TcpInSegs,
 		    tcp_statistics.TcpOutSegs, tcp_statistics.TcpRetransSegs);
+
+	len += sprintf (buffer + len,
+		"TcpExt: DupAcks FastRetrans PartialAcks Timeouts OfoQueued OfoPruned OfoMem"
+		" SynRecv SynOverflow SynTimeouts SyncookiesSent SyncookiesRecv SyncookiesFailed"
+		" TwBuckets TwRecycled ListenOverflows ListenDrops WriteCoalesced"
+		" TimerArmed TimerLazy TimerEarly\n"
+		"TcpExt: %lu %lu %lu %lu %lu %lu %lu %lu %lu %lu %lu %lu %lu %lu %lu %lu %lu %lu"
+		" %lu %lu %lu\n",
+		    tcpext_statistics.TcpExtDupAcks, tcpext_statistics.TcpExtFastRetrans,
+		    tcpext_statistics.TcpExtPartialAcks, tcpext_statistics.TcpExtTimeouts,
+		    tcpext_statistics.TcpExtOfoQueued, tcpext_statistics.TcpExtOfoPruned,
+		    tcpext_statistics.TcpExtOfoMem, tcpext_statistics.TcpExtSynRecv,
+		    tcpext_statistics.TcpExtSynOverflow, tcpext_statistics.TcpExtSynTimeouts,
+		    tcpext_statistics.TcpExtSyncookiesSent, tcpext_statistics.TcpExtSyncookiesRecv,
+		    tcpext_statistics.TcpExtSyncookiesFailed, tcpext_statistics.TcpExtTwBuckets,
+		    tcpext_statistics.TcpExtTwRecycled, tcpext_statistics.TcpExtListenOverflows,
+		    tcpext_statistics.TcpExtListenDrops, tcpext_statistics.TcpExtWriteCoalesced,
+		    tcpext_statistics.TcpExtTimerArmed, tcpext_statistics.TcpExtTimerLazy,
+		    tcpext_statistics.TcpExtTimerEarly);
 		
 	len += sprintf (buffer + len,
 		"Udp: InDatagrams NoPorts InErrors OutDatagrams\nUdp: %lu %lu %lu %lu\n",
@@ -317,6 +317,9 @@ struct proto raw_prot = {
 	NULL,
 	ip_setsockopt,
 	ip_getsockopt,
+	NULL,
+	NULL,
+	NULL,
 	128,
 	0,
 	{NULL,},
@@ -64,6 +64,218 @@ static struct rtable *rt_base = NULL;
 // 回环路由链表
 static struct rtable *rt_loopback = NULL;
 
+/*
+ *	Routing/ARP generation, see route.h
+ */
+
+unsigned long ip_rt_gen = 0;
+
+/*
+ *	rt_base stays the master list (it is what /proc shows and what the
+ *	gateway checks walk) but lookups go through a path compressed
+ *	binary trie over the same routes, so finding the longest matching
+ *	prefix costs at most 32 steps however big the table gets. Keys are
+ *	kept in host order so the bit tests are simple shifts. A node
+ *	exists for every route and for every point where two prefixes part
+ *	company, so there are never more than twice as many nodes as
+ *	routes.
+ */
+
+struct rt_node
+{
+	struct rt_node		*rn_child[2];
+	struct rt_node		*rn_parent;
+	unsigned long		rn_key;		/* Prefix, host order */
+	int			rn_bits;	/* Prefix length */
+	struct rtable		*rn_rt;		/* Route for this prefix */
+};
+
+static struct rt_node *rt_trie = NULL;
+
+/*
+ *	Routes whose mask is not a plain prefix can't live in the trie.
+ *	While any exist we fall back to walking rt_base.
+ */
+
+static int rt_irregular = 0;
+
+#define RN_MASK(bits)		((bits) ? ~0UL << (32 - (bits)) : 0UL)
+#define RN_BIT(key, n)		(((key) >> (31 - (n))) & 1)
+
+/*
+ *	Turn a network order mask into a prefix length, or -1 if the mask
+ *	has holes in it.
+ */
+
+static int rt_mask_bits(unsigned long mask)
+{
+	unsigned int m = ntohl(mask) & 0xffffffffUL;
+	int bits = 0;
+
+	while (m & 0x80000000U)
+	{
+		m <<= 1;
+		bits++;
+	}
+	return m ? -1 : bits;
+}
+
+/*
+ *	Find where the parent of a node keeps its pointer to it.
+ */
+
+static inline struct rt_node **rn_link(struct rt_node *rn)
+{
+	struct rt_node *parent = rn->rn_parent;
+
+	if (parent == NULL)
+		return &rt_trie;
+	return &parent->rn_child[RN_BIT(rn->rn_key, parent->rn_bits)];
+}
+
+static inline void rn_init(struct rt_node *rn, unsigned long key, int bits,
+	struct rt_node *parent)
+{
+	rn->rn_child[0] = rn->rn_child[1] = NULL;
+	rn->rn_parent = parent;
+	rn->rn_key = key & RN_MASK(bits);
+	rn->rn_bits = bits;
+	rn->rn_rt = NULL;
+}
+
+/*
+ *	Index a route. The caller supplies the (at most two) nodes we may
+ *	need so that nothing is allocated with the interrupts off; used
+ *	ones are set to NULL. Returns 0 if the route could not be indexed
+ *	because its mask is not a prefix.
+ */
+
+static int rt_trie_insert(struct rtable *rt, struct rt_node **spare)
+{
+	struct rt_node **link = &rt_trie;
+	struct rt_node *parent = NULL;
+	struct rt_node *rn, *leaf;
+	unsigned long key, diff;
+	int bits, common;
+
+	bits = rt_mask_bits(rt->rt_mask);
+	if (bits < 0)
+		return 0;
+	key = ntohl(rt->rt_dst) & RN_MASK(bits);
+
+	while ((rn = *link) != NULL)
+	{
+		/*
+		 *	How much of this node's prefix do we share ?
+		 */
+		common = (bits < rn->rn_bits) ? bits : rn->rn_bits;
+		diff = (key ^ rn->rn_key) & RN_MASK(common);
+		if (diff)
+		{
+			common = 0;
+			while (!(diff & 0x80000000UL))
+			{
+				diff <<= 1;
+				common++;
+			}
+		}
+		if (common < rn->rn_bits)
+		{
+			/*
+			 *	We go in above this node, either as its direct
+			 *	parent or as a sibling under a new branch point.
+			 */
+			leaf = spare[0];
+			spare[0] = NULL;
+			rn_init(leaf, key, bits, parent);
+			leaf->rn_rt = rt;
+			rt->rt_node = leaf;
+			if (common == bits)
+			{
+				leaf->rn_child[RN_BIT(rn->rn_key, bits)] = rn;
+				rn->rn_parent = leaf;
+				*link = leaf;
+				return 1;
+			}
+			parent = spare[1];
+			spare[1] = NULL;
+			rn_init(parent, key, common, rn->rn_parent);
+			parent->rn_child[RN_BIT(key, common)] = leaf;
+			parent->rn_child[RN_BIT(rn->rn_key, common)] = rn;
+			leaf->rn_parent = parent;
+			rn->rn_parent = parent;
+			*link = parent;
+			return 1;
+		}
+		if (rn->rn_bits == bits)
+		{
+			/* Already a branch point, or a route being replaced */
+			rn->rn_rt = rt;
+			rt->rt_node = rn;
+			return 1;
+		}
+		parent = rn;
+		link = &rn->rn_child[RN_BIT(key, rn->rn_bits)];
+	}
+	leaf = spare[0];
+	spare[0] = NULL;
+	rn_init(leaf, key, bits, parent);
+	leaf->rn_rt = rt;
+	rt->rt_node = leaf;
+	*link = leaf;
+	return 1;
+}
+
+/*
+ *	Drop a route from the trie and prune any node that no longer
+ *	carries a route or separates two subtrees.
+ */
+
+static void rt_trie_remove(struct rtable *rt)
+{
+	struct rt_node *rn = rt->rt_node;
+	struct rt_node *child, *parent;
+
+	if (rn == NULL)
+	{
+		rt_irregular--;
+		return;
+	}
+	rt->rt_node = NULL;
+	rn->rn_rt = NULL;
+	while (rn != NULL && rn->rn_rt == NULL &&
+		(rn->rn_child[0] == NULL || rn->rn_child[1] == NULL))
+	{
+		child = rn->rn_child[0] ? rn->rn_child[0] : rn->rn_child[1];
+		parent = rn->rn_parent;
+		*rn_link(rn) = child;
+		if (child != NULL)
+			child->rn_parent = parent;
+		kfree_s(rn, sizeof(struct rt_node));
+		/* A parent that lost a child may now be redundant too */
+		if (child != NULL)
+			break;
+		rn = parent;
+	}
+}
+
+/*
+ *	Take a route out of both the list and the trie and free it. The
+ *	caller holds cli() and passes the list link pointing at it.
+ */
+
+static void rt_free(struct rtable **rp)
+{
+	struct rtable *r = *rp;
+
+	*rp = r->rt_next;
+	rt_trie_remove(r);
+	if (rt_loopback == r)
+		rt_loopback = NULL;
+	ip_rt_gen++;
+	kfree_s(r, sizeof(struct rtable));
+}
+
 /*
  *	Remove a routing table entry.
  */
@@ -93,15 +305,8 @@ static void rt_del(unsigned long dst, char *devname)
 			continue;
 		}
 		// 利用二级指针，直接修改该指针的值，使他指向被删除节点的下一个节点的地址
-		*rp = r->rt_next;
-		
-		/*
-		 *	If we delete the loopback route update its pointer.
-		 */
-		// 删除的是回环地址 
-		if (rt_loopback == r)
-			rt_loopback = NULL;
-		kfree_s(r, sizeof(struct rtable));
+		// 同时更新回环路由指针
+		rt_free(rp);
 	} 
 	restore_flags(flags);
 }
@@ -126,10 +331,7 @@ void ip_rt_flush(struct device *dev)
 			rp = &r->rt_next;
 			continue;
 		}
-		*rp = r->rt_next;
-		if (rt_loopback == r)
-			rt_loopback = NULL;
-		kfree_s(r, sizeof(struct rtable));
+		rt_free(rp);
 	} 
 	restore_flags(flags);
 }
@@ -217,6 +419,7 @@ void ip_rt_add(short flags, unsigned long dst, unsigned long mask,
 {
 	struct rtable *r, *rt;
 	struct rtable **rp;
+	struct rt_node *spare[2];
 	unsigned long cpuflags;
 
 	/*
@@ -298,6 +501,22 @@ void ip_rt_add(short flags, unsigned long dst, unsigned long mask,
 	if(rt->rt_flags & RTF_WINDOW)
 		rt->rt_window = window;
 
+	/*
+	 *	Get the trie nodes now, not with the interrupts off.
+	 */
+
+	spare[0] = (struct rt_node *) kmalloc(sizeof(struct rt_node), GFP_ATOMIC);
+	spare[1] = (struct rt_node *) kmalloc(sizeof(struct rt_node), GFP_ATOMIC);
+	if (spare[0] == NULL || spare[1] == NULL)
+	{
+		if (spare[0])
+			kfree_s(spare[0], sizeof(struct rt_node));
+		if (spare[1])
+			kfree_s(spare[1], sizeof(struct rt_node));
+		kfree_s(rt, sizeof(struct rtable));
+		return;
+	}
+
 	/*
 	 *	What we have to do is loop though this until we have
 	 *	found the first address which has a higher generality than
@@ -321,10 +540,7 @@ void ip_rt_add(short flags, unsigned long dst, unsigned long mask,
 			rp = &r->rt_next;
 			continue;
 		}
-		*rp = r->rt_next;
-		if (rt_loopback == r)
-			rt_loopback = NULL;
-		kfree_s(r, sizeof(struct rtable));
+		rt_free(rp);
 	}
 	
 	/*
@@ -340,6 +556,9 @@ void ip_rt_add(short flags, unsigned long dst, unsigned long mask,
 	}
 	rt->rt_next = r;
 	*rp = rt;
+	if (!rt_trie_insert(rt, spare))
+		rt_irregular++;
+	ip_rt_gen++;
 	
 	/*
 	 *	Update the loopback route
@@ -353,6 +572,10 @@ void ip_rt_add(short flags, unsigned long dst, unsigned long mask,
 	 */
 	 
 	restore_flags(cpuflags);
+	if (spare[0])
+		kfree_s(spare[0], sizeof(struct rt_node));
+	if (spare[1])
+		kfree_s(spare[1], sizeof(struct rt_node));
 	return;
 }
 
@@ -555,18 +778,24 @@ int rt_get_info(char *buffer, char **start, off_t offset, int length)
 #define early_out ({ goto no_route; 1; })
 
 /*
- *	Route a packet. This needs to be fairly quick. Florian & Co. 
- *	suggested a unified ARP and IP routing cache. Done right its
- *	probably a brilliant idea. I'd actually suggest a unified
- *	ARP/IP routing/Socket pointer cache. Volunteers welcome
+ *	The list walk that defines what a lookup means: the first (most
+ *	specific) route covering the address, except that a directly
+ *	attached route whose device broadcast address it is wins as soon
+ *	as it is reached. If local is set gateway routes are ignored.
  */
- 
-struct rtable * ip_rt_route(unsigned long daddr, struct options *opt, unsigned long *src_addr)
+
+static struct rtable *rt_lookup_slow(unsigned long daddr, int local)
 {
 	struct rtable *rt;
 
-	for (rt = rt_base; rt != NULL || early_out ; rt = rt->rt_next) 
+	for (rt = rt_base; rt != NULL; rt = rt->rt_next) 
 	{
+		/*
+		 *	No routed addressing.
+		 */
+		if (local && (rt->rt_flags&RTF_GATEWAY))
+			continue;
+		// true则是同一个网络
 		if (!((rt->rt_dst ^ daddr) & rt->rt_mask))
 			break;
 		/*
@@ -574,10 +803,61 @@ struct rtable * ip_rt_route(unsigned long daddr, struct options *opt, unsigned l
 		 */
 		if (rt->rt_flags & RTF_GATEWAY)
 			continue;		 
+		// 是广播地址并且设备支持广播
 		if ((rt->rt_dev->flags & IFF_BROADCAST) &&
 		    (rt->rt_dev->pa_brdaddr == daddr))
 			break;
 	}
+	return rt;
+}
+
+/*
+ *	Longest prefix match in the trie. This gives the same answer as
+ *	the list walk unless the address is the broadcast address of one
+ *	of our interfaces (or we have irregular masks), which is rare
+ *	enough to send down the slow path.
+ */
+
+static struct rtable *rt_lookup(unsigned long daddr, int local)
+{
+	struct rt_node *rn;
+	struct rtable *best = NULL;
+	struct device *dev;
+	unsigned long key;
+
+	if (rt_irregular)
+		return rt_lookup_slow(daddr, local);
+	for (dev = dev_base; dev != NULL; dev = dev->next)
+		if ((dev->flags & IFF_BROADCAST) && dev->pa_brdaddr == daddr)
+			return rt_lookup_slow(daddr, local);
+
+	key = ntohl(daddr);
+	for (rn = rt_trie; rn != NULL; rn = rn->rn_child[RN_BIT(key, rn->rn_bits)])
+	{
+		if ((key ^ rn->rn_key) & RN_MASK(rn->rn_bits))
+			break;
+		if (rn->rn_rt != NULL &&
+		    !(local && (rn->rn_rt->rt_flags & RTF_GATEWAY)))
+			best = rn->rn_rt;
+		if (rn->rn_bits == 32)
+			break;
+	}
+	return best;
+}
+
+/*
+ *	Route a packet. This needs to be fairly quick. Florian & Co. 
+ *	suggested a unified ARP and IP routing cache. Done right its
+ *	probably a brilliant idea. I'd actually suggest a unified
+ *	ARP/IP routing/Socket pointer cache. Volunteers welcome
+ */
+ 
+struct rtable * ip_rt_route(unsigned long daddr, struct options *opt, unsigned long *src_addr)
+{
+	struct rtable *rt;
+
+	if ((rt = rt_lookup(daddr, 0)) == NULL)
+		early_out;
 	
 	if(src_addr!=NULL)
 		*src_addr= rt->rt_dev->pa_addr;
@@ -596,24 +876,8 @@ struct rtable * ip_rt_local(unsigned long daddr, struct options *opt, unsigned l
 {
 	struct rtable *rt;
 
-	for (rt = rt_base; rt != NULL || early_out ; rt = rt->rt_next) 
-	{
-		/*
-		 *	No routed addressing.
-		 */
-		if (rt->rt_flags&RTF_GATEWAY)
-			continue;
-		// true则是同一个网络
-		if (!((rt->rt_dst ^ daddr) & rt->rt_mask))
-			break;
-		/*
-		 *	broadcast addresses can be special cases.. 
-		 */
-		// 是广播地址并且设备支持广播
-		if ((rt->rt_dev->flags & IFF_BROADCAST) &&
-		     rt->rt_dev->pa_brdaddr == daddr)
-			break;
-	}
+	if ((rt = rt_lookup(daddr, 1)) == NULL)
+		early_out;
 	
 	if(src_addr!=NULL)
 		*src_addr= rt->rt_dev->pa_addr;
@@ -49,9 +49,19 @@ struct rtable
 	unsigned long		rt_window;
 	// 绑定的接口
 	struct device		*rt_dev;
+	/* Our node in the lookup trie, NULL if not indexed */
+	struct rt_node		*rt_node;
 };
 
 
+/*
+ *	Bumped whenever a route or a resolved ARP entry goes away or
+ *	changes. Anything caching routing or hardware header results
+ *	(see ip_build_header) must recheck it before use.
+ */
+
+extern unsigned long	ip_rt_gen;
+
 extern void		ip_rt_flush(struct device *dev);
 extern void		ip_rt_add(short flags, unsigned long addr, unsigned long mask,
 			       unsigned long gw, struct device *dev, unsigned short mss, unsigned long window);
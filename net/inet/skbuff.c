@@ -52,14 +52,73 @@ volatile unsigned long net_allocs = 0;
 volatile unsigned long net_fails  = 0;
 volatile unsigned long net_free_locked = 0;
 
+/*
+ *	Free lists of released buffers, one per common size class: bare
+ *	ACK/control segments, an ethernet MTU sized frame and the largest
+ *	block kmalloc() hands out from a single page. A buffer belonging
+ *	to a class is really allocated at the class size (the sk_buff
+ *	included), so any later request that fits can reuse it without
+ *	going back through kmalloc(). Sizes are the kmalloc() bucket sizes
+ *	less its 8 byte block header.
+ */
+
+struct skb_pool {
+	struct sk_buff	*head;		/* Chained through skb->next */
+	unsigned long	size;		/* Real allocation size */
+	int		count;
+	int		max;		/* Return to kmalloc() above this */
+	unsigned long	hits;
+	unsigned long	misses;
+};
+
+#define SKB_POOLS	3
+
+static struct skb_pool skb_pools[SKB_POOLS] = {
+	{ NULL,  244, 0, 64, 0, 0 },
+	{ NULL, 2032, 0, 32, 0, 0 },
+	{ NULL, 4072, 0,  8, 0, 0 }
+};
+
+static __inline__ struct skb_pool *skb_pool_find(unsigned long size)
+{
+	struct skb_pool *pool;
+
+	for (pool = skb_pools; pool < skb_pools + SKB_POOLS; pool++)
+		if (size <= pool->size)
+			return pool;
+	return NULL;
+}
+
 void show_net_buffers(void)
 {
+	int i;
+
 	printk("Networking buffers in use          : %lu\n",net_skbcount);
 	printk("Memory committed to network buffers: %lu\n",net_memory);
 	printk("Network buffers locked by drivers  : %lu\n",net_locked);
 	printk("Total network buffer allocations   : %lu\n",net_allocs);
 	printk("Total failed network buffer allocs : %lu\n",net_fails);
 	printk("Total free while locked events     : %lu\n",net_free_locked);
+	for (i = 0; i < SKB_POOLS; i++)
+		printk("Buffer pool %4lu: free %d hits %lu misses %lu\n",
+			skb_pools[i].size, skb_pools[i].count,
+			skb_pools[i].hits, skb_pools[i].misses);
+}
+
+/*
+ *	Pool statistics for /proc/net/sockstat.
+ */
+
+int skb_pool_get_info(char *buffer)
+{
+	int i;
+	int len = 0;
+
+	for (i = 0; i < SKB_POOLS; i++)
+		len += sprintf(buffer+len, "SKB%lu: free %d hits %lu misses %lu\n",
+			skb_pools[i].size, skb_pools[i].count,
+			skb_pools[i].hits, skb_pools[i].misses);
+	return len;
 }
 
 #if CONFIG_SKB_CHECK
@@ -390,6 +449,7 @@ void kfree_skb(struct sk_buff *skb, int rw)
 struct sk_buff *alloc_skb(unsigned int size,int priority)
 {
 	struct sk_buff *skb;
+	struct skb_pool *pool;
 	unsigned long flags;
 
 	if (intr_count && priority!=GFP_ATOMIC) {
@@ -402,25 +462,55 @@ struct sk_buff *alloc_skb(unsigned int size,int priority)
 	}
 
 	size+=sizeof(struct sk_buff);
-	skb=(struct sk_buff *)kmalloc(size,priority);
-	if (skb == NULL)
+	pool=skb_pool_find(size);
+
+	/*
+	 *	Try the free list first. A hit costs one interrupt disable
+	 *	for both the list and the accounting.
+	 */
+
+	save_flags(flags);
+	cli();
+	if (pool != NULL && (skb = pool->head) != NULL)
 	{
-		net_fails++;
-		return NULL;
+		pool->head = skb->next;
+		pool->count--;
+		pool->hits++;
+		net_memory += size;
+		net_skbcount++;
+		net_allocs++;
+		restore_flags(flags);
 	}
+	else
+	{
+		if (pool != NULL)
+			pool->misses++;
+		restore_flags(flags);
+		skb=(struct sk_buff *)kmalloc(pool ? pool->size : size,priority);
+		if (skb == NULL)
+		{
+			net_fails++;
+			return NULL;
+		}
 #ifdef PARANOID_BUGHUNT_MODE
-	if(skb->magic_debug_cookie == SK_GOOD_SKB)
-		printk("Kernel kmalloc handed us an existing skb (%p)\n",skb);
+		if(skb->magic_debug_cookie == SK_GOOD_SKB)
+			printk("Kernel kmalloc handed us an existing skb (%p)\n",skb);
 #endif
-
-	net_allocs++;
+		save_flags(flags);
+		cli();
+		net_memory += size;
+		net_skbcount++;
+		net_allocs++;
+		restore_flags(flags);
+		skb->mem_addr = skb;
+		skb->pool = pool ? pool - skb_pools + 1 : 0;
+	}
 
 	skb->free = 2;	/* Invalid so we pick up forgetful users */
 	skb->lock = 0;
 	skb->pkt_type = PACKET_HOST;	/* Default type */
 	skb->truesize = size;
 	skb->mem_len = size;
-	skb->mem_addr = skb;
 #ifdef CONFIG_SLAVE_BALANCING
 	skb->in_dev_queue = 0;
 #endif
@@ -428,14 +518,10 @@ struct sk_buff *alloc_skb(unsigned int size,int priority)
 	skb->prev = skb->next = NULL;
 	skb->link3 = NULL;
 	skb->sk = NULL;
-	skb->localroute=0;
 	skb->stamp.tv_sec=0;	/* No idea about time */
 	skb->localroute = 0;
-	save_flags(flags);
-	cli();
-	net_memory += size;
-	net_skbcount++;
-	restore_flags(flags);
+	skb->sacked = 0;
+	skb->csum_ok = 0;
 #if CONFIG_SKB_CHECK
 	skb->magic_debug_cookie = SK_GOOD_SKB;
 #endif
@@ -444,12 +530,14 @@ struct sk_buff *alloc_skb(unsigned int size,int priority)
 }
 
 /*
- *	Free an skbuff by memory
+ *	Free an skbuff by memory. Buffers from a size class go back on its
+ *	free list unless that already holds enough of them.
  */
 
 void kfree_skbmem(struct sk_buff *skb,unsigned size)
 {
 	unsigned long flags;
+	struct skb_pool *pool;
 #ifdef CONFIG_SLAVE_BALANCING
 	save_flags(flags);
 	cli();
@@ -462,27 +550,34 @@ void kfree_skbmem(struct sk_buff *skb,unsigned size)
 	if(size!=skb->truesize)
 		printk("kfree_skbmem: size mismatch.\n");
 
-	if(skb->magic_debug_cookie == SK_GOOD_SKB)
+	if(skb->magic_debug_cookie != SK_GOOD_SKB)
 	{
-		save_flags(flags);
-		cli();
-		IS_SKB(skb);
-		skb->magic_debug_cookie = SK_FREED_SKB;
-		kfree_s((void *)skb,size);
-		net_skbcount--;
-		net_memory -= size;
-		restore_flags(flags);
-	}
-	else
 		printk("kfree_skbmem: bad magic cookie\n");
-#else
+		return;
+	}
+#endif
 	save_flags(flags);
 	cli();
-	kfree_s((void *)skb,size);
+#ifdef CONFIG_SKB_CHECK
+	skb->magic_debug_cookie = SK_FREED_SKB;
+#endif
 	net_skbcount--;
 	net_memory -= size;
+	if (skb->pool)
+	{
+		pool = &skb_pools[skb->pool - 1];
+		if (pool->count < pool->max)
+		{
+			skb->next = pool->head;
+			pool->head = skb;
+			pool->count++;
+			restore_flags(flags);
+			return;
+		}
+		size = pool->size;
+	}
+	kfree_s((void *)skb,size);
 	restore_flags(flags);
-#endif
 }
 
 /*
@@ -516,6 +611,7 @@ struct sk_buff *skb_clone(struct sk_buff *skb, int priority)
 	n->daddr=skb->daddr;
 	n->raddr=skb->raddr;
 	n->acked=skb->acked;
+	n->sacked=skb->sacked;
 	n->used=skb->used;
 	n->free=1;
 	n->arp=skb->arp;
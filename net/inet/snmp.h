@@ -94,6 +94,35 @@ struct tcp_mib
  	unsigned long	TcpOutSegs;
  	unsigned long	TcpRetransSegs;
 };
+
+/*
+ *	Linux extensions, not in RFC 1213.
+ */
+
+struct tcpext_mib
+{
+ 	unsigned long	TcpExtDupAcks;
+ 	unsigned long	TcpExtFastRetrans;
+ 	unsigned long	TcpExtPartialAcks;
+ 	unsigned long	TcpExtTimeouts;
+ 	unsigned long	TcpExtOfoQueued;	/* Segments put on the out of order queue */
+ 	unsigned long	TcpExtOfoPruned;	/* ...and dropped from it for memory */
+ 	unsigned long	TcpExtOfoMem;	/* Memory held there now */
+ 	unsigned long	TcpExtSynRecv;	/* Requests in the SYN table now */
+ 	unsigned long	TcpExtSynOverflow;	/* SYNs that found it full */
+ 	unsigned long	TcpExtSynTimeouts;	/* Requests that got no final ack */
+ 	unsigned long	TcpExtSyncookiesSent;
+ 	unsigned long	TcpExtSyncookiesRecv;
+ 	unsigned long	TcpExtSyncookiesFailed;
+ 	unsigned long	TcpExtTwBuckets;	/* Connections in TIME_WAIT buckets now */
+ 	unsigned long	TcpExtTwRecycled;	/* ...reopened by a new SYN */
+ 	unsigned long	TcpExtListenOverflows;	/* Final acks dropped, accept queue full */
+ 	unsigned long	TcpExtListenDrops;	/* SYNs dropped for the same reason */
+ 	unsigned long	TcpExtWriteCoalesced;	/* Writes added to a queued segment */
+	unsigned long	TcpExtTimerArmed;	/* Retransmit timer really moved */
+	unsigned long	TcpExtTimerLazy;	/* ...and changes that did not need to */
+	unsigned long	TcpExtTimerEarly;	/* Expiries before the deadline */
+};
  
 struct udp_mib
 {
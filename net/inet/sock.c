@@ -148,8 +148,8 @@ int sock_setsockopt(struct sock *sk, int level, int optname,
 			return 0;
 		case SO_SNDBUF:
 			// 设置发送缓冲区大小
-			if(val>32767)
-				val=32767;
+			if(val>SK_WMEM_LIMIT)
+				val=SK_WMEM_LIMIT;
 			if(val<256)
 				val=256;
 			sk->sndbuf=val;
@@ -169,8 +169,8 @@ int sock_setsockopt(struct sock *sk, int level, int optname,
 			return 0;
 		case SO_RCVBUF:
 			// 设置接收缓冲区大小
-			if(val>32767)
-				val=32767;
+			if(val>SK_RMEM_LIMIT)
+				val=SK_RMEM_LIMIT;
 			if(val<256)
 				val=256;
 			sk->rcvbuf=val;
@@ -369,7 +369,11 @@ unsigned long sock_rspace(struct sock *sk)
 	{
 		if (sk->rmem_alloc >= sk->rcvbuf-2*MIN_WINDOW) 
 			return(0);
-		amt = min((sk->rcvbuf-sk->rmem_alloc)/2-MIN_WINDOW, MAX_WINDOW);
+		/*
+		 *	No MAX_WINDOW cap here: TCP limits the window to what
+		 *	fits its header once it knows the window scale.
+		 */
+		amt = (sk->rcvbuf-sk->rmem_alloc)/2-MIN_WINDOW;
 		if (amt < 0) 
 			return(0);
 		return(amt);
@@ -50,6 +50,7 @@
 #include <linux/igmp.h>
 
 #define SOCK_ARRAY_SIZE	256		/* Think big (also on some systems a byte is faster */
+#define SOCK_EHASH_SIZE	1024		/* Fully bound (connected) sockets, power of two */
 
 
 /*
@@ -90,12 +91,16 @@ struct sock {
 				no_check,
 				zapped,	/* In ax25 & ipx means not linked */
 				broadcast,
-				nonagle;
+				nonagle,
+				cork;	/* TCP_CORK */
   unsigned long		        lingertime;
   int				proc;
   struct sock			*next;
   struct sock			*prev; /* Doubly linked chain.. */
   struct sock			*pair;
+  struct sock			*hash_next;	/* Lookup hash chain (see get_sock) */
+  unsigned short		hash_slot;	/* Bucket on that hash */
+  unsigned char			hashed;		/* Which lookup hash we are on */
   struct sk_buff		* volatile send_head;
   struct sk_buff		* volatile send_tail;
   struct sk_buff_head		back_log;
@@ -104,19 +109,38 @@ struct sock {
   long				retransmits;
   struct sk_buff_head		write_queue,
 				receive_queue;
+  struct sk_buff_head		out_of_order_queue;	/* TCP reassembly */
+  unsigned long			ofo_mem;	/* Memory held there */
   struct proto			*prot;
   struct wait_queue		**sleep;
   unsigned long			daddr;
   unsigned long			saddr;
   unsigned short		max_unacked;
-  unsigned short		window;
-  unsigned short		bytes_rcv;
-/* mss is min(mtu, max_window) */
+  unsigned long			window;
+  unsigned long			bytes_rcv;
+/* mss is min(mtu, max_window), less the timestamp option if used */
   unsigned short		mtu;       /* mss negotiated in the syn's */
   volatile unsigned short	mss;       /* current eff. mss - can change */
   volatile unsigned short	user_mss;  /* mss requested by user in ioctl */
-  volatile unsigned short	max_window;
+  volatile unsigned long	max_window;
   unsigned long 		window_clamp;
+  unsigned char			snd_wscale;	/* Peer's window shift (RFC 1323) */
+  unsigned char			rcv_wscale;	/* Our window shift */
+  unsigned char			wscale_ok;	/* Both ends sent the option */
+  unsigned char			tstamp_ok;	/* Timestamps negotiated (RFC 1323) */
+  unsigned char			saw_tstamp;	/* Segment being processed had one */
+  unsigned long			rcv_tsval;	/* Its timestamp value... */
+  unsigned long			rcv_tsecr;	/* ...and echo reply */
+  unsigned long			ts_recent;	/* Timestamp to echo, also for PAWS */
+  unsigned long			ts_recent_stamp;	/* When ts_recent was set */
+  unsigned char			sack_ok;	/* SACK permitted (RFC 2018) */
+  unsigned long			sack_last;	/* Latest out of order segment */
+  unsigned short		dup_acks;	/* Duplicate acks in a row */
+  unsigned char			in_recovery;	/* Fast recovery (NewReno) */
+  unsigned long			high_seq;	/* sent_seq when recovery started */
+  unsigned long			nr_dupacks;	/* Loss recovery counters, see */
+  unsigned long			nr_fast_retrans;	/* struct tcp_loss_stats */
+  unsigned long			nr_timeouts;
   unsigned short		num;
   volatile unsigned short	cong_window;
   volatile unsigned short	cong_count;
@@ -135,10 +159,16 @@ struct sock {
   volatile unsigned char	state;
   volatile unsigned char	ack_backlog;
   unsigned char			max_ack_backlog;
+  unsigned short		syn_backlog;	/* Listener's entries in the SYN table */
+  unsigned short		accept_backlog;	/* ...and children waiting for accept() */
+  unsigned short		max_accept_backlog;	/* As given to listen() */
+  struct sock			*accept_head;	/* A listener's accept queue */
+  struct sock			*accept_tail;
+  struct sock			*accept_next;	/* A child's link on it */
   unsigned char			priority;
   unsigned char			debug;
-  unsigned short		rcvbuf;
-  unsigned short		sndbuf;
+  unsigned long			rcvbuf;
+  unsigned long			sndbuf;
   unsigned short		type;
   unsigned char			localroute;	/* Route locally only */
 #ifdef CONFIG_IPX
@@ -170,13 +200,23 @@ struct sock {
   int				ip_ttl;		/* TTL setting */
   int				ip_tos;		/* TOS */
   struct tcphdr			dummy_th;
-  struct timer_list		keepalive_timer;	/* TCP keepalive hack */
   struct timer_list		retransmit_timer;	/* TCP retransmit timer */
-  struct timer_list		ack_timer;		/* TCP delayed ack timer */
   int				ip_xmit_timeout;	/* Why the timeout is running */
+  unsigned long			xmit_deadline;		/* ...and when it is due */
+  /* Routing and hardware header for the last destination (ip_build_header) */
+  struct rtable			*ip_cache_rt;		/* NULL if nothing cached */
+  unsigned long			ip_cache_gen;		/* ip_rt_gen when filled */
+  unsigned long			ip_cache_daddr;
+  unsigned long			ip_cache_src;
+  unsigned long			ip_cache_raddr;		/* First hop */
+  struct device			*ip_cache_dev;
+  unsigned char			ip_cache_local;		/* Was skb->localroute */
+  short				ip_cache_hhlen;		/* -1 if header not cached */
+  unsigned char			ip_cache_hh[MAX_HEADER];
 #ifdef CONFIG_IP_MULTICAST  
   int				ip_mc_ttl;			/* Multicasting TTL */
   int				ip_mc_loop;			/* Loopback (not implemented yet) */
+  int				ip_mc_all;			/* Multicasts for groups not joined too */
   char				ip_mc_name[MAX_ADDR_LEN];	/* Multicast device name */
   struct ip_mc_socklist		*ip_mc_list;			/* Group array */
 #endif  
@@ -197,6 +237,8 @@ struct socket			*socket;
   
 };
 
+struct file;
+
 struct proto {
   struct sk_buff *	(*wmalloc)(struct sock *sk,
 				    unsigned long size, int force,
@@ -251,13 +293,48 @@ struct proto {
   				 char *optval, int optlen);
   int			(*getsockopt)(struct sock *sk, int level, int optname,
   				char *optval, int *option);  	 
+  int			(*sendfile)(struct sock *sk, struct file *file,
+				    int len, int nonblock);
+  int			(*recvmmsg)(struct sock *sk, struct mmsghdr *vec,
+				    int vlen, int noblock, unsigned flags);
+  int			(*sendmmsg)(struct sock *sk, struct mmsghdr *vec,
+				    int vlen, int noblock, unsigned flags);
   unsigned short	max_header;
   unsigned long		retransmits;
   struct sock *		sock_array[SOCK_ARRAY_SIZE];
   char			name[80];
   int			inuse, highestinuse;
+  /*
+   *	Lookup tables for get_sock(). Every bound socket is on exactly
+   *	one of these as well as on sock_array, which stays the bind table.
+   */
+  struct sock *		sock_ehash[SOCK_EHASH_SIZE];	/* Connected, by 4-tuple */
+  struct sock *		sock_lhash[SOCK_ARRAY_SIZE];	/* Wildcard, by local port */
+  int			mc_all_inuse[SOCK_ARRAY_SIZE];	/* On sock_array with ip_mc_all */
 };
 
+/*
+ *	Values for sk->hashed
+ */
+
+#define SOCK_UNHASHED	0
+#define SOCK_EHASHED	1
+#define SOCK_LHASHED	2
+
+/*
+ *	Hash a connection 4-tuple. The local port is in host order (as
+ *	sk->num), everything else in network order as it comes off the wire.
+ */
+
+static inline int sock_ehashfn(unsigned long laddr, unsigned short lnum,
+			       unsigned long raddr, unsigned short rnum)
+{
+	unsigned long h = laddr ^ raddr ^ (((unsigned long)lnum) << 16) ^ rnum;
+	h ^= h >> 16;
+	h ^= h >> 8;
+	return h & (SOCK_EHASH_SIZE - 1);
+}
+
 #define TIME_WRITE	1
 #define TIME_CLOSE	2
 #define TIME_KEEPOPEN	3
@@ -276,6 +353,9 @@ struct proto {
 extern void			destroy_sock(struct sock *sk);
 extern unsigned short		get_new_socknum(struct proto *, unsigned short);
 extern void			put_sock(unsigned short, struct sock *); 
+extern void			rehash_sock(struct sock *);
+extern void			unhash_sock(struct sock *);
+extern void			set_sock_mc_all(struct sock *, int);
 extern void			release_sock(struct sock *sk);
 extern struct sock		*get_sock(struct proto *, unsigned short,
 					  unsigned long, unsigned short,
@@ -285,6 +365,12 @@ extern struct sock		*get_sock_mcast(struct sock *, unsigned short,
 					  unsigned long);
 extern struct sock		*get_sock_raw(struct sock *, unsigned short,
 					  unsigned long, unsigned long);
+#ifdef CONFIG_IP_MULTICAST
+extern struct ip_mc_member	*get_mc_member(struct ip_mc_member *, struct proto *,
+					  unsigned short, unsigned long,
+					  unsigned short, unsigned long,
+					  struct device *);
+#endif
 
 extern struct sk_buff		*sock_wmalloc(struct sock *sk,
 					      unsigned long size, int force,
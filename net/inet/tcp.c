@@ -242,9 +242,13 @@
 #define SEQ_TICK 3
 unsigned long seq_offset;
 struct tcp_mib	tcp_statistics;
+struct tcpext_mib tcpext_statistics;
 
 static void tcp_close(struct sock *sk, int timeout);
-
+static void tcp_synq_purge(struct sock *sk);
+static int tcp_tw_hold(struct sock *sk);
+static void tcp_send_skb_check(struct sk_buff *skb, struct tcphdr *th,
+	unsigned long saddr, unsigned long daddr, int len);
 
 /*
  *	The less said about this the better, but it works and will do for 1.2 
@@ -312,6 +316,13 @@ int tcp_select_window(struct sock *sk)
 	if(sk->window_clamp)
 		// 取小的
 		new_window=min(sk->window_clamp,new_window);
+	/*
+	 *	The window has to fit the 16 bit header field after scaling.
+	 *	Round it down to what the other end will actually see.
+	 */
+	if (new_window > (65535 << sk->rcv_wscale))
+		new_window = 65535 << sk->rcv_wscale;
+	new_window &= ~((1 << sk->rcv_wscale) - 1);
 	/*
 	 * 	Two things are going on here.  First, we don't ever offer a
 	 * 	window less than min(sk->mss, MAX_WINDOW/2).  This is the
@@ -331,23 +342,257 @@ int tcp_select_window(struct sock *sk)
 	return(new_window);
 }
 
+/*
+ *	Pick the shift for our receive window (RFC 1323): the smallest one
+ *	that lets the largest window we could offer fit into 16 bits. This
+ *	is fixed once the SYN is out, so SO_RCVBUF must be set before
+ *	connect() or listen().
+ */
+
+static int tcp_select_wscale(unsigned long rcvbuf, unsigned long window_clamp)
+{
+	unsigned long space = rcvbuf / 2;
+	int wscale = 0;
+
+	if (window_clamp && window_clamp < space)
+		space = window_clamp;
+	while (space > 65535 && wscale < TCP_MAX_WSCALE)
+	{
+		space >>= 1;
+		wscale++;
+	}
+	return wscale;
+}
+
+/*
+ *	The window field for an outgoing segment that is not a SYN.
+ */
+
+static inline unsigned short tcp_window_field(struct sock *sk, unsigned long window)
+{
+	return htons(window >> sk->rcv_wscale);
+}
+
+/*
+ *	The window the other end offers in this segment. The window in a
+ *	SYN is never scaled.
+ */
+
+static inline unsigned long tcp_peer_window(struct sock *sk, struct tcphdr *th)
+{
+	if (th->syn)
+		return ntohs(th->window);
+	return (unsigned long) ntohs(th->window) << sk->snd_wscale;
+}
+
+/*
+ *	The timestamp option always goes first, padded to 12 bytes, so that
+ *	a segment carrying one has it right after the TCP header. Write it
+ *	there if timestamps are in use and return its length.
+ */
+
+static int tcp_tstamp_option(struct sock *sk, struct tcphdr *th)
+{
+	unsigned long *ptr = (unsigned long *)(th + 1);
+
+	if (!sk->tstamp_ok)
+		return 0;
+	ptr[0] = htonl(TCPOPT_TSTAMP_HDR);
+	ptr[1] = htonl(jiffies);
+	ptr[2] = htonl(sk->ts_recent);
+	return TCPOLEN_TSTAMP_ALIGNED;
+}
+
+/*
+ *	A segment built earlier is going out now (queued data, a
+ *	retransmit): bring its timestamp up to date like the ack and
+ *	window fields. The caller redoes the checksum.
+ */
+
+static inline void tcp_tstamp_refresh(struct sock *sk, struct tcphdr *th)
+{
+	unsigned long *ptr = (unsigned long *)(th + 1);
+
+	if (th->doff*4 >= sizeof(struct tcphdr) + TCPOLEN_TSTAMP_ALIGNED &&
+	    ptr[0] == htonl(TCPOPT_TSTAMP_HDR))
+	{
+		ptr[1] = htonl(jiffies);
+		ptr[2] = htonl(sk->ts_recent);
+	}
+}
+
+/*
+ *	The most data a segment may carry: the MSS the other end gave us,
+ *	less the options we put on every segment.
+ */
+
+static inline int tcp_seg_space(struct sock *sk)
+{
+	if (sk->tstamp_ok)
+		return sk->mtu - TCPOLEN_TSTAMP_ALIGNED;
+	return sk->mtu;
+}
+
+/*
+ *	Write the options that go on a SYN or SYN-ACK: our MSS, plus the
+ *	timestamp, window scale (unless wscale is -1) and SACK permitted
+ *	options as asked. On an active open we offer them all, on a
+ *	SYN-ACK we only answer the ones the other end sent. Returns their
+ *	length, which is always a multiple of 4.
+ */
+
+static int tcp_syn_options(unsigned char *ptr, unsigned short mtu, int wscale,
+	int tstamp, unsigned long ts_recent, int sack)
+{
+	int len = 0;
+
+	if (tstamp)
+	{
+		((unsigned long *)ptr)[0] = htonl(TCPOPT_TSTAMP_HDR);
+		((unsigned long *)ptr)[1] = htonl(jiffies);
+		((unsigned long *)ptr)[2] = htonl(ts_recent);
+		ptr += TCPOLEN_TSTAMP_ALIGNED;
+		len += TCPOLEN_TSTAMP_ALIGNED;
+	}
+	ptr[0] = TCPOPT_MSS;
+	ptr[1] = 4;
+	ptr[2] = (mtu >> 8) & 0xff;
+	ptr[3] = mtu & 0xff;
+	ptr += 4;
+	len += 4;
+	if (wscale >= 0)
+	{
+		ptr[0] = TCPOPT_NOP;
+		ptr[1] = TCPOPT_WINDOW;
+		ptr[2] = 3;
+		ptr[3] = wscale;
+		ptr += 4;
+		len += 4;
+	}
+	if (sack)
+	{
+		ptr[0] = TCPOPT_NOP;
+		ptr[1] = TCPOPT_NOP;
+		ptr[2] = TCPOPT_SACK_PERM;
+		ptr[3] = TCPOLEN_SACK_PERM;
+		len += 4;
+	}
+	return len;
+}
+
+/*
+ *	Describe the out of order queue in a SACK option (RFC 2018) of at
+ *	most max blocks. The ack_seq of the segments there holds their
+ *	right edge (see tcp_data()). The block holding the segment that
+ *	arrived last goes first, the rest follow in sequence order.
+ *	Returns the option length, 0 if there is nothing to report.
+ */
+
+static int tcp_sack_option(struct sock *sk, unsigned char *ptr, int max)
+{
+	unsigned long blk[TCP_MAX_SACKS][2];
+	unsigned long start = 0, end = 0;
+	struct sk_buff *skb;
+	int n = 1, i, len;
+
+	/*
+	 *	blk[0] is kept for the most recent block.
+	 */
+
+	blk[0][0] = blk[0][1] = 0;
+	skb = sk->out_of_order_queue.next;
+	for (;;)
+	{
+		int last = (skb == (struct sk_buff *)&sk->out_of_order_queue);
+
+		if (!last)
+		{
+			if (!after(skb->h.th->ack_seq, sk->acked_seq))
+			{
+				skb = skb->next;
+				continue;
+			}
+			if (start != end && !after(skb->h.th->seq, end))
+			{
+				if (after(skb->h.th->ack_seq, end))
+					end = skb->h.th->ack_seq;
+				skb = skb->next;
+				continue;
+			}
+		}
+		if (start != end)
+		{
+			if (!before(sk->sack_last, start) && before(sk->sack_last, end))
+				i = 0;
+			else if (n < max)
+				i = n++;
+			else
+				i = -1;
+			if (i >= 0)
+			{
+				blk[i][0] = start;
+				blk[i][1] = end;
+			}
+		}
+		if (last)
+			break;
+		start = skb->h.th->seq;
+		end = skb->h.th->ack_seq;
+		skb = skb->next;
+	}
+
+	i = (blk[0][0] == blk[0][1]);	/* No recent block, skip the slot */
+	if (n == i)
+		return 0;
+	len = TCPOLEN_SACK_BASE + (n - i) * TCPOLEN_SACK_PERBLOCK;
+	ptr[0] = TCPOPT_NOP;
+	ptr[1] = TCPOPT_NOP;
+	ptr[2] = TCPOPT_SACK;
+	ptr[3] = len;
+	ptr += 4;
+	for (; i < n; i++)
+	{
+		((unsigned long *)ptr)[0] = htonl(blk[i][0]);
+		((unsigned long *)ptr)[1] = htonl(blk[i][1]);
+		ptr += TCPOLEN_SACK_PERBLOCK;
+	}
+	return len + 2;		/* And the two NOPs */
+}
+
+/*
+ *	Children that have completed the handshake wait for accept() on a
+ *	FIFO hung off the listener, linked through accept_next. A child is
+ *	queued as its final ack arrives and is only handed out once that
+ *	ack has made it established.
+ */
+
+static void tcp_accept_enqueue(struct sock *s, struct sock *newsk)
+{
+	unsigned long flags;
+
+	newsk->accept_next = NULL;
+	save_flags(flags);
+	cli();
+	if (s->accept_tail != NULL)
+		s->accept_tail->accept_next = newsk;
+	else
+		s->accept_head = newsk;
+	s->accept_tail = newsk;
+	s->accept_backlog++;
+	restore_flags(flags);
+}
+
 /*
  *	Find someone to 'accept'. Must be called with
  *	sk->inuse=1 or cli()
  */ 
 // 找出已经完成三次握手的socket
-static struct sk_buff *tcp_find_established(struct sock *s)
+static struct sock *tcp_find_established(struct sock *s)
 {
-	struct sk_buff *p=skb_peek(&s->receive_queue);
-	if(p==NULL)
-		return NULL;
-	do
-	{
-		if(p->sk->state == TCP_ESTABLISHED || p->sk->state >= TCP_FIN_WAIT1)
-			return p;
-		p=p->next;
-	}
-	while(p!=(struct sk_buff *)&s->receive_queue);
+	struct sock *p = s->accept_head;
+
+	if (p != NULL && (p->state == TCP_ESTABLISHED || p->state >= TCP_FIN_WAIT1))
+		return p;
 	return NULL;
 }
 
@@ -356,17 +601,23 @@ static struct sk_buff *tcp_find_established(struct sock *s)
  *	tcp_accept() to get connections from the queue.
  */
 // 返回一个完成的连接
-static struct sk_buff *tcp_dequeue_established(struct sock *s)
+static struct sock *tcp_dequeue_established(struct sock *s)
 {
-	struct sk_buff *skb;
+	struct sock *p;
 	unsigned long flags;
 	save_flags(flags);
 	cli(); 
-	skb=tcp_find_established(s);
-	if(skb!=NULL)
-		skb_unlink(skb);	/* Take it off the queue */
+	p = tcp_find_established(s);
+	if (p != NULL)
+	{
+		/* Take it off the queue */
+		if ((s->accept_head = p->accept_next) == NULL)
+			s->accept_tail = NULL;
+		p->accept_next = NULL;
+		s->accept_backlog--;
+	}
 	restore_flags(flags);
-	return skb;
+	return p;
 }
 
 /* 
@@ -377,19 +628,33 @@ static struct sk_buff *tcp_dequeue_established(struct sock *s)
 // 用于listen型的socket
 static void tcp_close_pending (struct sock *sk) 
 {
-	struct sk_buff *skb;
-	// 置socket为释放状态，关闭建立的连接，释放读缓冲区空间
-	while ((skb = skb_dequeue(&sk->receive_queue)) != NULL) 
+	struct sock *p;
+	unsigned long flags;
+	// 置socket为释放状态，关闭建立的连接
+	for (;;)
 	{
-		skb->sk->dead=1;
-		tcp_close(skb->sk, 0);
-		kfree_skb(skb, FREE_READ);
+		save_flags(flags);
+		cli();
+		if ((p = sk->accept_head) != NULL)
+		{
+			if ((sk->accept_head = p->accept_next) == NULL)
+				sk->accept_tail = NULL;
+			sk->accept_backlog--;
+		}
+		restore_flags(flags);
+		if (p == NULL)
+			break;
+		p->dead=1;
+		tcp_close(p, 0);
 	}
+	/* Those still in the handshake are only in the SYN table */
+	tcp_synq_purge(sk);
 	return;
 }
 
 /*
- *	Enter the time wait state. 
+ *	Enter the time wait state. If nobody holds the socket any more a
+ *	TIME_WAIT bucket does the waiting and the socket is freed.
  */
 // 进入time_wait状态，开启msl定时器
 static void tcp_time_wait(struct sock *sk)
@@ -398,6 +663,11 @@ static void tcp_time_wait(struct sock *sk)
 	sk->shutdown = SHUTDOWN_MASK;
 	if (!sk->dead)
 		sk->state_change(sk);
+	else if (tcp_tw_hold(sk))
+	{
+		tcp_set_state(sk, TCP_CLOSE);
+		return;
+	}
 	reset_msl_timer(sk, TIME_CLOSE, TCP_TIMEWAIT_LEN);
 }
 
@@ -423,6 +693,18 @@ void tcp_do_retransmit(struct sock *sk, int all)
 		struct iphdr *iph;
 		int size;
 
+		/*
+		 *	The other end has this one already (SACK). Only the
+		 *	holes need filling, and they don't count against
+		 *	the window.
+		 */
+
+		if (skb->sacked && all)
+		{
+			skb = skb->link3;
+			continue;
+		}
+
 		dev = skb->dev;
 		IS_SKB(skb);
 		// 发送的开始时间
@@ -467,8 +749,9 @@ void tcp_do_retransmit(struct sock *sk, int all)
 		 */
 		// 当前的ack
 		th->ack_seq = ntohl(sk->acked_seq);
-		th->window = ntohs(tcp_select_window(sk));
-		tcp_send_check(th, sk->saddr, sk->daddr, size, sk);
+		th->window = tcp_window_field(sk, tcp_select_window(sk));
+		tcp_tstamp_refresh(sk, th);
+		tcp_send_skb_check(skb, th, sk->saddr, sk->daddr, size);
 		
 		/*
 		 *	If the interface is (still) up and running, kick it.
@@ -522,20 +805,51 @@ void tcp_do_retransmit(struct sock *sk, int all)
 }
 
 /*
- *	Reset the retransmission timer
+ *	Reset the retransmission timer. The reason and the deadline live in
+ *	the socket; the timer itself is only moved when the new deadline is
+ *	earlier than the one it is set for. This is called for nearly every
+ *	segment, and usually only pushes the deadline back. If the timer
+ *	goes off before the deadline retransmit_timer() sets it again for
+ *	the time left.
  */
 // 重置重传定时器 
 static void reset_xmit_timer(struct sock *sk, int why, unsigned long when)
 {
-	del_timer(&sk->retransmit_timer);
-	sk->ip_xmit_timeout = why;
+	unsigned long flags;
+
 	if((int)when < 0)
 	{
 		when=3;
 		printk("Error: Negative timer in xmit_timer\n");
 	}
+	save_flags(flags);
+	cli();
+	sk->ip_xmit_timeout = why;
+	sk->xmit_deadline = jiffies + when;
+	if (sk->retransmit_timer.next != NULL &&
+	    (long) (sk->retransmit_timer.expires - sk->xmit_deadline) <= 0)
+	{
+		tcpext_statistics.TcpExtTimerLazy++;
+		restore_flags(flags);
+		return;
+	}
+	del_timer(&sk->retransmit_timer);
 	sk->retransmit_timer.expires=when;
 	add_timer(&sk->retransmit_timer);
+	tcpext_statistics.TcpExtTimerArmed++;
+	restore_flags(flags);
+}
+
+/*
+ *	Stop the retransmission timer. A timer still pending finds no
+ *	reason when it goes off and does nothing.
+ */
+
+static void tcp_clear_xmit_timer(struct sock *sk)
+{
+	if (sk->retransmit_timer.next != NULL)
+		tcpext_statistics.TcpExtTimerLazy++;
+	sk->ip_xmit_timeout = 0;
 }
 
 /*
@@ -583,11 +897,36 @@ void tcp_retransmit_time(struct sock *sk, int all)
 
 static void tcp_retransmit(struct sock *sk, int all)
 {
+	struct sk_buff *skb;
+
+	/*
+	 *	A SACKed segment at the head of the queue would have been
+	 *	acked by now unless the other end threw it away again
+	 *	(reneged, RFC 2018 section 8). Forget the scoreboard.
+	 */
+
+	if (sk->send_head != NULL && sk->send_head->sacked)
+	{
+		for (skb = sk->send_head; skb != NULL; skb = skb->link3)
+			skb->sacked = 0;
+	}
+
 	if (all) 
 	{
 		tcp_retransmit_time(sk, all);
 		return;
 	}
+
+	/*
+	 *	A timeout ends any fast recovery. The dup acks for what
+	 *	we had out before it must not start another one.
+	 */
+
+	sk->nr_timeouts++;
+	tcpext_statistics.TcpExtTimeouts++;
+	sk->in_recovery = 0;
+	sk->dup_acks = 0;
+	sk->high_seq = sk->sent_seq;
 	// 减少发送数据包的数量
 	sk->ssthresh = sk->cong_window >> 1; /* remember window where we lost */
 	/* sk->ssthresh in theory can be zero.  I guess that's OK */
@@ -626,7 +965,7 @@ static int tcp_write_timeout(struct sock *sk)
 	{
 		sk->err = ETIMEDOUT;
 		sk->error_report(sk);
-		del_timer(&sk->retransmit_timer);
+		tcp_clear_xmit_timer(sk);
 		/*
 		 *	Time wait the socket 
 		 */
@@ -661,13 +1000,34 @@ static int tcp_write_timeout(struct sock *sk)
 static void retransmit_timer(unsigned long data)
 {
 	struct sock *sk = (struct sock*)data;
-	int why = sk->ip_xmit_timeout;
+	int why;
+
+	cli();
+	why = sk->ip_xmit_timeout;
+	if (!why)
+	{
+		/* Stopped since it was set */
+		sti();
+		return;
+	}
+
+	/*
+	 *	Set for an earlier deadline that has since been pushed back.
+	 */
+
+	if ((long) (sk->xmit_deadline - jiffies) >= 0)
+	{
+		sk->retransmit_timer.expires = sk->xmit_deadline - jiffies;
+		add_timer(&sk->retransmit_timer);
+		tcpext_statistics.TcpExtTimerEarly++;
+		sti();
+		return;
+	}
 
 	/* 
 	 * only process if socket is not in use
 	 */
 
-	cli();
 	// socket正在被使用，一秒后重试
 	if (sk->inuse || in_bh) 
 	{
@@ -922,7 +1282,7 @@ static int tcp_listen_select(struct sock *sk, int sel_type, select_table *wait)
 		int retval;
 
 		sk->inuse = 1;
-		retval = (tcp_find_established(sk) != NULL);
+		retval = (sk->accept_backlog && tcp_find_established(sk) != NULL);
 		release_sock(sk);
 		// 没有建立的连接，阻塞等待唤醒
 		if (!retval)
@@ -1058,81 +1418,10 @@ int tcp_ioctl(struct sock *sk, int cmd, unsigned long arg)
 unsigned short tcp_check(struct tcphdr *th, int len,
 	  unsigned long saddr, unsigned long daddr)
 {     
-	unsigned long sum;
-   
 	if (saddr == 0) saddr = ip_my_addr();
 
-/*
- * stupid, gcc complains when I use just one __asm__ block,
- * something about too many reloads, but this is just two
- * instructions longer than what I want
- */
-	__asm__("
-	    addl %%ecx, %%ebx
-	    adcl %%edx, %%ebx
-	    adcl $0, %%ebx
-	    "
-	: "=b"(sum)
-	: "0"(daddr), "c"(saddr), "d"((ntohs(len) << 16) + IPPROTO_TCP*256)
-	: "bx", "cx", "dx" );
-	__asm__("
-	    movl %%ecx, %%edx
-	    cld
-	    cmpl $32, %%ecx
-	    jb 2f
-	    shrl $5, %%ecx
-	    clc
-1:	    lodsl
-	    adcl %%eax, %%ebx
-	    lodsl
-	    adcl %%eax, %%ebx
-	    lodsl
-	    adcl %%eax, %%ebx
-	    lodsl
-	    adcl %%eax, %%ebx
-	    lodsl
-	    adcl %%eax, %%ebx
-	    lodsl
-	    adcl %%eax, %%ebx
-	    lodsl
-	    adcl %%eax, %%ebx
-	    lodsl
-	    adcl %%eax, %%ebx
-	    loop 1b
-	    adcl $0, %%ebx
-	    movl %%edx, %%ecx
-2:	    andl $28, %%ecx
-	    je 4f
-	    shrl $2, %%ecx
-	    clc
-3:	    lodsl
-	    adcl %%eax, %%ebx
-	    loop 3b
-	    adcl $0, %%ebx
-4:	    movl $0, %%eax
-	    testw $2, %%dx
-	    je 5f
-	    lodsw
-	    addl %%eax, %%ebx
-	    adcl $0, %%ebx
-	    movw $0, %%ax
-5:	    test $1, %%edx
-	    je 6f
-	    lodsb
-	    addl %%eax, %%ebx
-	    adcl $0, %%ebx
-6:	    movl %%ebx, %%eax
-	    shrl $16, %%eax
-	    addw %%ax, %%bx
-	    adcw $0, %%bx
-	    "
-	: "=b"(sum)
-	: "0"(sum), "c"(len), "S"(th)
-	: "ax", "bx", "cx", "dx", "si" );
-
-  	/* We only want the bottom 16 bits, but we never cleared the top 16. */
-  
-  	return((~sum) & 0xffff);
+	return csum_tcpudp_magic(saddr, daddr, len, IPPROTO_TCP,
+		csum_partial((unsigned char *) th, len, 0));
 }
 
 
@@ -1145,6 +1434,27 @@ void tcp_send_check(struct tcphdr *th, unsigned long saddr,
 	return;
 }
 
+/*
+ *	The same for a segment on its way out. If the payload was summed as
+ *	it was copied in (skb->csum_ok), only the header is summed here, so
+ *	a retransmit with a new ack and window costs no pass over the data.
+ */
+
+static void tcp_send_skb_check(struct sk_buff *skb, struct tcphdr *th,
+	unsigned long saddr, unsigned long daddr, int len)
+{
+	if (!skb->csum_ok)
+	{
+		tcp_send_check(th, saddr, daddr, len, NULL);
+		return;
+	}
+	if (saddr == 0)
+		saddr = ip_my_addr();
+	th->check = 0;
+	th->check = csum_tcpudp_magic(saddr, daddr, len, IPPROTO_TCP,
+		csum_add(csum_partial((unsigned char *) th, th->doff*4, 0), skb->csum));
+}
+
 /*
  *	This is the main buffer sending routine. We queue the buffer
  *	having checked it is sane seeming.
@@ -1179,7 +1489,7 @@ static void tcp_send_skb(struct sock *sk, struct sk_buff *skb)
 	 *	tcp stacks if ack is not set)
 	 */
 	// 相等说明待发送的数据长度0
-	if (size == sizeof(struct tcphdr)) 
+	if (size == th->doff*4) 
 	{
 		/* If it's got a syn or fin it's notionally included in the size..*/
 		// 不是syn或fin包则报错，只有这两种包的负载可以为0
@@ -1240,9 +1550,10 @@ static void tcp_send_skb(struct sock *sk, struct sk_buff *skb)
 		 */
 		// 希望对方传输的数据的序列化，即小于ack_seq的都收到了
 		th->ack_seq = ntohl(sk->acked_seq);
-		th->window = ntohs(tcp_select_window(sk));
+		th->window = tcp_window_field(sk, tcp_select_window(sk));
+		tcp_tstamp_refresh(sk, th);
 
-		tcp_send_check(th, sk->saddr, sk->daddr, size, sk);
+		tcp_send_skb_check(skb, th, sk->saddr, sk->daddr, size);
 		// 将要发送的数据包第一个字节的序号 
 		sk->sent_seq = sk->write_seq;
 		
@@ -1416,7 +1727,7 @@ static void tcp_send_ack(unsigned long sequence, unsigned long ack,
 	t1->ack = 1;
 	sk->window = tcp_select_window(sk);
 	// 本机窗口大小
-	t1->window = ntohs(sk->window);
+	t1->window = tcp_window_field(sk, sk->window);
 	t1->res1 = 0;
 	t1->res2 = 0;
 	t1->rst = 0;
@@ -1442,7 +1753,7 @@ static void tcp_send_ack(unsigned long sequence, unsigned long ack,
 			if(sk->keepopen) {
 				reset_xmit_timer(sk,TIME_KEEPOPEN,TCP_TIMEOUT_LEN);
 			} else {
-				delete_timer(sk);
+				tcp_clear_xmit_timer(sk);
 			}
 		}
   	}
@@ -1452,9 +1763,14 @@ static void tcp_send_ack(unsigned long sequence, unsigned long ack,
   	 */
   	// 确认的序列号 
   	t1->ack_seq = ntohl(ack);
-  	t1->doff = sizeof(*t1)/4;
+	tmp = tcp_tstamp_option(sk, t1);
+	if (sk->sack_ok)
+		tmp += tcp_sack_option(sk, (unsigned char *)(t1 + 1) + tmp,
+				       sk->tstamp_ok ? TCP_MAX_SACKS - 1 : TCP_MAX_SACKS);
+  	t1->doff = (sizeof(*t1) + tmp)/4;
+	buff->len += tmp;
 	// 计算校验和
-  	tcp_send_check(t1, sk->saddr, daddr, sizeof(*t1), sk);
+  	tcp_send_check(t1, sk->saddr, daddr, sizeof(*t1) + tmp, sk);
   	if (sk->debug)
   		 printk("\rtcp_ack: seq %lx ack %lx\n", sequence, ack);
   	tcp_statistics.TcpOutSegs++;
@@ -1469,6 +1785,7 @@ static void tcp_send_ack(unsigned long sequence, unsigned long ack,
 // 构建tcp头
 extern __inline int tcp_build_header(struct tcphdr *th, struct sock *sk, int push)
 {
+	int tmp;
 
 	memcpy(th,(void *) &(sk->dummy_th), sizeof(*th));
 	// 序列号，即当前发送的数据中第一个字节的序号
@@ -1484,22 +1801,92 @@ extern __inline int tcp_build_header(struct tcphdr *th, struct sock *sk, int pus
 	sk->ack_timed = 0;
 	th->ack_seq = htonl(sk->acked_seq);
 	sk->window = tcp_select_window(sk);
-	th->window = htons(sk->window);
+	th->window = tcp_window_field(sk, sk->window);
+	tmp = tcp_tstamp_option(sk, th);
+	th->doff = (sizeof(*th) + tmp)/4;
+
+	return(sizeof(*th) + tmp);
+}
+
+/*
+ *	The last segment on the write queue, if more data may go on its end:
+ *	it has not been sent, is short of the mss, has room in its buffer and
+ *	carries no SYN, FIN or urgent data. *hdrlen is set to the length of
+ *	its headers. Queued segments keep their end in skb->h.seq, so the
+ *	TCP header is found from the IP one as in tcp_write_xmit(). The
+ *	caller holds the socket, so only we touch the write queue.
+ */
+
+static struct sk_buff *tcp_write_tail(struct sock *sk, int *hdrlen)
+{
+	struct sk_buff *skb = sk->write_queue.prev;
+	struct iphdr *iph;
+	struct tcphdr *th;
+
+	if (skb == (struct sk_buff *) &sk->write_queue)
+		return NULL;
+	iph = (struct iphdr *)(skb->data + skb->dev->hard_header_len);
+	th = (struct tcphdr *)(((char *)iph) + (iph->ihl << 2));
+	if (th->syn || th->fin || th->urg)
+		return NULL;
+	*hdrlen = ((unsigned char *) th - skb->data) + th->doff*4;
+	if (skb->len - *hdrlen >= sk->mss)
+		return NULL;
+	if (skb->len >= skb->mem_len - sizeof(struct sk_buff))
+		return NULL;
+	return skb;
+}
+
+/*
+ *	Put up to copy bytes of the caller's data into a segment at to: from
+ *	user memory for write(), or straight from a file for sendfile(),
+ *	whose read() then copies out of the buffer cache into the segment.
+ *	The payload is summed on the way in while it is cache hot. off is
+ *	where to is in the payload; the sum only stays good if that is even.
+ *	Returns the bytes put in, which is short at the end of a file, or an
+ *	error.
+ */
 
-	return(sizeof(*th));
+static int tcp_fill(struct sk_buff *skb, unsigned char *to, int off,
+	unsigned char *from, struct file *file, int copy)
+{
+	unsigned long fs;
+	int ok = skb->csum_ok && !(off & 1);
+
+	if (file == NULL)
+	{
+		if (ok)
+			skb->csum = csum_add(skb->csum,
+				csum_partial_copy_fromuser(from, to, copy, 0));
+		else
+			memcpy_fromfs(to, from, copy);
+	}
+	else
+	{
+		fs = get_fs();
+		set_fs(get_ds());
+		copy = file->f_op->read(file->f_inode, file, (char *) to, copy);
+		set_fs(fs);
+		if (copy > 0 && ok)
+			skb->csum = csum_add(skb->csum, csum_partial(to, copy, 0));
+	}
+	skb->csum_ok = ok;
+	return copy;
 }
 
 /*
- *	This routine copies from a user buffer into a socket,
+ *	This routine copies from a user buffer, or a file, into a socket,
  *	and starts the transmit system.
  */
 
-static int tcp_write(struct sock *sk, unsigned char *from,
+static int tcp_do_write(struct sock *sk, unsigned char *from, struct file *file,
 	  int len, int nonblock, unsigned flags)
 {
 	int copied = 0;
 	int copy;
 	int tmp;
+	int hdrlen;
+	int err = 0;
 	struct sk_buff *skb;
 	struct sk_buff *send_tmp;
 	unsigned char *buff;
@@ -1615,12 +2002,10 @@ static int tcp_write(struct sock *sk, unsigned char *from,
 		// 先看是否有小块的数据被缓存起来，是的话先取出skb，不需要立刻发送的话再入队
 		if ((skb = tcp_dequeue_partial(sk)) != NULL) 
 		{
-		        int hdrlen;
-
 		         /* IP header + TCP header */
 			// 所有协议头的长度
 			hdrlen = ((unsigned long)skb->h.th - (unsigned long)skb->data)
-			         + sizeof(struct tcphdr);
+			         + skb->h.th->doff*4;
 	
 			/* Add more stuff to the end of skb->len */
 			// 不是紧急数据，则把数据追加到缓存的小包数据后面，是紧急数据则先把小包数据发出去，然后下一个循环再发普通数据
@@ -1635,7 +2020,18 @@ static int tcp_write(struct sock *sk, unsigned char *from,
 			  		copy = 0;
 				}
 	  			// 把用户的数据赋值copy长度个字节到数据包的数据部分
-				memcpy_fromfs(skb->data + skb->len, from, copy);
+				tmp = tcp_fill(skb, skb->data + skb->len,
+					skb->len - hdrlen, from, file, copy);
+				if (tmp < copy)
+				{
+					/* Short read from the file: stop after this */
+					if (tmp < 0)
+					{
+						err = tmp;
+						tmp = 0;
+					}
+					copy = len = tmp;
+				}
 				// 更新skb的data字段使用了多少字节
 				skb->len += copy;
 				// 下次复制的首地址
@@ -1649,7 +2045,7 @@ static int tcp_write(struct sock *sk, unsigned char *from,
 			}
 			// 数据部分大于等于mss或者是带外数据或者还没有发出去一个数据包则直接发送
 			if ((skb->len - hdrlen) >= sk->mss ||
-				(flags & MSG_OOB) || !sk->packets_out)
+				(flags & MSG_OOB) || (!sk->packets_out && !sk->cork))
 				tcp_send_skb(sk, skb);
 			else
 				// 继续缓存，满足条件后一起发送
@@ -1657,6 +2053,38 @@ static int tcp_write(struct sock *sk, unsigned char *from,
 			continue;
 		}
 
+	/*
+	 *	Then the last segment on the write queue, if the window or
+	 *	the congestion window has held it back: small writes made
+	 *	while we wait go out in it rather than in segments of their
+	 *	own. TCP_NODELAY does not stop this, as nothing is delayed.
+	 */
+		if (!(flags & MSG_OOB) && (skb = tcp_write_tail(sk, &hdrlen)) != NULL)
+		{
+			copy = min(sk->mss - (skb->len - hdrlen), len);
+			copy = min(copy, skb->mem_len - sizeof(struct sk_buff) - skb->len);
+			tmp = tcp_fill(skb, skb->data + skb->len,
+				skb->len - hdrlen, from, file, copy);
+			if (tmp < copy)
+			{
+				/* Short read from the file: stop after this */
+				if (tmp < 0)
+				{
+					err = tmp;
+					tmp = 0;
+				}
+				copy = len = tmp;
+			}
+			skb->len += copy;
+			skb->h.seq += copy;
+			from += copy;
+			copied += copy;
+			len -= copy;
+			sk->write_seq += copy;
+			tcpext_statistics.TcpExtWriteCoalesced++;
+			continue;
+		}
+
 	/*
 	 * We also need to worry about the window.
  	 * If window < 1/2 the maximum window we've seen from this
@@ -1801,7 +2229,21 @@ static int tcp_write(struct sock *sk, unsigned char *from,
 		// 更新skb->data中的数据长度
 		skb->len += tmp;
 		// 复制copy个字节到tcp头后面成为tcp报文的负载
-		memcpy_fromfs(buff+tmp, from, copy);
+		skb->csum = 0;
+		skb->csum_ok = 1;
+		tmp = tcp_fill(skb, buff+tmp, 0, from, file, copy);
+		if (tmp < copy)
+		{
+			/* Short read from the file: stop after this */
+			if (tmp <= 0)
+			{
+				if (tmp < 0)
+					err = tmp;
+				prot->wfree(sk, skb->mem_addr, skb->mem_len);
+				break;
+			}
+			copy = len = tmp;
+		}
 		// 更新需要复制的数据地址
 		from += copy;
 		// 复制字节数累加
@@ -1813,8 +2255,8 @@ static int tcp_write(struct sock *sk, unsigned char *from,
 		skb->free = 0;
 		// 更新下一个tcp报文的序列化
 		sk->write_seq += copy;
-		// 数据量太少并且不是紧急数据，并且有待确认的包（nagle算法规则），则先缓存
-		if (send_tmp != NULL && sk->packets_out) 
+		// 数据量太少并且不是紧急数据，并且有待确认的包（nagle算法规则）或者设置了TCP_CORK，则先缓存
+		if (send_tmp != NULL && (sk->packets_out || sk->cork)) 
 		{
 			tcp_enqueue_partial(send_tmp, sk);
 			continue;
@@ -1835,16 +2277,34 @@ static int tcp_write(struct sock *sk, unsigned char *from,
  *	Avoid possible race on send_tmp - c/o Johannes Stille 
  */
 	// 符合nagle算法条件或者没有开启nagle算法且序列号合法则发送
-	if(sk->partial && ((!sk->packets_out) 
+	if(sk->partial && !sk->cork && ((!sk->packets_out) 
      /* If not nagling we can send on the before case too.. */
 	      || (sk->nonagle && before(sk->write_seq , sk->window_seq))
       	))
   		tcp_send_partial(sk);
 
 	release_sock(sk);
+	if (err && !copied)
+		return(err);
 	return(copied);
 }
 
+static int tcp_write(struct sock *sk, unsigned char *from,
+	  int len, int nonblock, unsigned flags)
+{
+	return tcp_do_write(sk, from, NULL, len, nonblock, flags);
+}
+
+/*
+ *	Send len bytes of a file from its current position, reading them
+ *	straight into the segments.
+ */
+
+static int tcp_sendfile(struct sock *sk, struct file *file, int len, int nonblock)
+{
+	return tcp_do_write(sk, NULL, file, len, nonblock, 0);
+}
+
 /*
  *	This is just a wrapper. 
  */
@@ -1945,10 +2405,12 @@ static void tcp_read_wakeup(struct sock *sk)
 	sk->ack_backlog = 0;
 	sk->bytes_rcv = 0;
 	sk->window = tcp_select_window(sk);
-	t1->window = ntohs(sk->window);
+	t1->window = tcp_window_field(sk, sk->window);
 	t1->ack_seq = ntohl(sk->acked_seq);
-	t1->doff = sizeof(*t1)/4;
-	tcp_send_check(t1, sk->saddr, sk->daddr, sizeof(*t1), sk);
+	tmp = tcp_tstamp_option(sk, t1);
+	t1->doff = (sizeof(*t1) + tmp)/4;
+	buff->len += tmp;
+	tcp_send_check(t1, sk->saddr, sk->daddr, sizeof(*t1) + tmp, sk);
 	sk->prot->queue_xmit(sk, dev, buff, 1);
 	tcp_statistics.TcpOutSegs++;
 }
@@ -2031,14 +2493,14 @@ static void cleanup_rbuf(struct sock *sk)
 		} 
 		else 
 		{
-			/* Force it to send an ack soon. */
-			int was_active = del_timer(&sk->retransmit_timer);
-			if (!was_active || TCP_ACK_TIME < sk->timer.expires) 
-			{
-				reset_xmit_timer(sk, TIME_WRITE, TCP_ACK_TIME);
-			} 
-			else
-				add_timer(&sk->retransmit_timer);
+			/*
+			 *	Force it to send an ack soon. A reason may be
+			 *	left over from a timer that went off and was
+			 *	not set again, so check it is still pending.
+			 */
+			if (sk->retransmit_timer.next == NULL || !sk->ip_xmit_timeout ||
+			    (long) (sk->xmit_deadline - jiffies) > TCP_ACK_TIME)
+				reset_xmit_timer(sk, TIME_WRITE, TCP_ACK_TIME);
 		}
 	}
 } 
@@ -2431,7 +2893,7 @@ static void tcp_send_fin(struct sock *sk)
 		
 	release_sock(sk); /* in case the malloc sleeps. */
 	// 分配一个用于写的skb	
-	buff = prot->wmalloc(sk, MAX_RESET_SIZE,1 , GFP_KERNEL);
+	buff = prot->wmalloc(sk, MAX_FIN_SIZE,1 , GFP_KERNEL);
 	sk->inuse = 1;
 
 	if (buff == NULL)
@@ -2499,13 +2961,15 @@ static void tcp_send_fin(struct sock *sk)
 	// 期待收到对端的下一个字节的序列号
 	t1->ack_seq = ntohl(sk->acked_seq);
 	// 当前接收窗口的大小
-	t1->window = ntohs(sk->window=tcp_select_window(sk));
+	t1->window = tcp_window_field(sk, sk->window=tcp_select_window(sk));
 	// 是个fin包
 	t1->fin = 1;
 	t1->rst = 0;
-	// tcp头长度
-	t1->doff = sizeof(*t1)/4;
-	tcp_send_check(t1, sk->saddr, sk->daddr, sizeof(*t1), sk);
+	// tcp头长度，加上时间戳选项
+	tmp = tcp_tstamp_option(sk, t1);
+	t1->doff = (sizeof(*t1) + tmp)/4;
+	buff->len += tmp;
+	tcp_send_check(t1, sk->saddr, sk->daddr, sizeof(*t1) + tmp, sk);
 
 	/*
 	 * If there is data in the write queue, the fin must be appended to
@@ -2710,23 +3174,22 @@ static void tcp_reset(unsigned long saddr, unsigned long daddr, struct tcphdr *t
 
 
 /*
- *	Look for tcp options. Parses everything but only knows about MSS.
- *      This routine is always called with the packet containing the SYN.
- *      However it may also be called with the ack to the SYN.  So you
- *      can't assume this is always the SYN.  It's always called after
- *      we have set up sk->mtu to our own MTU.
- *
- *	We need at minimum to add PAWS support here. Possibly large windows
- *	as Linux gets deployed on 100Mb/sec networks.
+ *	Look for tcp options. Parses everything but only knows about MSS,
+ *	window scaling, SACK permitted and timestamps. The options that
+ *	only mean something on a SYN are ignored on other segments.
  */
- 
-static void tcp_options(struct sock *sk, struct tcphdr *th)
+
+static void tcp_parse_options(struct tcphdr *th, struct tcp_opts *opts)
 {
 	unsigned char *ptr;
 	int length=(th->doff*4)-sizeof(struct tcphdr);
-	int mss_seen = 0;
-    
+
 	ptr = (unsigned char *)(th + 1);
+	opts->mss = 0;
+	opts->wscale_ok = 0;
+	opts->snd_wscale = 0;
+	opts->sack_ok = 0;
+	opts->saw_tstamp = 0;
   
 	while(length>0)
 	{
@@ -2742,35 +3205,114 @@ static void tcp_options(struct sock *sk, struct tcphdr *th)
 	  			continue;
 	  		
 	  		default:
-	  			if(opsize<=2)	/* Avoid silly options looping forever */
+	  			if(opsize<2)	/* Avoid silly options looping forever */
 	  				return;
 	  			switch(opcode)
 	  			{
 	  				case TCPOPT_MSS:
 	  					if(opsize==4 && th->syn)
+	  						opts->mss=ntohs(*(unsigned short *)ptr);
+	  					break;
+	  				case TCPOPT_WINDOW:
+	  					if(opsize==3 && th->syn)
 	  					{
-	  						sk->mtu=min(sk->mtu,ntohs(*(unsigned short *)ptr));
-							mss_seen = 1;
+	  						opts->snd_wscale=min(*ptr, TCP_MAX_WSCALE);
+	  						opts->wscale_ok = 1;
 	  					}
 	  					break;
-		  				/* Add other options here as people feel the urge to implement stuff like large windows */
+	  				case TCPOPT_SACK_PERM:
+	  					if(opsize==TCPOLEN_SACK_PERM && th->syn)
+	  						opts->sack_ok = 1;
+	  					break;
+	  				case TCPOPT_TIMESTAMP:
+	  					if(opsize==TCPOLEN_TIMESTAMP)
+	  					{
+	  						opts->rcv_tsval=ntohl(*(unsigned long *)ptr);
+	  						opts->rcv_tsecr=ntohl(*(unsigned long *)(ptr+4));
+	  						opts->saw_tstamp = 1;
+	  					}
+	  					break;
+		  				/* Add other options here as people feel the urge to implement stuff like T/TCP */
 	  			}
 	  			ptr+=opsize-2;
 	  			length-=opsize;
 	  	}
 	}
+}
+
+/*
+ *	Apply the options of a segment to the socket.
+ *      This routine is always called with the packet containing the SYN.
+ *      However it may also be called with the ack to the SYN.  So you
+ *      can't assume this is always the SYN.  It's always called after
+ *      we have set up sk->mtu to our own MTU, and sk->rcv_wscale to the
+ *	shift we offered (or would offer in the SYN-ACK).
+ *	tcp_parse_tstamp() also uses it for segments whose options are not
+ *	laid out the usual way.
+ */
+ 
+static void tcp_options(struct sock *sk, struct tcphdr *th)
+{
+	struct tcp_opts opts;
+
+	tcp_parse_options(th, &opts);
+	sk->saw_tstamp = opts.saw_tstamp;
+	if (opts.saw_tstamp)
+	{
+		sk->rcv_tsval = opts.rcv_tsval;
+		sk->rcv_tsecr = opts.rcv_tsecr;
+	}
 	if (th->syn) 
 	{
-		if (! mss_seen)
+		if (opts.mss)
+			sk->mtu=min(sk->mtu, opts.mss);
+		else
 		      sk->mtu=min(sk->mtu, 536);  /* default MSS if none sent */
+		/*
+		 *	Scaling is only used if both ends asked for it.
+		 */
+		sk->wscale_ok = opts.wscale_ok;
+		sk->snd_wscale = opts.snd_wscale;
+		if (! opts.wscale_ok)
+			sk->rcv_wscale = 0;
+		/*
+		 *	So are timestamps. Theirs is the first one we echo.
+		 */
+		sk->tstamp_ok = opts.saw_tstamp;
+		sk->ts_recent = opts.saw_tstamp ? opts.rcv_tsval : 0;
+		sk->ts_recent_stamp = jiffies;
+		sk->sack_ok = opts.sack_ok;
 	}
 #ifdef CONFIG_INET_PCTCP
-	sk->mss = min(sk->max_window >> 1, sk->mtu);
+	sk->mss = min(sk->max_window >> 1, tcp_seg_space(sk));
 #else    
-	sk->mss = min(sk->max_window, sk->mtu);
+	sk->mss = min(sk->max_window, tcp_seg_space(sk));
 #endif  
 }
 
+/*
+ *	Pick up the timestamp option, if any, of a segment on a connection
+ *	that uses them. Nearly everyone sends it on its own, padded with
+ *	two NOPs, so check for that before walking the options.
+ */
+
+static inline void tcp_parse_tstamp(struct sock *sk, struct tcphdr *th)
+{
+	unsigned long *ptr = (unsigned long *)(th + 1);
+
+	if (th->doff == (sizeof(struct tcphdr) + TCPOLEN_TSTAMP_ALIGNED)/4 &&
+	    ptr[0] == htonl(TCPOPT_TSTAMP_HDR))
+	{
+		sk->rcv_tsval = ntohl(ptr[1]);
+		sk->rcv_tsecr = ntohl(ptr[2]);
+		sk->saw_tstamp = 1;
+		return;
+	}
+	sk->saw_tstamp = 0;
+	if (th->doff > sizeof(struct tcphdr)/4)
+		tcp_options(sk, th);
+}
+
 static inline unsigned long default_mask(unsigned long dst)
 {
 	dst = ntohl(dst);
@@ -2798,299 +3340,1134 @@ extern inline unsigned long tcp_init_seq(void)
 }
 
 /*
- *	This routine handles a connection request.
- *	It should make sure we haven't already responded.
- *	Because of the way BSD works, we have to send a syn/ack now.
- *	This also means it will be harder to close a socket which is
- *	listening.
+ *	The SYN table. A listener answers a SYN with a SYN-ACK and keeps
+ *	only a struct tcp_synreq for it; the socket is built when the final
+ *	ack of the handshake arrives (tcp_synq_ack()), so a flood of SYNs
+ *	no longer costs a sock and a queued SYN-ACK each. The table is
+ *	shared by all the listeners. It is changed with interrupts off, as
+ *	tcp_rcv() may run from release_sock() in process context.
  */
-// 收到一个syn包时的处理 
-static void tcp_conn_request(struct sock *sk, struct sk_buff *skb,
-		 unsigned long daddr, unsigned long saddr,
-		 struct options *opt, struct device *dev, unsigned long seq)
+
+static struct tcp_synreq *tcp_synq[TCP_SYNQ_HSIZE];
+static int tcp_synq_len = 0;		/* Requests in the table */
+static int tcp_synq_timer_on = 0;
+static unsigned long tcp_synq_secret[3];
+
+static void tcp_synq_expire(unsigned long);
+
+static struct timer_list tcp_synq_timer =
+	{ NULL, NULL, TCP_SYNQ_INTERVAL, 0L, &tcp_synq_expire };
+
+/*
+ *	Mix a 4-tuple, and a count for the SYN cookies, with one of our
+ *	secrets so that nobody can aim SYNs at one hash chain or guess a
+ *	cookie. Secret 0 is for the hash table, 1 and 2 for the cookies.
+ *	The ports are in network order like the addresses.
+ */
+
+static unsigned long tcp_synq_hash(unsigned long laddr, unsigned short lport,
+	unsigned long raddr, unsigned short rport, unsigned long count, int c)
 {
-	struct sk_buff *buff;
-	struct tcphdr *t1;
-	unsigned char *ptr;
-	struct sock *newsk;
-	struct tcphdr *th;
-	struct device *ndev=NULL;
-	int tmp;
-	struct rtable *rt;
-	
-	th = skb->h.th;
-	// data_ready是唤醒阻塞在accept函数的进程，而这次还没建立起连接，执行回调没有意义
-	/* If the socket is dead, don't accept the connection. */
-	if (!sk->dead) 
-	{
-  		sk->data_ready(sk,0);
-	}
-	else 
-	{	// 该socket已经处于释放状态，发送reset包
-		if(sk->debug)
-			printk("Reset on %p: Connect on dead socket.\n",sk);
-		tcp_reset(daddr, saddr, th, sk->prot, opt, dev, sk->ip_tos,sk->ip_ttl);
-		tcp_statistics.TcpAttemptFails++;
-		kfree_skb(skb, FREE_READ);
-		return;
-	}
+	unsigned long h = tcp_synq_secret[c] ^ count;
 
-	/*
-	 * Make sure we can accept more.  This will prevent a
-	 * flurry of syns from eating up all our memory.
-	 */
-	// 如果当前的半连接+已连接队列大小大于等于最大值则丢包
-	if (sk->ack_backlog >= sk->max_ack_backlog) 
-	{
-		tcp_statistics.TcpAttemptFails++;
-		kfree_skb(skb, FREE_READ);
+	h = ((h ^ raddr) * 0x9E3779B1UL) & 0xFFFFFFFFUL;
+	h = ((h ^ laddr) * 0x9E3779B1UL) & 0xFFFFFFFFUL;
+	h = ((h ^ (((unsigned long) lport << 16) | rport)) * 0x9E3779B1UL) & 0xFFFFFFFFUL;
+	return h ^ (h >> 16);
+}
+
+/*
+ *	There is no better source of randomness than the clock here. Pick
+ *	the secrets when the first SYN arrives, which is long enough after
+ *	boot to make them hard to guess.
+ */
+
+static void tcp_synq_init_secret(void)
+{
+	int i;
+
+	if (tcp_synq_secret[0] | tcp_synq_secret[1] | tcp_synq_secret[2])
 		return;
-	}
+	for (i = 0; i < 3; i++)
+		tcp_synq_secret[i] = ((tcp_init_seq() + jiffies) * 0x9E3779B1UL
+			^ tcp_synq_secret[(i + 2) % 3]) & 0xFFFFFFFFUL;
+}
 
-	/*
-	 * We need to build a new sock struct.
-	 * It is sort of bad to have a socket without an inode attached
-	 * to it, but the wake_up's will just wake up the listening socket,
-	 * and if the listening socket is destroyed before this is taken
-	 * off of the queue, this will take care of it.
-	 */
-	// 分配一个新的sock结构用于连接连接
-	newsk = (struct sock *) kmalloc(sizeof(struct sock), GFP_ATOMIC);
-	if (newsk == NULL) 
+/*
+ *	Find the request for a 4-tuple. Returns the link that points to it,
+ *	or to the NULL at the end of its chain if there is none, so that the
+ *	caller can unlink or insert. Call with interrupts off.
+ */
+
+static struct tcp_synreq **tcp_synq_find(unsigned long laddr, unsigned short lport,
+	unsigned long raddr, unsigned short rport)
+{
+	struct tcp_synreq **reqp;
+
+	reqp = &tcp_synq[tcp_synq_hash(laddr, lport, raddr, rport, 0, 0) & (TCP_SYNQ_HSIZE - 1)];
+	for (; *reqp != NULL; reqp = &(*reqp)->next)
 	{
-		/* just ignore the syn.  It will get retransmitted. */
-		tcp_statistics.TcpAttemptFails++;
-		kfree_skb(skb, FREE_READ);
-		return;
+		struct tcp_synreq *req = *reqp;
+
+		if (req->raddr == raddr && req->rport == rport &&
+		    req->laddr == laddr && req->lport == lport)
+			break;
 	}
-	// 从listen套接字复制内容，再覆盖某些字段
-	memcpy(newsk, sk, sizeof(*newsk));
-	skb_queue_head_init(&newsk->write_queue);
-	skb_queue_head_init(&newsk->receive_queue);
-	newsk->send_head = NULL;
-	newsk->send_tail = NULL;
-	skb_queue_head_init(&newsk->back_log);
-	newsk->rtt = 0;		/*TCP_CONNECT_TIME<<3*/
-	newsk->rto = TCP_TIMEOUT_INIT;
-	newsk->mdev = 0;
-	newsk->max_window = 0;
-	newsk->cong_window = 1;
-	newsk->cong_count = 0;
-	newsk->ssthresh = 0;
-	newsk->backoff = 0;
-	newsk->blog = 0;
-	newsk->intr = 0;
-	newsk->proc = 0;
-	newsk->done = 0;
-	newsk->partial = NULL;
-	newsk->pair = NULL;
-	newsk->wmem_alloc = 0;
-	newsk->rmem_alloc = 0;
-	newsk->localroute = sk->localroute;
+	return reqp;
+}
 
-	newsk->max_unacked = MAX_WINDOW - TCP_WINDOW_DIFF;
+/*
+ *	Take a request off the table and free it. Call with interrupts off.
+ */
 
-	newsk->err = 0;
-	newsk->shutdown = 0;
-	newsk->ack_backlog = 0;
-	// 期待收到的对端下一个字节的序列号
-	newsk->acked_seq = skb->h.th->seq+1;
-	// 进程可以读但是还没有读取的字节序列号
-	newsk->copied_seq = skb->h.th->seq+1;
-	// 当收到对端fin包的时候，回复的ack包中的序列号	
-	newsk->fin_seq = skb->h.th->seq;
-	// 进入syn_recv状态
-	newsk->state = TCP_SYN_RECV;
-	newsk->timeout = 0;
-	newsk->ip_xmit_timeout = 0;
-	// 下一个发送的字节的序列号
-	newsk->write_seq = seq; 
-	// 可发送的字节序列号最大值
-	newsk->window_seq = newsk->write_seq;
-	// 序列号小于rcv_ack_seq的数据包都已经收到
-	newsk->rcv_ack_seq = newsk->write_seq;
-	newsk->urg_data = 0;
-	newsk->retransmits = 0;
-	// 关闭套接字的时候不需要等待一段时间才能关闭
-	newsk->linger=0;
-	newsk->destroy = 0;
-	init_timer(&newsk->timer);
-	newsk->timer.data = (unsigned long)newsk;
-	newsk->timer.function = &net_timer;
-	init_timer(&newsk->retransmit_timer);
-	newsk->retransmit_timer.data = (unsigned long)newsk;
-	newsk->retransmit_timer.function=&retransmit_timer;
-	// 记录ip
-	newsk->dummy_th.source = skb->h.th->dest;
-	newsk->dummy_th.dest = skb->h.th->source;
-	
-	/*
-	 *	Swap these two, they are from our point of view. 
-	 */
-	 
-	newsk->daddr = saddr;
-	newsk->saddr = daddr;
-	// 放到tcp的socket哈希队列
-	put_sock(newsk->num,newsk);
-	newsk->dummy_th.res1 = 0;
-	newsk->dummy_th.doff = 6;
-	newsk->dummy_th.fin = 0;
-	newsk->dummy_th.syn = 0;
-	newsk->dummy_th.rst = 0;	
-	newsk->dummy_th.psh = 0;
-	newsk->dummy_th.ack = 0;
-	newsk->dummy_th.urg = 0;
-	newsk->dummy_th.res2 = 0;
-	newsk->acked_seq = skb->h.th->seq + 1;
-	newsk->copied_seq = skb->h.th->seq + 1;
-	newsk->socket = NULL;
+static void tcp_synq_unlink(struct tcp_synreq **reqp)
+{
+	struct tcp_synreq *req = *reqp;
 
-	/*
-	 *	Grab the ttl and tos values and use them 
-	 */
+	*reqp = req->next;
+	req->sk->syn_backlog--;
+	tcp_synq_len--;
+	tcpext_statistics.TcpExtSynRecv--;
+	kfree_s(req, sizeof(*req));
+}
 
-	newsk->ip_ttl=sk->ip_ttl;
-	newsk->ip_tos=skb->ip_hdr->tos;
+/*
+ *	Drop the requests of a listener that is going away.
+ */
 
-	/*
-	 *	Use 512 or whatever user asked for 
-	 */
+static void tcp_synq_purge(struct sock *sk)
+{
+	struct tcp_synreq **reqp;
+	unsigned long flags;
+	int i;
 
-	/*
-	 * 	Note use of sk->user_mss, since user has no direct access to newsk 
-	 */
+	save_flags(flags);
+	for (i = 0; i < TCP_SYNQ_HSIZE && sk->syn_backlog; i++)
+	{
+		cli();
+		reqp = &tcp_synq[i];
+		while (*reqp != NULL)
+		{
+			if ((*reqp)->sk == sk)
+				tcp_synq_unlink(reqp);
+			else
+				reqp = &(*reqp)->next;
+		}
+		restore_flags(flags);
+	}
+}
+
+/*
+ *	Our MSS and window clamp for a connection, from the route or else
+ *	a guess from the addresses. Use 512 or whatever user asked for.
+ *	Note use of sk->user_mss, since user has no direct access to the
+ *	socket we will build.
+ */
+
+static void tcp_synq_route(struct sock *sk, struct tcp_synreq *req, struct device *dev)
+{
+	struct rtable *rt;
 
-	rt=ip_rt_route(saddr, NULL,NULL);
+	rt=ip_rt_route(req->raddr, NULL,NULL);
 	
 	if(rt!=NULL && (rt->rt_flags&RTF_WINDOW))
-		newsk->window_clamp = rt->rt_window;
+		req->window_clamp = rt->rt_window;
 	else
-		newsk->window_clamp = 0;
+		req->window_clamp = 0;
 		
 	if (sk->user_mss)
-		newsk->mtu = sk->user_mss;
+		req->mtu = sk->user_mss;
 	else if(rt!=NULL && (rt->rt_flags&RTF_MSS))
-		newsk->mtu = rt->rt_mss - HEADER_SIZE;
+		req->mtu = rt->rt_mss - HEADER_SIZE;
 	else 
 	{
 #ifdef CONFIG_INET_SNARL	/* Sub Nets Are Local */
-		if ((saddr ^ daddr) & default_mask(saddr))
+		if ((req->raddr ^ req->laddr) & default_mask(req->raddr))
 #else
-		if ((saddr ^ daddr) & dev->pa_mask)
+		if ((req->raddr ^ req->laddr) & dev->pa_mask)
 #endif
-			newsk->mtu = 576 - HEADER_SIZE;
+			req->mtu = 576 - HEADER_SIZE;
 		else
-			newsk->mtu = MAX_WINDOW;
+			req->mtu = MAX_WINDOW;
 	}
 
 	/*
 	 *	But not bigger than device MTU 
 	 */
 
-	newsk->mtu = min(newsk->mtu, dev->mtu - HEADER_SIZE);
+	req->mtu = min(req->mtu, dev->mtu - HEADER_SIZE);
+}
 
-	/*
-	 *	This will min with what arrived in the packet 
-	 */
-	// 解析tcp选项
-	tcp_options(newsk,skb->h.th);
-	// 分配一个skb
-	buff = newsk->prot->wmalloc(newsk, MAX_SYN_SIZE, 1, GFP_ATOMIC);
+/*
+ *	The window we offer in the SYN-ACK, as tcp_select_window() would
+ *	for the new socket. The window in a SYN is not scaled.
+ */
+
+static unsigned long tcp_synq_window(struct sock *sk, struct tcp_synreq *req)
+{
+	unsigned long window = sk->prot->rspace(sk);
+
+	if (req->window_clamp)
+		window = min(req->window_clamp, window);
+	if (window > 65535)
+		window = 65535 & ~((1 << req->rcv_wscale) - 1);
+	return window;
+}
+
+/*
+ *	Send the SYN-ACK for a request, the first time or again. This is
+ *	given a copy of the request, the table may change under us.
+ */
+
+static void tcp_synack_send(struct tcp_synreq *req)
+{
+	struct sock *sk = req->sk;
+	struct sk_buff *buff;
+	struct tcphdr *t1;
+	struct device *ndev=NULL;
+	int tmp;
+
+	buff = sk->prot->wmalloc(NULL, MAX_SYN_SIZE, 1, GFP_ATOMIC);
 	if (buff == NULL) 
-	{
-		sk->err = ENOMEM;
-		newsk->dead = 1;
-		newsk->state = TCP_CLOSE;
-		/* And this will destroy it */
-		release_sock(newsk);
-		kfree_skb(skb, FREE_READ);
-		tcp_statistics.TcpAttemptFails++;
-		return;
-	}
-	// skb和sock关联，4个字节是用于tcp mss选项，告诉对端自己的mss
-	buff->len = sizeof(struct tcphdr)+4;
-	buff->sk = newsk;
-	buff->localroute = newsk->localroute;
+		return;		/* The timer or their next SYN will retry */
+
+	buff->len = sizeof(struct tcphdr);
+	buff->sk = NULL;
+	buff->localroute = sk->localroute;
 
 	t1 =(struct tcphdr *) buff->data;
 
 	/*
 	 *	Put in the IP header and routing stuff. 
 	 */
-	// 构造ip和mac头
-	tmp = sk->prot->build_header(buff, newsk->saddr, newsk->daddr, &ndev,
-			       IPPROTO_TCP, NULL, MAX_SYN_SIZE,sk->ip_tos,sk->ip_ttl);
-
-	/*
-	 *	Something went wrong. 
-	 */
 
+	tmp = sk->prot->build_header(buff, req->laddr, req->raddr, &ndev,
+			       IPPROTO_TCP, NULL, MAX_SYN_SIZE, sk->ip_tos, sk->ip_ttl);
 	if (tmp < 0) 
 	{
-		sk->err = tmp;
 		buff->free = 1;
-		kfree_skb(buff,FREE_WRITE);
-		newsk->dead = 1;
-		newsk->state = TCP_CLOSE;
-		release_sock(newsk);
-		skb->sk = sk;
-		kfree_skb(skb, FREE_READ);
-		tcp_statistics.TcpAttemptFails++;
+		sk->prot->wfree(NULL, buff->mem_addr, buff->mem_len);
 		return;
 	}
 
 	buff->len += tmp;
-	// tcp头
 	t1 =(struct tcphdr *)((char *)t1 +tmp);
-  
-	memcpy(t1, skb->h.th, sizeof(*t1));
-	buff->h.seq = newsk->write_seq;
-	/*
-	 *	Swap the send and the receive. 
-	 */
-	t1->dest = skb->h.th->source;
-	t1->source = newsk->dummy_th.source;
-	t1->seq = ntohl(newsk->write_seq++);
-	// 是个ack包，即第二次握手
+	t1->source = req->lport;
+	t1->dest = req->rport;
+	t1->seq = htonl(req->snt_isn);
+	t1->ack_seq = htonl(req->rcv_isn + 1);
+	t1->res1 = 0;
+	t1->res2 = 0;
+	t1->fin = 0;
+	t1->syn = 1;
+	t1->rst = 0;
+	t1->psh = 0;
 	t1->ack = 1;
-	newsk->window = tcp_select_window(newsk);
+	t1->urg = 0;
+	t1->window = htons(req->window);
+	t1->urg_ptr = 0;
+	tmp = tcp_syn_options((unsigned char *)(t1 + 1), req->mtu,
+		req->wscale_ok ? req->rcv_wscale : -1,
+		req->tstamp_ok, req->ts_recent, req->sack_ok);
+	t1->doff = (sizeof(*t1)+tmp)/4;
+	buff->len += tmp;
+
+	tcp_send_check(t1, req->laddr, req->raddr, sizeof(*t1)+tmp, NULL);
+	sk->prot->queue_xmit(NULL, ndev, buff, 1);
+	tcp_statistics.TcpOutSegs++;
+}
+
+/*
+ *	Resend the SYN-ACKs that are due, backing off like the retransmit
+ *	timer, and give up on requests that never got an answer. This runs
+ *	as a timer bottom half, which nothing that changes the table can
+ *	interrupt, so interrupts stay on while we send.
+ */
+
+static void tcp_synq_expire(unsigned long dummy)
+{
+	struct tcp_synreq **reqp, *req;
+	int i;
+
+	for (i = 0; i < TCP_SYNQ_HSIZE; i++)
+	{
+		reqp = &tcp_synq[i];
+		while ((req = *reqp) != NULL)
+		{
+			if ((long)(jiffies - req->expires) < 0)
+			{
+				reqp = &req->next;
+				continue;
+			}
+			if (req->retransmits >= TCP_SYNACK_RETRIES)
+			{
+				tcp_synq_unlink(reqp);
+				tcpext_statistics.TcpExtSynTimeouts++;
+				continue;
+			}
+			req->retransmits++;
+			req->expires = jiffies + (TCP_TIMEOUT_INIT << req->retransmits);
+			tcp_synack_send(req);
+			tcp_statistics.TcpRetransSegs++;
+			reqp = &req->next;
+		}
+	}
+	tcp_synq_timer_on = 0;
+	if (tcp_synq_len)
+	{
+		tcp_synq_timer_on = 1;
+		tcp_synq_timer.expires = TCP_SYNQ_INTERVAL;
+		add_timer(&tcp_synq_timer);
+	}
+}
+
+#ifdef CONFIG_SYN_COOKIES
+
+/*
+ *	SYN cookies. When the table is full we still answer, but pick our
+ *	ISN so that the final ack brings back what we need to know:
+ *
+ *		hash(4-tuple) + their ISN + (minute << 24) +
+ *			((hash(4-tuple, minute) + MSS index) & 0xffffff)
+ *
+ *	where minute is the low 8 bits of a minute count. Options other
+ *	than the MSS cannot be remembered, so these connections go without
+ *	window scaling, timestamps and SACK.
+ */
+
+static unsigned short tcp_cookie_mss[] = { 256, 536, 1024, 1460 };
+
+#define TCP_COOKIE_NMSS	(sizeof(tcp_cookie_mss)/sizeof(tcp_cookie_mss[0]))
+
+static void tcp_cookie_make(struct tcp_synreq *req)
+{
+	unsigned long count = (jiffies / (60*HZ)) & 0xff;
+	int mssind;
+
+	for (mssind = TCP_COOKIE_NMSS - 1; mssind > 0; mssind--)
+		if (tcp_cookie_mss[mssind] <= req->mtu)
+			break;
+	req->mtu = tcp_cookie_mss[mssind];
+	req->wscale_ok = 0;
+	req->snd_wscale = 0;
+	req->rcv_wscale = 0;
+	req->tstamp_ok = 0;
+	req->sack_ok = 0;
+	req->snt_isn = (tcp_synq_hash(req->laddr, req->lport, req->raddr, req->rport, 0, 1) +
+		req->rcv_isn + (count << 24) +
+		((tcp_synq_hash(req->laddr, req->lport, req->raddr, req->rport, count, 2) + mssind)
+			& 0xffffff)) & 0xFFFFFFFFUL;
+}
+
+/*
+ *	See if the ack of a SYN-ACK we did not keep returns a cookie made
+ *	in the last TCP_COOKIE_AGE minutes. req has the addresses and the
+ *	ISNs; if the cookie is good fill in the MSS and return 1.
+ */
+
+static int tcp_cookie_check(struct tcp_synreq *req)
+{
+	unsigned long count = (jiffies / (60*HZ)) & 0xff;
+	unsigned long diff, mssind;
+
+	diff = (req->snt_isn - req->rcv_isn -
+		tcp_synq_hash(req->laddr, req->lport, req->raddr, req->rport, 0, 1)) & 0xFFFFFFFFUL;
+	if (((count - (diff >> 24)) & 0xff) > TCP_COOKIE_AGE)
+		return 0;
+	mssind = (diff - tcp_synq_hash(req->laddr, req->lport, req->raddr, req->rport,
+		diff >> 24, 2)) & 0xffffff;
+	if (mssind >= TCP_COOKIE_NMSS)
+		return 0;
+	req->mtu = tcp_cookie_mss[mssind];
+	return 1;
+}
+
+#endif
+
+/*
+ *	This routine handles a connection request.
+ *	It should make sure we haven't already responded.
+ *	Because of the way BSD works, we have to send a syn/ack now.
+ *	We only note the connection in the SYN table though; the socket
+ *	is made when they ack our SYN.
+ */
+// 收到一个syn包时的处理 
+static void tcp_conn_request(struct sock *sk, struct sk_buff *skb,
+		 unsigned long daddr, unsigned long saddr,
+		 struct options *opt, struct device *dev, unsigned long seq)
+{
+	struct tcp_synreq synack, *req, **reqp;
+	struct tcp_opts opts;
+	struct tcphdr *th;
+	unsigned long flags;
+	
+	th = skb->h.th;
+	// data_ready是唤醒阻塞在accept函数的进程，而这次还没建立起连接，执行回调没有意义
+	/* If the socket is dead, don't accept the connection. */
+	if (!sk->dead) 
+	{
+  		sk->data_ready(sk,0);
+	}
+	else 
+	{	// 该socket已经处于释放状态，发送reset包
+		if(sk->debug)
+			printk("Reset on %p: Connect on dead socket.\n",sk);
+		tcp_reset(daddr, saddr, th, sk->prot, opt, dev, sk->ip_tos,sk->ip_ttl);
+		tcp_statistics.TcpAttemptFails++;
+		kfree_skb(skb, FREE_READ);
+		return;
+	}
+
+	/*
+	 * Make sure we can accept more. There is no point in answering
+	 * if the connection could not be queued for accept() anyway.
+	 */
+	// 如果已连接队列大小大于等于最大值则丢包
+	if (sk->accept_backlog >= sk->max_accept_backlog) 
+	{
+		tcp_statistics.TcpAttemptFails++;
+		tcpext_statistics.TcpExtListenDrops++;
+		kfree_skb(skb, FREE_READ);
+		return;
+	}
+
+	tcp_synq_init_secret();
+
+	/*
+	 *	Work out our answer from the SYN and the route. Swap the
+	 *	addresses, they are from our point of view.
+	 */
+
+	synack.sk = sk;
+	synack.laddr = daddr;
+	synack.raddr = saddr;
+	synack.lport = th->dest;
+	synack.rport = th->source;
+	synack.rcv_isn = th->seq;
+	synack.snt_isn = seq;
+	synack.tos = skb->ip_hdr->tos;
+	synack.retransmits = 0;
+	synack.expires = jiffies + TCP_TIMEOUT_INIT;
+	tcp_synq_route(sk, &synack, dev);
+
+	/*
+	 *	This will min with what arrived in the packet. Scaling is only
+	 *	used if both ends ask for it; so are timestamps, and theirs is
+	 *	the first one we echo.
+	 */
+	// 解析tcp选项
+	tcp_parse_options(th, &opts);
+	synack.mtu = min(synack.mtu, opts.mss ? opts.mss : 536);
+	synack.wscale_ok = opts.wscale_ok;
+	synack.snd_wscale = opts.snd_wscale;
+	synack.rcv_wscale = 0;
+	if (opts.wscale_ok)
+		synack.rcv_wscale = tcp_select_wscale(sk->rcvbuf, synack.window_clamp);
+	synack.tstamp_ok = opts.saw_tstamp;
+	synack.ts_recent = opts.saw_tstamp ? opts.rcv_tsval : 0;
+	synack.sack_ok = opts.sack_ok;
+	synack.window = tcp_synq_window(sk, &synack);
+
+	save_flags(flags);
+	cli();
+	reqp = tcp_synq_find(daddr, th->dest, saddr, th->source);
+	if ((req = *reqp) != NULL && req->sk == sk)
+	{
+		/*
+		 *	A retransmitted SYN, or a new one for the same
+		 *	connection. Answer it with the same ISN.
+		 */
+		synack.snt_isn = req->snt_isn;
+		synack.retransmits = req->retransmits;
+		synack.expires = req->expires;
+		synack.next = req->next;
+		*req = synack;
+	}
+	else if (req != NULL || sk->syn_backlog >= TCP_SYNQ_LISTEN ||
+		 tcp_synq_len >= TCP_SYNQ_MAX ||
+		 (req = (struct tcp_synreq *) kmalloc(sizeof(*req), GFP_ATOMIC)) == NULL)
+	{
+		/*
+		 *	No room. Answer with a cookie if we can, or else
+		 *	ignore the syn. It will get retransmitted.
+		 */
+		restore_flags(flags);
+		tcpext_statistics.TcpExtSynOverflow++;
+#ifdef CONFIG_SYN_COOKIES
+		tcp_cookie_make(&synack);
+		synack.window = tcp_synq_window(sk, &synack);
+		tcp_synack_send(&synack);
+		tcpext_statistics.TcpExtSyncookiesSent++;
+#else
+		tcp_statistics.TcpAttemptFails++;
+#endif
+		kfree_skb(skb, FREE_READ);
+		return;
+	}
+	else
+	{
+		synack.next = NULL;
+		*req = synack;
+		*reqp = req;
+		sk->syn_backlog++;
+		tcp_synq_len++;
+		tcpext_statistics.TcpExtSynRecv++;
+		if (!tcp_synq_timer_on)
+		{
+			tcp_synq_timer_on = 1;
+			tcp_synq_timer.expires = TCP_SYNQ_INTERVAL;
+			add_timer(&tcp_synq_timer);
+		}
+	}
+	restore_flags(flags);
+
+	// 发送ack，即第二次握手
+	tcp_synack_send(&synack);
+	kfree_skb(skb, FREE_READ);
+}
+
+/*
+ *	Build the socket for a connection whose handshake is done. It starts
+ *	in SYN_RECV; tcp_ack() moves it on when it processes the final ack.
+ *	It is returned in use.
+ */
+
+static struct sock *tcp_synq_child(struct sock *sk, struct tcp_synreq *req)
+{
+	struct sock *newsk;
+
+	/*
+	 * We need to build a new sock struct.
+	 * It is sort of bad to have a socket without an inode attached
+	 * to it, but the wake_up's will just wake up the listening socket,
+	 * and if the listening socket is destroyed before this is taken
+	 * off of the queue, this will take care of it.
+	 */
+	// 分配一个新的sock结构用于连接连接
+	newsk = (struct sock *) kmalloc(sizeof(struct sock), GFP_ATOMIC);
+	if (newsk == NULL) 
+		return NULL;
+	// 从listen套接字复制内容，再覆盖某些字段
+	memcpy(newsk, sk, sizeof(*newsk));
+	skb_queue_head_init(&newsk->write_queue);
+	skb_queue_head_init(&newsk->receive_queue);
+	skb_queue_head_init(&newsk->out_of_order_queue);
+	newsk->ofo_mem = 0;
+	newsk->send_head = NULL;
+	newsk->send_tail = NULL;
+	skb_queue_head_init(&newsk->back_log);
+	newsk->rtt = 0;		/*TCP_CONNECT_TIME<<3*/
+	newsk->rto = TCP_TIMEOUT_INIT;
+	newsk->mdev = 0;
+	newsk->max_window = 0;
+	newsk->cong_window = 1;
+	newsk->cong_count = 0;
+	newsk->ssthresh = 0;
+	newsk->backoff = 0;
+	newsk->blog = 0;
+	newsk->intr = 0;
+	newsk->proc = 0;
+	newsk->done = 0;
+	newsk->partial = NULL;
+	newsk->pair = NULL;
+	newsk->wmem_alloc = 0;
+	newsk->rmem_alloc = 0;
+	newsk->localroute = sk->localroute;
+	newsk->ip_cache_rt = NULL;
+
+	newsk->max_unacked = MAX_WINDOW - TCP_WINDOW_DIFF;
+
+	newsk->err = 0;
+	newsk->shutdown = 0;
+	newsk->ack_backlog = 0;
+	newsk->syn_backlog = 0;
+	newsk->accept_backlog = 0;
+	newsk->max_accept_backlog = 0;
+	newsk->accept_head = NULL;
+	newsk->accept_tail = NULL;
+	newsk->accept_next = NULL;
+	// 期待收到的对端下一个字节的序列号
+	newsk->acked_seq = req->rcv_isn+1;
+	// 进程可以读但是还没有读取的字节序列号
+	newsk->copied_seq = req->rcv_isn+1;
+	// 当收到对端fin包的时候，回复的ack包中的序列号	
+	newsk->fin_seq = req->rcv_isn;
+	// 进入syn_recv状态
+	newsk->state = TCP_SYN_RECV;
+	newsk->timeout = 0;
+	newsk->ip_xmit_timeout = 0;
+	// 下一个发送的字节的序列号，syn已经占了一个
+	newsk->write_seq = req->snt_isn+1;
 	newsk->sent_seq = newsk->write_seq;
-	t1->window = ntohs(newsk->window);
+	// 可发送的字节序列号最大值
+	newsk->window_seq = req->snt_isn;
+	// 序列号小于rcv_ack_seq的数据包都已经收到
+	newsk->rcv_ack_seq = req->snt_isn;
+	newsk->high_seq = req->snt_isn;
+	newsk->dup_acks = 0;
+	newsk->in_recovery = 0;
+	newsk->nr_dupacks = 0;
+	newsk->nr_fast_retrans = 0;
+	newsk->nr_timeouts = 0;
+	newsk->urg_data = 0;
+	newsk->retransmits = 0;
+	// 关闭套接字的时候不需要等待一段时间才能关闭
+	newsk->linger=0;
+	newsk->destroy = 0;
+	init_timer(&newsk->timer);
+	newsk->timer.data = (unsigned long)newsk;
+	newsk->timer.function = &net_timer;
+	init_timer(&newsk->retransmit_timer);
+	newsk->retransmit_timer.data = (unsigned long)newsk;
+	newsk->retransmit_timer.function=&retransmit_timer;
+	// 记录端口
+	newsk->dummy_th.source = req->lport;
+	newsk->dummy_th.dest = req->rport;
+	newsk->daddr = req->raddr;
+	newsk->saddr = req->laddr;
+	// 放到tcp的socket哈希队列
+	put_sock(newsk->num,newsk);
+	newsk->dummy_th.res1 = 0;
+	newsk->dummy_th.doff = 6;
+	newsk->dummy_th.fin = 0;
+	newsk->dummy_th.syn = 0;
+	newsk->dummy_th.rst = 0;	
+	newsk->dummy_th.psh = 0;
+	newsk->dummy_th.ack = 0;
+	newsk->dummy_th.urg = 0;
+	newsk->dummy_th.res2 = 0;
+	newsk->socket = NULL;
+
+	/*
+	 *	Grab the ttl and tos values and use them 
+	 */
+
+	newsk->ip_ttl=sk->ip_ttl;
+	newsk->ip_tos=req->tos;
+
+	/*
+	 *	What we agreed on in the SYN and SYN-ACK.
+	 */
+
+	newsk->window_clamp = req->window_clamp;
+	newsk->mtu = req->mtu;
+	newsk->window = req->window;
+	newsk->wscale_ok = req->wscale_ok;
+	newsk->snd_wscale = req->snd_wscale;
+	newsk->rcv_wscale = req->rcv_wscale;
+	newsk->tstamp_ok = req->tstamp_ok;
+	newsk->saw_tstamp = 0;
+	newsk->ts_recent = req->ts_recent;
+	newsk->ts_recent_stamp = jiffies;
+	newsk->sack_ok = req->sack_ok;
+	newsk->mss = min(newsk->max_window, tcp_seg_space(newsk));
+	return newsk;
+}
+
+/*
+ *	A segment with an ack for a listener: the end of a handshake, or
+ *	data after it if the ack got lost. Build the socket from the SYN
+ *	table, or from a SYN cookie, and queue it for accept(). Returns the
+ *	new socket, in use, or NULL if the caller should drop the segment.
+ */
+
+static struct sock *tcp_synq_ack(struct sock *sk, struct sk_buff *skb,
+	unsigned long daddr, unsigned long saddr, struct options *opt,
+	struct device *dev)
+{
+	struct tcphdr *th = skb->h.th;
+	struct tcp_synreq req, **reqp;
+	struct sock *newsk;
+	unsigned long flags;
+	int found;
+
+	save_flags(flags);
+	cli();
+	reqp = tcp_synq_find(daddr, th->dest, saddr, th->source);
+	found = (*reqp != NULL && (*reqp)->sk == sk);
+	if (found)
+		req = **reqp;
+	restore_flags(flags);
+
+	if (found)
+	{
+		/*
+		 *	Our three way handshake failed.
+		 */
+		if (ntohl(th->ack_seq) != req.snt_isn + 1 ||
+		    before(th->seq, req.rcv_isn + 1) ||
+		    after(th->seq, req.rcv_isn + 1 + req.window))
+		{
+			tcp_reset(daddr, saddr, th, sk->prot, opt, dev, sk->ip_tos, sk->ip_ttl);
+			return NULL;
+		}
+	}
+	else
+	{
+#ifdef CONFIG_SYN_COOKIES
+		unsigned short mss;
+
+		req.sk = sk;
+		req.laddr = daddr;
+		req.raddr = saddr;
+		req.lport = th->dest;
+		req.rport = th->source;
+		req.rcv_isn = th->seq - 1;
+		req.snt_isn = ntohl(th->ack_seq) - 1;
+		req.tos = skb->ip_hdr->tos;
+		if (!tcp_cookie_check(&req))
+		{
+			tcpext_statistics.TcpExtSyncookiesFailed++;
+			tcp_reset(daddr, saddr, th, sk->prot, opt, dev, sk->ip_tos, sk->ip_ttl);
+			return NULL;
+		}
+		mss = req.mtu;
+		tcp_synq_route(sk, &req, dev);
+		req.mtu = min(req.mtu, mss);
+		req.wscale_ok = 0;
+		req.snd_wscale = 0;
+		req.rcv_wscale = 0;
+		req.tstamp_ok = 0;
+		req.ts_recent = 0;
+		req.sack_ok = 0;
+		req.window = tcp_synq_window(sk, &req);
+		tcpext_statistics.TcpExtSyncookiesRecv++;
+#else
+		tcp_reset(daddr, saddr, th, sk->prot, opt, dev, sk->ip_tos, sk->ip_ttl);
+		return NULL;
+#endif
+	}
+
+	/*
+	 *	If accept() is behind, drop the ack and let them send it
+	 *	again; the request stays in the table meanwhile.
+	 */
+
+	if (sk->accept_backlog >= sk->max_accept_backlog)
+	{
+		tcp_statistics.TcpAttemptFails++;
+		tcpext_statistics.TcpExtListenOverflows++;
+		return NULL;
+	}
+
+	newsk = tcp_synq_child(sk, &req);
+	if (newsk == NULL) 
+	{
+		tcp_statistics.TcpAttemptFails++;
+		return NULL;
+	}
+
+	save_flags(flags);
+	cli();
+	reqp = tcp_synq_find(daddr, th->dest, saddr, th->source);
+	if (*reqp != NULL && (*reqp)->sk == sk)
+		tcp_synq_unlink(reqp);
+	restore_flags(flags);
+
+	// 挂到已连接队列
+	tcp_accept_enqueue(sk, newsk);
+	return newsk;
+}
+
+/*
+ *	A reset for a listener. If it is for a connection we answered, and in
+ *	the window we offered, forget about it.
+ */
+
+static void tcp_synq_reset(struct sock *sk, struct tcphdr *th,
+	unsigned long daddr, unsigned long saddr)
+{
+	struct tcp_synreq **reqp, *req;
+	unsigned long flags;
+
+	save_flags(flags);
+	cli();
+	reqp = tcp_synq_find(daddr, th->dest, saddr, th->source);
+	if ((req = *reqp) != NULL && req->sk == sk &&
+	    between(th->seq, req->rcv_isn + 1, req->rcv_isn + 1 + req->window))
+		tcp_synq_unlink(reqp);
+	restore_flags(flags);
+}
+
+/*
+ *	TIME_WAIT. Once the user has closed a socket, all that TIME_WAIT
+ *	needs of it is enough to answer late segments, so tcp_time_wait()
+ *	moves that into a struct tcp_tw_bucket and lets the socket go. The
+ *	buckets are hashed by 4-tuple for tcp_rcv() and by local port for
+ *	bind(), and expire from a timer wheel of TCP_TW_SLOTS slots, one
+ *	turned every TCP_TW_TICK, so that they live between
+ *	TCP_TIMEWAIT_LEN and TCP_TIMEWAIT_LEN + TCP_TW_TICK. They are
+ *	changed with interrupts off.
+ */
+
+static struct tcp_tw_bucket *tcp_tw_ehash[SOCK_EHASH_SIZE];
+static struct tcp_tw_bucket *tcp_tw_bhash[SOCK_ARRAY_SIZE];
+static struct tcp_tw_bucket *tcp_tw_wheel[TCP_TW_SLOTS];
+static int tcp_tw_slot = 0;		/* The slot that expires next */
+static int tcp_tw_count = 0;
+static int tcp_tw_timer_on = 0;
+
+static void tcp_tw_expire(unsigned long);
+
+static struct timer_list tcp_tw_timer =
+	{ NULL, NULL, TCP_TW_TICK, 0L, &tcp_tw_expire };
+
+/*
+ *	Put a bucket on the wheel so that it expires in TCP_TIMEWAIT_LEN or
+ *	a little more: the slot we just turned comes round last.
+ */
+
+static void tcp_tw_schedule(struct tcp_tw_bucket *tw)
+{
+	struct tcp_tw_bucket **twp;
+
+	twp = &tcp_tw_wheel[(tcp_tw_slot + TCP_TW_SLOTS - 1) % TCP_TW_SLOTS];
+	if ((tw->wnext = *twp) != NULL)
+		tw->wnext->wpprev = &tw->wnext;
+	*twp = tw;
+	tw->wpprev = twp;
+}
+
+static void tcp_tw_unschedule(struct tcp_tw_bucket *tw)
+{
+	if (tw->wnext != NULL)
+		tw->wnext->wpprev = tw->wpprev;
+	*tw->wpprev = tw->wnext;
+}
+
+/*
+ *	Take a bucket off everything and free it.
+ */
+
+static void tcp_tw_kill(struct tcp_tw_bucket *tw)
+{
+	if (tw->next != NULL)
+		tw->next->pprev = tw->pprev;
+	*tw->pprev = tw->next;
+	if (tw->bnext != NULL)
+		tw->bnext->bpprev = tw->bpprev;
+	*tw->bpprev = tw->bnext;
+	tcp_tw_unschedule(tw);
+	tcp_tw_count--;
+	tcpext_statistics.TcpExtTwBuckets--;
+	kfree_s(tw, sizeof(*tw));
+}
+
+/*
+ *	Find the bucket for a 4-tuple. lnum is in host order as in sk->num.
+ */
+
+static struct tcp_tw_bucket *tcp_tw_find(unsigned long laddr, unsigned short lnum,
+	unsigned long raddr, unsigned short rnum)
+{
+	struct tcp_tw_bucket *tw;
+
+	for (tw = tcp_tw_ehash[sock_ehashfn(laddr, lnum, raddr, rnum)]; tw != NULL; tw = tw->next)
+		if (tw->daddr == raddr && tw->dport == rnum &&
+		    tw->saddr == laddr && tw->num == lnum)
+			break;
+	return tw;
+}
+
+/*
+ *	Expire the buckets in the current slot and turn the wheel. This runs
+ *	as a timer bottom half, so nothing else touches the buckets while it
+ *	works.
+ */
+
+static void tcp_tw_expire(unsigned long dummy)
+{
+	while (tcp_tw_wheel[tcp_tw_slot] != NULL)
+		tcp_tw_kill(tcp_tw_wheel[tcp_tw_slot]);
+	tcp_tw_slot = (tcp_tw_slot + 1) % TCP_TW_SLOTS;
+	tcp_tw_timer_on = 0;
+	if (tcp_tw_count)
+	{
+		tcp_tw_timer_on = 1;
+		tcp_tw_timer.expires = TCP_TW_TICK;
+		add_timer(&tcp_tw_timer);
+	}
+}
+
+/*
+ *	Make a TIME_WAIT bucket for a closed socket. Returns 0 if there was
+ *	no memory; the socket then does its TIME_WAIT itself.
+ */
+
+static int tcp_tw_hold(struct sock *sk)
+{
+	struct tcp_tw_bucket *tw, *old, **twp;
+	unsigned long flags;
+
+	tw = (struct tcp_tw_bucket *) kmalloc(sizeof(*tw), GFP_ATOMIC);
+	if (tw == NULL)
+		return 0;
+	tw->saddr = sk->saddr;
+	tw->daddr = sk->daddr;
+	tw->num = sk->num;
+	tw->sport = sk->dummy_th.source;
+	tw->dport = sk->dummy_th.dest;
+	tw->snd_nxt = sk->sent_seq;
+	tw->rcv_nxt = sk->acked_seq;
+	tw->rcv_wnd = sk->window;
+	tw->ts_recent = sk->ts_recent;
+	tw->ts_recent_stamp = sk->ts_recent_stamp;
+	tw->window = tcp_window_field(sk, sk->window);
+	tw->tstamp_ok = sk->tstamp_ok;
+	tw->reuse = sk->reuse;
+	tw->localroute = sk->localroute;
+	tw->tos = sk->ip_tos;
+	tw->ttl = sk->ip_ttl;
+
+	save_flags(flags);
+	cli();
+	if ((old = tcp_tw_find(tw->saddr, tw->num, tw->daddr, tw->dport)) != NULL)
+		tcp_tw_kill(old);
+	twp = &tcp_tw_ehash[sock_ehashfn(tw->saddr, tw->num, tw->daddr, tw->dport)];
+	if ((tw->next = *twp) != NULL)
+		tw->next->pprev = &tw->next;
+	*twp = tw;
+	tw->pprev = twp;
+	twp = &tcp_tw_bhash[tw->num & (SOCK_ARRAY_SIZE - 1)];
+	if ((tw->bnext = *twp) != NULL)
+		tw->bnext->bpprev = &tw->bnext;
+	*twp = tw;
+	tw->bpprev = twp;
+	tcp_tw_schedule(tw);
+	unhash_sock(sk);
+	tcp_tw_count++;
+	tcpext_statistics.TcpExtTwBuckets++;
+	if (!tcp_tw_timer_on)
+	{
+		tcp_tw_timer_on = 1;
+		tcp_tw_timer.expires = TCP_TW_TICK;
+		add_timer(&tcp_tw_timer);
+	}
+	restore_flags(flags);
+	return 1;
+}
+
+/*
+ *	May a socket bind to port snum on saddr, as far as the connections
+ *	in TIME_WAIT go? The same rules as for sockets in inet_bind().
+ */
+
+int tcp_tw_port_busy(unsigned short snum, unsigned long saddr, int reuse)
+{
+	struct tcp_tw_bucket *tw;
+	unsigned long flags;
+	int busy = 0;
+
+	save_flags(flags);
+	cli();
+	for (tw = tcp_tw_bhash[snum & (SOCK_ARRAY_SIZE - 1)]; tw != NULL; tw = tw->bnext)
+	{
+		if (tw->num != snum)
+			continue;
+		if (!reuse || (tw->saddr == saddr && !tw->reuse))
+		{
+			busy = 1;
+			break;
+		}
+	}
+	restore_flags(flags);
+	return busy;
+}
+
+/*
+ *	Ack a segment for a connection in TIME_WAIT. tw is a copy.
+ */
+
+static void tcp_tw_send_ack(struct tcp_tw_bucket *tw)
+{
+	struct sk_buff *buff;
+	struct tcphdr *t1;
+	struct device *ndev=NULL;
+	unsigned long *ptr;
+	int tmp;
+
+	buff = tcp_prot.wmalloc(NULL, MAX_ACK_SIZE, 1, GFP_ATOMIC);
+	if (buff == NULL) 
+		return;		/* They will send it again */
+
+	buff->len = sizeof(struct tcphdr);
+	buff->sk = NULL;
+	buff->localroute = tw->localroute;
+	t1 =(struct tcphdr *) buff->data;
+
+	tmp = tcp_prot.build_header(buff, tw->saddr, tw->daddr, &ndev,
+			       IPPROTO_TCP, NULL, MAX_ACK_SIZE, tw->tos, tw->ttl);
+	if (tmp < 0) 
+	{
+		buff->free = 1;
+		tcp_prot.wfree(NULL, buff->mem_addr, buff->mem_len);
+		return;
+	}
+	buff->len += tmp;
+	t1 =(struct tcphdr *)((char *)t1 +tmp);
+
+	t1->source = tw->sport;
+	t1->dest = tw->dport;
+	t1->seq = htonl(tw->snd_nxt);
+	t1->ack_seq = htonl(tw->rcv_nxt);
 	t1->res1 = 0;
 	t1->res2 = 0;
+	t1->fin = 0;
+	t1->syn = 0;
 	t1->rst = 0;
-	t1->urg = 0;
 	t1->psh = 0;
-	t1->syn = 1;
-	t1->ack_seq = ntohl(skb->h.th->seq+1);
-	t1->doff = sizeof(*t1)/4+1;
-	ptr =(unsigned char *)(t1+1);
-	ptr[0] = 2;
-	ptr[1] = 4;
-	ptr[2] = ((newsk->mtu) >> 8) & 0xff;
-	ptr[3] =(newsk->mtu) & 0xff;
-
-	tcp_send_check(t1, daddr, saddr, sizeof(*t1)+4, newsk);
-	// 发送ack，即第二次握手
-	newsk->prot->queue_xmit(newsk, ndev, buff, 0);
-	reset_xmit_timer(newsk, TIME_WRITE , TCP_TIMEOUT_INIT);
-	// skb关联的socket为newsk，accept的时候摘取skb时即拿到该socket返回给应用层
-	skb->sk = newsk;
+	t1->ack = 1;
+	t1->urg = 0;
+	t1->window = tw->window;
+	t1->urg_ptr = 0;
+	tmp = 0;
+	if (tw->tstamp_ok)
+	{
+		ptr = (unsigned long *)(t1 + 1);
+		ptr[0] = htonl(TCPOPT_TSTAMP_HDR);
+		ptr[1] = htonl(jiffies);
+		ptr[2] = htonl(tw->ts_recent);
+		tmp = TCPOLEN_TSTAMP_ALIGNED;
+	}
+	t1->doff = (sizeof(*t1) + tmp)/4;
+	buff->len += tmp;
 
-	/*
-	 *	Charge the sock_buff to newsk. 
-	 */
-	// 把skb中数据的大小算在newsk中 
-	sk->rmem_alloc -= skb->mem_len;
-	newsk->rmem_alloc += skb->mem_len;
-	// 
-	skb_queue_tail(&sk->receive_queue,skb);
-	// 连接队列节点个数加1
-	sk->ack_backlog++;
-	release_sock(newsk);
+	tcp_send_check(t1, tw->saddr, tw->daddr, sizeof(*t1) + tmp, NULL);
+	tcp_prot.queue_xmit(NULL, ndev, buff, 1);
 	tcp_statistics.TcpOutSegs++;
 }
 
+/*
+ *	A segment for which there is no socket, or only a listener. If it is
+ *	for a connection in TIME_WAIT, deal with it as RFC 793 says and
+ *	return 1. Returns 0 if the caller should go on with it: there is no
+ *	such connection, or it was a new SYN and the listener is busy.
+ */
+
+static int tcp_tw_rcv(struct sock *sk, struct sk_buff *skb, struct device *dev,
+	struct options *opt, unsigned long daddr, unsigned short len,
+	unsigned long saddr)
+{
+	struct tcphdr *th = skb->h.th;
+	struct tcp_tw_bucket tw, *twp;
+	struct tcp_opts opts;
+	unsigned long flags;
+	int kill = 0, ack = 0, restart = 0;
+
+	save_flags(flags);
+	cli();
+	twp = tcp_tw_find(daddr, ntohs(th->dest), saddr, th->source);
+	if (twp != NULL)
+		tw = *twp;
+	restore_flags(flags);
+	if (twp == NULL)
+		return 0;
+
+	if (th->rst)
+	{
+		/*
+		 *	Time wait assassination protection [RFC1337]. Without
+		 *	it a reset must still be in the window we last had, as
+		 *	tcp_sequence() checks; any other is an old duplicate
+		 *	and is dropped.
+		 */
+#ifndef TCP_DO_RFC1337
+		if (!before(th->seq, tw.rcv_nxt) &&
+		    before(th->seq, tw.rcv_nxt + tw.rcv_wnd + 1))
+			kill = 1;
+#endif
+	}
+	else if (tw.tstamp_ok && (tcp_parse_options(th, &opts), opts.saw_tstamp) &&
+		 before(opts.rcv_tsval, tw.ts_recent) &&
+		 jiffies - tw.ts_recent_stamp < TCP_PAWS_24DAYS)
+	{
+		/* PAWS: an old duplicate */
+		ack = 1;
+	}
+	else if (th->syn)
+	{
+		/*
+		 *	BSD has a funny hack with TIME_WAIT and fast reuse of a
+		 *	port: a new SYN beyond what we have seen opens a new
+		 *	connection to a listener. A SYN in the window kills the
+		 *	connection, an old one just gets an ack.
+		 */
+		if (after(th->seq, tw.rcv_nxt) && !th->ack && sk != NULL &&
+		    ip_chk_addr(daddr) == IS_MYADDR)
+		{
+			save_flags(flags);
+			cli();
+			if ((twp = tcp_tw_find(daddr, tw.num, saddr, th->source)) != NULL)
+				tcp_tw_kill(twp);
+			if (sk->inuse)
+			{
+				restore_flags(flags);
+				return 0;
+			}
+			sk->inuse = 1;
+			restore_flags(flags);
+			tcpext_statistics.TcpExtTwRecycled++;
+			if (sk->rmem_alloc + skb->mem_len >= sk->rcvbuf) 
+			{
+				skb->sk = NULL;
+				kfree_skb(skb, FREE_READ);
+				release_sock(sk);
+				return 1;
+			}
+			skb->len = len;
+			skb->acked = 0;
+			skb->used = 0;
+			skb->free = 0;
+			skb->saddr = daddr;
+			skb->daddr = saddr;
+			skb->sk = sk;
+			sk->rmem_alloc += skb->mem_len;
+			tcp_conn_request(sk, skb, daddr, saddr, opt, dev, tw.snd_nxt+128000);
+			release_sock(sk);
+			return 1;
+		}
+		if (before(th->seq, tw.rcv_nxt))
+			ack = 1;
+		else
+		{
+			tcp_reset(daddr, saddr, th, &tcp_prot, opt, dev, tw.tos, tw.ttl);
+			kill = 1;
+		}
+	}
+	else if (th->fin || len > th->doff*4)
+	{
+		/*
+		 *	A retransmitted FIN means our last ack got lost: send
+		 *	it again and restart the TIME_WAIT timer. Data gets an
+		 *	ack too, as in any state.
+		 */
+		ack = 1;
+		restart = th->fin;
+	}
+
+	if (kill || restart)
+	{
+		save_flags(flags);
+		cli();
+		if ((twp = tcp_tw_find(daddr, tw.num, saddr, th->source)) != NULL)
+		{
+			if (kill)
+				tcp_tw_kill(twp);
+			else
+			{
+				tcp_tw_unschedule(twp);
+				tcp_tw_schedule(twp);
+			}
+		}
+		restore_flags(flags);
+	}
+	if (ack)
+		tcp_tw_send_ack(&tw);
+	skb->sk = NULL;
+	kfree_skb(skb, FREE_READ);
+	return 1;
+}
+
 // 关闭一个socket
 static void tcp_close(struct sock *sk, int timeout)
 {
@@ -3129,6 +4506,7 @@ static void tcp_close(struct sock *sk, int timeout)
 		// 销毁未处理的数据 
 		while((skb=skb_dequeue(&sk->receive_queue))!=NULL)
 			kfree_skb(skb, FREE_READ);
+		tcp_ofo_purge(sk);
 		/*
 		 *	Get rid off any half-completed packets. 
 		 */
@@ -3228,9 +4606,10 @@ static void tcp_write_xmit(struct sock *sk)
 			size = skb->len - (((unsigned char *) th) - skb->data);
 			
 			th->ack_seq = ntohl(sk->acked_seq);
-			th->window = ntohs(tcp_select_window(sk));
+			th->window = tcp_window_field(sk, tcp_select_window(sk));
+			tcp_tstamp_refresh(sk, th);
 
-			tcp_send_check(th, sk->saddr, sk->daddr, size, sk);
+			tcp_send_skb_check(skb, th, sk->saddr, sk->daddr, size);
 
 			sk->sent_seq = skb->h.seq;
 			
@@ -3250,6 +4629,186 @@ static void tcp_write_xmit(struct sock *sk)
 }
 
 
+/*
+ *	The first sequence number of a segment on the retransmit queue.
+ *	Its h.seq holds the last one, so find the header again.
+ */
+
+static inline unsigned long tcp_skb_seq(struct sk_buff *skb)
+{
+	struct iphdr *iph = (struct iphdr *)(skb->data + skb->dev->hard_header_len);
+	struct tcphdr *th = (struct tcphdr *)(((char *)iph) + (iph->ihl << 2));
+
+	return ntohl(th->seq);
+}
+
+/*
+ *	Walk the SACK option (RFC 2018) of an ack, if any, and mark the
+ *	segments on the retransmit queue that the other end holds, so
+ *	that tcp_do_retransmit() only fills the holes. Blocks at or below
+ *	the ack are old news and skipped.
+ */
+
+static void tcp_sacktag(struct sock *sk, struct tcphdr *th, unsigned long ack)
+{
+	unsigned char *ptr = (unsigned char *)(th + 1);
+	int length = th->doff*4 - sizeof(struct tcphdr);
+	struct sk_buff *skb;
+
+	while (length >= 2)
+	{
+		int opcode = ptr[0];
+		int opsize;
+
+		if (opcode == TCPOPT_EOL)
+			return;
+		if (opcode == TCPOPT_NOP)
+		{
+			ptr++;
+			length--;
+			continue;
+		}
+		opsize = ptr[1];
+		if (opsize < 2 || opsize > length)
+			return;
+		if (opcode == TCPOPT_SACK)
+		{
+			unsigned char *blk = ptr + TCPOLEN_SACK_BASE;
+			int n = (opsize - TCPOLEN_SACK_BASE) / TCPOLEN_SACK_PERBLOCK;
+
+			for (; n > 0; n--, blk += TCPOLEN_SACK_PERBLOCK)
+			{
+				unsigned long left = ntohl(*(unsigned long *)blk);
+				unsigned long right = ntohl(*(unsigned long *)(blk + 4));
+
+				if (!after(right, ack) || !before(left, right))
+					continue;
+				for (skb = sk->send_head; skb != NULL; skb = skb->link3)
+				{
+					if (after(skb->h.seq, right))
+						break;
+					if (!skb->sacked && !before(tcp_skb_seq(skb), left))
+						skb->sacked = 1;
+				}
+			}
+		}
+		ptr += opsize;
+		length -= opsize;
+	}
+}
+
+/*
+ *	A duplicate ack arrived. After TCP_FASTRETRANS_THRESH in a row we
+ *	take it that the segment at the head of the retransmit queue was
+ *	lost while later ones got through, resend it at once rather than
+ *	waiting for the timeout, and enter fast recovery (RFC 2581, with
+ *	the NewReno changes of RFC 2582). While recovering each further
+ *	dup ack means another segment has left the network, so the window
+ *	is inflated to let a new one go out.
+ */
+
+static void tcp_dupack(struct sock *sk, unsigned long ack)
+{
+	sk->nr_dupacks++;
+	tcpext_statistics.TcpExtDupAcks++;
+
+	if (sk->in_recovery)
+	{
+		if (sk->cong_window < 2048)
+			sk->cong_window++;
+		return;
+	}
+	if (++sk->dup_acks < TCP_FASTRETRANS_THRESH)
+		return;
+
+	/*
+	 *	These may still be the echoes of a window we have already
+	 *	retransmitted after a timeout.
+	 */
+
+	if (before(ack, sk->high_seq))
+		return;
+
+	sk->nr_fast_retrans++;
+	tcpext_statistics.TcpExtFastRetrans++;
+	sk->ssthresh = sk->cong_window >> 1;
+	if (sk->ssthresh < 2)
+		sk->ssthresh = 2;
+	sk->cong_window = sk->ssthresh + TCP_FASTRETRANS_THRESH;
+	sk->cong_count = 0;
+	sk->high_seq = sk->sent_seq;
+	sk->in_recovery = 1;
+	tcp_do_retransmit(sk, 0);
+	reset_xmit_timer(sk, TIME_WRITE, sk->rto);
+}
+
+/*
+ *	An ack of new data while in fast recovery. If it covers everything
+ *	that was out when recovery started we are done and fall back to
+ *	congestion avoidance. A partial ack means the next hole is lost
+ *	too: resend it now, and deflate the window by what left the
+ *	network. acked is the number of segments taken off the queue.
+ */
+
+static void tcp_recovery_ack(struct sock *sk, unsigned long ack, int acked)
+{
+	if (!before(ack, sk->high_seq))
+	{
+		sk->cong_window = sk->ssthresh;
+		sk->in_recovery = 0;
+		sk->dup_acks = 0;
+		return;
+	}
+
+	tcpext_statistics.TcpExtPartialAcks++;
+	if (sk->cong_window > acked)
+		sk->cong_window -= acked;
+	else
+		sk->cong_window = 0;
+	sk->cong_window++;
+	if (sk->send_head != NULL)
+	{
+		tcp_do_retransmit(sk, 0);
+		reset_xmit_timer(sk, TIME_WRITE, sk->rto);
+	}
+}
+
+/*
+ *	Feed a round trip time measurement m (in jiffies) into the
+ *	estimator and recompute the timeout.
+ */
+
+static void tcp_rtt_estimator(struct sock *sk, long m)
+{
+	/*
+	 *	The following amusing code comes from Jacobson's
+	 *	article in SIGCOMM '88.  Note that rtt and mdev
+	 *	are scaled versions of rtt and mean deviation.
+	 *	This is designed to be as fast as possible 
+	 *	m stands for "measurement".
+	 */
+
+	if(m<=0)
+		m=1;		/* IS THIS RIGHT FOR <0 ??? */
+	m -= (sk->rtt >> 3);    /* m is now error in rtt est */
+	sk->rtt += m;           /* rtt = 7/8 rtt + 1/8 new */
+	if (m < 0)
+		m = -m;		/* m is now abs(error) */
+	m -= (sk->mdev >> 2);   /* similar update on mdev */
+	sk->mdev += m;	    	/* mdev = 3/4 mdev + 1/4 new */
+
+	/*
+	 *	Now update timeout.  Note that this removes any backoff.
+	 */
+ 
+	sk->rto = ((sk->rtt >> 2) + sk->mdev) >> 1;
+	if (sk->rto > 120*HZ)
+		sk->rto = 120*HZ;
+	if (sk->rto < 20)	/* Was 1*HZ - keep .2 as minimum cos of the BSD delayed acks */
+		sk->rto = 20;
+	sk->backoff = 0;
+}
+
 /*
  *	This routine deals with incoming acks, but not outgoing ones.
  */
@@ -3257,7 +4816,12 @@ static void tcp_write_xmit(struct sock *sk)
 extern __inline__ int tcp_ack(struct sock *sk, struct tcphdr *th, unsigned long saddr, int len)
 {
 	unsigned long ack;
+	unsigned long window;
 	int flag = 0;
+	int rtt_sampled = 0;
+	int dupack = 0;
+	int newack;
+	int acked = 0;
 
 	/* 
 	 * 1 - there was data in packet as well as ack or new data is sent or 
@@ -3274,17 +4838,18 @@ extern __inline__ int tcp_ack(struct sock *sk, struct tcphdr *th, unsigned long
 	 */
 	 
 	ack = ntohl(th->ack_seq);
+	window = tcp_peer_window(sk, th);
 	// 对端的接收窗口大小比之前的大，则更新最大报文的大小
-	if (ntohs(th->window) > sk->max_window) 
+	if (window > sk->max_window) 
 	{
-  		sk->max_window = ntohs(th->window);
+  		sk->max_window = window;
 #ifdef CONFIG_INET_PCTCP
 		/* Hack because we don't send partial packets to non SWS
 		   handling hosts */
-		sk->mss = min(sk->max_window>>1, sk->mtu);
+		sk->mss = min(sk->max_window>>1, tcp_seg_space(sk));
 #else
 		// 更新mss，取最大报文大小和mtu的最小值
-		sk->mss = min(sk->max_window, sk->mtu);
+		sk->mss = min(sk->max_window, tcp_seg_space(sk));
 #endif	
 	}
 
@@ -3335,11 +4900,23 @@ extern __inline__ int tcp_ack(struct sock *sk, struct tcphdr *th, unsigned long
 	if (len != th->doff*4) 
 		flag |= 1;
 
+	/*
+	 *	A duplicate ack acks nothing new, carries no data, leaves
+	 *	the window alone, and comes while we have data out.
+	 */
+
+	newack = after(ack, sk->rcv_ack_seq);
+	if (!newack && !(flag & 1) && sk->send_head != NULL &&
+	    ack + window == sk->window_seq && !th->syn && !th->fin)
+		dupack = 1;
+	else if (newack && !sk->in_recovery)
+		sk->dup_acks = 0;
+
 	/*
 	 *	See if our window has been shrunk. 
 	 */
 	// 当前能发送的最大序列号，已经收到的最大序列号+还能接收的大小
-	if (after(sk->window_seq, ack+ntohs(th->window))) 
+	if (after(sk->window_seq, ack+window)) 
 	{
 		/*
 		 * We may need to move packets from the send queue
@@ -3363,7 +4940,7 @@ extern __inline__ int tcp_ack(struct sock *sk, struct tcphdr *th, unsigned long
 	
 		flag |= 4;	/* Window changed */
 		// 更新可以发送的序列号最大值
-		sk->window_seq = ack + ntohs(th->window);
+		sk->window_seq = ack + window;
 		cli();
 		while (skb2 != NULL) 
 		{
@@ -3419,17 +4996,27 @@ extern __inline__ int tcp_ack(struct sock *sk, struct tcphdr *th, unsigned long
 		sk->packets_out= 0;
 	}
 
+	/*
+	 *	Update the scoreboard from any SACK blocks.
+	 */
+
+	if (sk->sack_ok && th->doff > sizeof(struct tcphdr)/4)
+		tcp_sacktag(sk, th, ack);
+
+	if (dupack)
+		tcp_dupack(sk, ack);
+
 	/*
 	 *	Update the right hand window edge of the host
 	 */
 	 
-	sk->window_seq = ack + ntohs(th->window);
+	sk->window_seq = ack + window;
 
 	/*
 	 *	We don't want too many packets out there. 
 	 */
 	 
-	if (sk->ip_xmit_timeout == TIME_WRITE && 
+	if (sk->ip_xmit_timeout == TIME_WRITE && !sk->in_recovery &&
 		sk->cong_window < 2048 && after(ack, sk->rcv_ack_seq)) 
 	{
 		/* 
@@ -3565,39 +5152,20 @@ extern __inline__ int tcp_ack(struct sock *sk, struct tcphdr *th, unsigned long
 				sk->write_space(sk);
 			oskb = sk->send_head;
 
-			if (!(flag&2)) 	/* Not retransmitting */
+			if (sk->saw_tstamp && sk->rcv_tsecr)
 			{
-				long m;
-	
-				/*
-				 *	The following amusing code comes from Jacobson's
-				 *	article in SIGCOMM '88.  Note that rtt and mdev
-				 *	are scaled versions of rtt and mean deviation.
-				 *	This is designed to be as fast as possible 
-				 *	m stands for "measurement".
-				 */
-	
-				m = jiffies - oskb->when;  /* RTT */
-				if(m<=0)
-					m=1;		/* IS THIS RIGHT FOR <0 ??? */
-				m -= (sk->rtt >> 3);    /* m is now error in rtt est */
-				sk->rtt += m;           /* rtt = 7/8 rtt + 1/8 new */
-				if (m < 0)
-					m = -m;		/* m is now abs(error) */
-				m -= (sk->mdev >> 2);   /* similar update on mdev */
-				sk->mdev += m;	    	/* mdev = 3/4 mdev + 1/4 new */
-	
 				/*
-				 *	Now update timeout.  Note that this removes any backoff.
+				 *	The echoed timestamp tells us exactly which
+				 *	transmission this ack is for, so Karn's rule
+				 *	is not needed (RFC 1323 RTTM). One sample
+				 *	per ack.
 				 */
-			 
-				sk->rto = ((sk->rtt >> 2) + sk->mdev) >> 1;
-				if (sk->rto > 120*HZ)
-					sk->rto = 120*HZ;
-				if (sk->rto < 20)	/* Was 1*HZ - keep .2 as minimum cos of the BSD delayed acks */
-					sk->rto = 20;
-				sk->backoff = 0;
+				if (!rtt_sampled)
+					tcp_rtt_estimator(sk, jiffies - sk->rcv_tsecr);
+				rtt_sampled = 1;
 			}
+			else if (!(flag&2) && !sk->in_recovery) 	/* Not retransmitting */
+				tcp_rtt_estimator(sk, jiffies - oskb->when);
 			flag |= (2|4);	/* 2 is really more like 'don't adjust the rtt 
 			                   In this case as we just set it up */
 			cli();
@@ -3617,6 +5185,7 @@ extern __inline__ int tcp_ack(struct sock *sk, struct tcphdr *th, unsigned long
 				skb_unlink(oskb);
 			sti();
 			kfree_skb(oskb, FREE_WRITE); /* write. */
+			acked++;
 			if (!sk->dead) 
 				sk->write_space(sk);
 		}
@@ -3626,6 +5195,9 @@ extern __inline__ int tcp_ack(struct sock *sk, struct tcphdr *th, unsigned long
 		}
 	}
 
+	if (newack && sk->in_recovery)
+		tcp_recovery_ack(sk, ack, acked);
+
 	/*
 	 * XXX someone ought to look at this too.. at the moment, if skb_peek()
 	 * returns non-NULL, we complete ignore the timer stuff in the else
@@ -3702,8 +5274,7 @@ extern __inline__ int tcp_ack(struct sock *sk, struct tcphdr *th, unsigned long
 			} else if (sk->keepopen) {
 				reset_xmit_timer(sk, TIME_KEEPOPEN, TCP_TIMEOUT_LEN);
 			} else {
-				del_timer(&sk->retransmit_timer);
-				sk->ip_xmit_timeout = 0;
+				tcp_clear_xmit_timer(sk);
 			}
 			break;
 		}
@@ -3714,7 +5285,7 @@ extern __inline__ int tcp_ack(struct sock *sk, struct tcphdr *th, unsigned long
 	 *	packets immediately (end of Nagle rule application).
 	 */
 	 
-	if (sk->packets_out == 0 && sk->partial != NULL &&
+	if (sk->packets_out == 0 && sk->partial != NULL && !sk->cork &&
 		skb_peek(&sk->write_queue) == NULL && sk->send_head == NULL) 
 	{
 		flag |= 1;
@@ -3799,7 +5370,7 @@ extern __inline__ int tcp_ack(struct sock *sk, struct tcphdr *th, unsigned long
 		if(sk->max_window==0)
 		{
 			sk->max_window=32;	/* Sanity check */
-			sk->mss=min(sk->max_window,sk->mtu);
+			sk->mss=min(sk->max_window,tcp_seg_space(sk));
 		}
 	}
 	
@@ -3924,9 +5495,7 @@ static int tcp_fin(struct sk_buff *skb, struct sock *sk, struct tcphdr *th)
 			/*
 			 * received a FIN -- send ACK and enter TIME_WAIT
 			 */
-			reset_msl_timer(sk, TIME_CLOSE, TCP_TIMEWAIT_LEN);
-			sk->shutdown|=SHUTDOWN_MASK;
-			tcp_set_state(sk,TCP_TIME_WAIT);
+			tcp_time_wait(sk);
 			break;
 		case TCP_CLOSE:
 			/*
@@ -3946,6 +5515,130 @@ static int tcp_fin(struct sk_buff *skb, struct sock *sk, struct tcphdr *th)
 
 
 
+/*
+ *	Out of order segments wait on their own queue, sorted by sequence
+ *	number, until the hole in front of them is filled, so that
+ *	receive_queue only ever holds data in order. As on receive_queue
+ *	their ack_seq holds their right edge. ofo_mem is what they cost.
+ */
+
+static inline void tcp_ofo_unlink(struct sock *sk, struct sk_buff *skb)
+{
+	skb_unlink(skb);
+	sk->ofo_mem -= skb->mem_len;
+	tcpext_statistics.TcpExtOfoMem -= skb->mem_len;
+}
+
+static void tcp_ofo_queue(struct sock *sk, struct sk_buff *skb)
+{
+	struct sk_buff_head *list = &sk->out_of_order_queue;
+	struct tcphdr *th = skb->h.th;
+	struct sk_buff *skb1, *next;
+
+	/*
+	 *	Find the last segment that starts at or before this one.
+	 *	Segments mostly arrive in order behind the hole, so start
+	 *	at the tail.
+	 */
+
+	for (skb1 = list->prev; skb1 != (struct sk_buff *)list; skb1 = skb1->prev)
+		if (!after(skb1->h.th->seq, th->seq))
+			break;
+
+	if (skb1 != (struct sk_buff *)list)
+	{
+		if (!after(th->ack_seq, skb1->h.th->ack_seq))
+		{
+			/* Nothing new in it */
+			kfree_skb(skb, FREE_READ);
+			return;
+		}
+		if (skb1->h.th->seq == th->seq)
+		{
+			/* A longer copy of one we have */
+			next = skb1->prev;
+			tcp_ofo_unlink(sk, skb1);
+			kfree_skb(skb1, FREE_READ);
+			skb1 = next;
+		}
+	}
+	if (skb1 == (struct sk_buff *)list)
+		skb_queue_head(list, skb);
+	else
+		skb_append(skb1, skb);
+	sk->ofo_mem += skb->mem_len;
+	tcpext_statistics.TcpExtOfoMem += skb->mem_len;
+	tcpext_statistics.TcpExtOfoQueued++;
+
+	/*
+	 *	Drop the ones after it that it covers.
+	 */
+
+	while ((next = skb->next) != (struct sk_buff *)list &&
+	       !after(next->h.th->ack_seq, th->ack_seq))
+	{
+		tcp_ofo_unlink(sk, next);
+		kfree_skb(next, FREE_READ);
+	}
+
+	/* Reported first in our SACK blocks */
+	sk->sack_last = th->seq;
+}
+
+/*
+ *	This is important.  If we don't have much room left, we need to
+ *	throw out a few packets so we have a good window.  Note that mtu
+ *	is used, not mss, because mss is really for the send side.  He
+ *	could be sending us stuff as large as mtu.
+ *	Only reordered data goes, from the far end of the queue first as
+ *	it is the least use to us. If we SACKed it the sender finds out
+ *	on its next timeout (RFC 2018 allows us to renege).
+ */
+
+static void tcp_ofo_prune(struct sock *sk)
+{
+	struct sk_buff *skb;
+
+	while (sk->prot->rspace(sk) < sk->mtu &&
+	       (skb = sk->out_of_order_queue.prev) != (struct sk_buff *)&sk->out_of_order_queue)
+	{
+		tcp_ofo_unlink(sk, skb);
+		kfree_skb(skb, FREE_READ);
+		tcpext_statistics.TcpExtOfoPruned++;
+	}
+}
+
+/*
+ *	Throw away all the reordered data, when the socket goes.
+ */
+
+void tcp_ofo_purge(struct sock *sk)
+{
+	struct sk_buff *skb;
+
+	while ((skb = skb_peek(&sk->out_of_order_queue)) != NULL)
+	{
+		tcp_ofo_unlink(sk, skb);
+		kfree_skb(skb, FREE_READ);
+	}
+}
+
+/*
+ *	Data up to end is in order on receive_queue now: move the ack
+ *	point and take what it used out of the window we offered.
+ */
+
+static inline void tcp_rcv_advance(struct sock *sk, unsigned long end)
+{
+	int newwindow;
+
+	newwindow = sk->window - (end - sk->acked_seq);
+	if (newwindow < 0)
+		newwindow = 0;	
+	sk->window = newwindow;
+	sk->acked_seq = end;
+}
+
 /*
  *	This routine handles the data.  If there is room in the buffer,
  *	it will be have already been moved into it.  If there is no
@@ -3955,9 +5648,8 @@ static int tcp_fin(struct sk_buff *skb, struct sock *sk, struct tcphdr *th)
 extern __inline__ int tcp_data(struct sk_buff *skb, struct sock *sk, 
 	 unsigned long saddr, unsigned short len)
 {
-	struct sk_buff *skb1, *skb2;
+	struct sk_buff *skb2;
 	struct tcphdr *th;
-	int dup_dumped=0;
 	unsigned long new_seq;
 	unsigned long shut_seq;
 
@@ -4040,75 +5732,6 @@ extern __inline__ int tcp_data(struct sk_buff *skb, struct sock *sk,
 
 #endif
 
-	/*
-	 * 	Now we have to walk the chain, and figure out where this one
-	 * 	goes into it.  This is set up so that the last packet we received
-	 * 	will be the first one we look at, that way if everything comes
-	 * 	in order, there will be no performance loss, and if they come
-	 * 	out of order we will be able to fit things in nicely.
-	 *
-	 *	[AC: This is wrong. We should assume in order first and then walk
-	 *	 forwards from the first hole based upon real traffic patterns.]
-	 *	
-	 */
-	// 接收队列是空则直接赋值成为第一个节点，否则插入接收队列的相应位置
-	if (skb_peek(&sk->receive_queue) == NULL) 	/* Empty queue is easy case */
-	{
-		skb_queue_head(&sk->receive_queue,skb);
-		skb1= NULL;
-	} 
-	else
-	{
-		for(skb1=sk->receive_queue.prev; ; skb1 = skb1->prev) 
-		{
-			if(sk->debug)
-			{
-				printk("skb1=%p :", skb1);
-				printk("skb1->h.th->seq = %ld: ", skb1->h.th->seq);
-				printk("skb->h.th->seq = %ld\n",skb->h.th->seq);
-				printk("copied_seq = %ld acked_seq = %ld\n", sk->copied_seq,
-						sk->acked_seq);
-			}
-			
-			/*
-			 *	Optimisation: Duplicate frame or extension of previous frame from
-			 *	same sequence point (lost ack case).
-			 *	The frame contains duplicate data or replaces a previous frame
-			 *	discard the previous frame (safe as sk->inuse is set) and put
-			 *	the new one in its place.
-			 */
-			// 和某个节点的序列号一样但是数据比他多，则删除旧的skb，插入新的skb
-			if (th->seq==skb1->h.th->seq && skb->len>= skb1->len)
-			{	
-				skb_append(skb1,skb);
-				skb_unlink(skb1);
-				kfree_skb(skb1,FREE_READ);
-				dup_dumped=1;
-				skb1=NULL;
-				break;
-			}
-			
-			/*
-			 *	Found where it fits
-			 */
-			 
-			if (after(th->seq+1, skb1->h.th->seq))
-			{
-				skb_append(skb1,skb);
-				break;
-			}
-			
-			/*
-			 *	See if we've hit the start. If so insert.
-			 */
-			if (skb1 == skb_peek(&sk->receive_queue))
-			{
-				skb_queue_head(&sk->receive_queue, skb);
-				break;
-			}
-		}
-  	}
-
 	/*
 	 *	Figure out what the ack value for this frame is
 	 */
@@ -4127,137 +5750,97 @@ extern __inline__ int tcp_data(struct sk_buff *skb, struct sock *sk,
 	}
 
 	/*
-	 *	Now figure out if we can ack anything. This is very messy because we really want two
-	 *	receive queues, a completed and an assembly queue. We also want only one transmit
-	 *	queue.
+	 *	If we've missed a packet, park this one until the hole is
+	 *	filled, send an ack at once so the other end knows, and
+	 *	start a timer to send another. Queueing or pruning may free
+	 *	the skb, and the ack has to follow them to carry the new SACK
+	 *	block, so it is built from a copy of the header.
 	 */
 
-	if ((!dup_dumped && (skb1 == NULL || skb1->acked)) || before(th->seq, sk->acked_seq+1)) 
+	if (after(th->seq, sk->acked_seq))
 	{
-		if (before(th->seq, sk->acked_seq+1)) 
-		{
-			int newwindow;
+		struct tcphdr ack_th = *th;
 
-			if (after(th->ack_seq, sk->acked_seq)) 
-			{
-				newwindow = sk->window-(th->ack_seq - sk->acked_seq);
-				if (newwindow < 0)
-					newwindow = 0;	
-				sk->window = newwindow;
-				sk->acked_seq = th->ack_seq;
-			}
-			skb->acked = 1;
-
-			/*
-			 *	When we ack the fin, we do the FIN 
-			 *	processing.
-			 */
-			// 收到的是fin包
-			if (skb->h.th->fin) 
-			{
-				tcp_fin(skb,sk,skb->h.th);
-			}
-	  
-			for(skb2 = skb->next;
-			    skb2 != (struct sk_buff *)&sk->receive_queue;
-			    skb2 = skb2->next) 
-			{
-				if (before(skb2->h.th->seq, sk->acked_seq+1)) 
-				{
-					if (after(skb2->h.th->ack_seq, sk->acked_seq))
-					{
-						newwindow = sk->window -
-						 (skb2->h.th->ack_seq - sk->acked_seq);
-						if (newwindow < 0)
-							newwindow = 0;	
-						sk->window = newwindow;
-						sk->acked_seq = skb2->h.th->ack_seq;
-					}
-					skb2->acked = 1;
-					/*
-					 * 	When we ack the fin, we do
-					 * 	the fin handling.
-					 */
-					if (skb2->h.th->fin) 
-					{
-						tcp_fin(skb,sk,skb->h.th);
-					}
+		tcp_ofo_queue(sk, skb);
+		tcp_ofo_prune(sk);
+		tcp_send_ack(sk->sent_seq, sk->acked_seq, sk, &ack_th, saddr);
+		sk->ack_backlog++;
+		reset_xmit_timer(sk, TIME_WRITE, TCP_ACK_TIME);
+		return(0);
+	}
 
-					/*
-					 *	Force an immediate ack.
-					 */
-					 
-					sk->ack_backlog = sk->max_ack_backlog;
-				}
-				else
-				{
-					break;
-				}
-			}
+	/*
+	 *	Nothing we have not got already. Ack it again so the other end
+	 *	stops sending it.
+	 */
 
-			/*
-			 *	This also takes care of updating the window.
-			 *	This if statement needs to be simplified.
-			 */
-			if (!sk->delay_acks ||
-			    sk->ack_backlog >= sk->max_ack_backlog || 
-			    sk->bytes_rcv > sk->max_unacked || th->fin) {
-	/*			tcp_send_ack(sk->sent_seq, sk->acked_seq,sk,th, saddr); */
-			}
-			else 
-			{
-				sk->ack_backlog++;
-				if(sk->debug)
-					printk("Ack queued.\n");
-				reset_xmit_timer(sk, TIME_WRITE, TCP_ACK_TIME);
-			}
-		}
+	if (!after(th->ack_seq, sk->acked_seq))
+	{
+		tcp_send_ack(sk->sent_seq, sk->acked_seq, sk, th, saddr);
+		kfree_skb(skb, FREE_READ);
+		return(0);
 	}
 
 	/*
-	 *	If we've missed a packet, send an ack.
-	 *	Also start a timer to send another.
+	 *	In order. It may overlap what we have, tcp_read() skips
+	 *	the part it has seen.
 	 */
-	 
-	if (!skb->acked) 
-	{
-	
+
+	skb_queue_tail(&sk->receive_queue, skb);
+	tcp_rcv_advance(sk, th->ack_seq);
+	skb->acked = 1;
+
 	/*
-	 *	This is important.  If we don't have much room left,
-	 *	we need to throw out a few packets so we have a good
-	 *	window.  Note that mtu is used, not mss, because mss is really
-	 *	for the send side.  He could be sending us stuff as large as mtu.
+	 *	When we ack the fin, we do the FIN 
+	 *	processing.
 	 */
-		 
-		while (sk->prot->rspace(sk) < sk->mtu) 
+	// 收到的是fin包
+	if (th->fin) 
+		tcp_fin(skb, sk, th);
+
+	/*
+	 *	If this filled a hole, what waited behind it is in order now.
+	 */
+
+	while ((skb2 = skb_peek(&sk->out_of_order_queue)) != NULL &&
+	       !after(skb2->h.th->seq, sk->acked_seq))
+	{
+		tcp_ofo_unlink(sk, skb2);
+		if (!after(skb2->h.th->ack_seq, sk->acked_seq))
 		{
-			skb1 = skb_peek(&sk->receive_queue);
-			if (skb1 == NULL) 
-			{
-				printk("INET: tcp.c:tcp_data memory leak detected.\n");
-				break;
-			}
+			kfree_skb(skb2, FREE_READ);
+			continue;
+		}
+		skb_queue_tail(&sk->receive_queue, skb2);
+		tcp_rcv_advance(sk, skb2->h.th->ack_seq);
+		skb2->acked = 1;
+		if (skb2->h.th->fin) 
+			tcp_fin(skb2, sk, skb2->h.th);
 
-			/*
-			 *	Don't throw out something that has been acked. 
-			 */
+		/*
+		 *	Force an immediate ack.
+		 */
 		 
-			if (skb1->acked) 
-			{
-				break;
-			}
-		
-			skb_unlink(skb1);
-			kfree_skb(skb1, FREE_READ);
-		}
-		tcp_send_ack(sk->sent_seq, sk->acked_seq, sk, th, saddr);
-		sk->ack_backlog++;
-		reset_xmit_timer(sk, TIME_WRITE, TCP_ACK_TIME);
+		sk->ack_backlog = sk->max_ack_backlog;
 	}
-	else
+
+	/*
+	 *	This also takes care of updating the window.
+	 *	This if statement needs to be simplified.
+	 */
+	if (!sk->delay_acks ||
+	    sk->ack_backlog >= sk->max_ack_backlog || 
+	    sk->bytes_rcv > sk->max_unacked || th->fin) {
+/*		tcp_send_ack(sk->sent_seq, sk->acked_seq,sk,th, saddr); */
+	}
+	else 
 	{
-		tcp_send_ack(sk->sent_seq, sk->acked_seq, sk, th, saddr);
+		sk->ack_backlog++;
+		if(sk->debug)
+			printk("Ack queued.\n");
+		reset_xmit_timer(sk, TIME_WRITE, TCP_ACK_TIME);
 	}
+	tcp_send_ack(sk->sent_seq, sk->acked_seq, sk, th, saddr);
 
 	/*
 	 *	Now tell the user we may have some data. 
@@ -4366,7 +5949,6 @@ extern __inline__ int tcp_urg(struct sock *sk, struct tcphdr *th,
 static struct sock *tcp_accept(struct sock *sk, int flags)
 {
 	struct sock *newsk;
-	struct sk_buff *skb;
   
   /*
    * We need to make sure that this socket is listening,
@@ -4383,7 +5965,7 @@ static struct sock *tcp_accept(struct sock *sk, int flags)
 	cli();
 	sk->inuse = 1;
 	// 从sock的receive_queue队列摘取已建立连接的节点，
-	while((skb = tcp_dequeue_established(sk)) == NULL) 
+	while((newsk = tcp_dequeue_established(sk)) == NULL) 
 	{	
 		// 没有已经建立连接的节点，但是设置了非阻塞模式，直接返回
 		if (flags & O_NONBLOCK) 
@@ -4406,16 +5988,6 @@ static struct sock *tcp_accept(struct sock *sk, int flags)
 		sk->inuse = 1;
   	}
 	sti();
-
-	/*
-	 *	Now all we need to do is return skb->sk. 
-	 */
-	// 拿到一个新的sock结构，由建立连接的时候创建的
-	newsk = skb->sk;
-
-	kfree_skb(skb, FREE_READ);
-	// 队列节点数减一
-	sk->ack_backlog--;
 	release_sock(sk);
 	// 返回新的sock结构体
 	return(newsk);
@@ -4468,9 +6040,13 @@ static int tcp_connect(struct sock *sk, struct sockaddr_in *usin, int addr_len)
 	sk->write_seq = tcp_init_seq();
 	sk->window_seq = sk->write_seq;
 	sk->rcv_ack_seq = sk->write_seq -1;
+	sk->high_seq = sk->write_seq;
+	sk->dup_acks = 0;
+	sk->in_recovery = 0;
 	sk->err = 0;
 	// 远端端口
 	sk->dummy_th.dest = usin->sin_port;
+	rehash_sock(sk);
 	release_sock(sk);
 	// 分配一个skb
 	buff = sk->prot->wmalloc(sk,MAX_SYN_SIZE,0, GFP_KERNEL);
@@ -4479,8 +6055,8 @@ static int tcp_connect(struct sock *sk, struct sockaddr_in *usin, int addr_len)
 		return(-ENOMEM);
 	}
 	sk->inuse = 1;
-	// tcp头和选项，告诉对方自己的接收窗口大小1
-	buff->len = 24;
+	// tcp头，选项的长度在下面填选项时加上
+	buff->len = sizeof(struct tcphdr);
 	buff->sk = sk;
 	buff->free = 0;
 	buff->localroute = sk->localroute;
@@ -4526,8 +6102,6 @@ static int tcp_connect(struct sock *sk, struct sockaddr_in *usin, int addr_len)
 	// 是一个syn包
 	t1->syn = 1;
 	t1->urg_ptr = 0;
-	// TCP头包括24个字节，因为还有4个字节的选项
-	t1->doff = 6;
 	/* use 512 or whatever user asked for */
 	
 	if(rt!=NULL && (rt->rt_flags&RTF_WINDOW))
@@ -4560,20 +6134,23 @@ static int tcp_connect(struct sock *sk, struct sockaddr_in *usin, int addr_len)
 	sk->mtu = min(sk->mtu, dev->mtu - HEADER_SIZE);
 	
 	/*
-	 *	Put in the TCP options to say MTU. 
+	 *	Put in the TCP options to say MTU and window scale, and offer
+	 *	timestamps and SACK. We always offer scaling, even with a shift
+	 *	of 0, so that the other end may scale the windows it sends us.
 	 */
 	// 执行tcp头后面的第一个字节
 	ptr = (unsigned char *)(t1+1);
-	// 选项的类型是2，通知对方TCP报文中数据部分的最大值
-	ptr[0] = 2;
-	// 选项内容长度是4个字节
-	ptr[1] = 4;
-	// 组成MSS
-	ptr[2] = (sk->mtu) >> 8;
-	ptr[3] = (sk->mtu) & 0xff;
+	sk->snd_wscale = 0;
+	sk->rcv_wscale = tcp_select_wscale(sk->rcvbuf, sk->window_clamp);
+	sk->tstamp_ok = 0;
+	sk->ts_recent = 0;
+	sk->sack_ok = 0;
+	tmp = tcp_syn_options(ptr, sk->mtu, sk->rcv_wscale, 1, sk->ts_recent, 1);
+	t1->doff = (sizeof(struct tcphdr) + tmp)/4;
+	buff->len += tmp;
 	// tcp头的校验和
 	tcp_send_check(t1, sk->saddr, sk->daddr,
-		  sizeof(struct tcphdr) + 4, sk);
+		  sizeof(struct tcphdr) + tmp, sk);
 
 	/*
 	 *	This must go first otherwise a really quick response will get reset. 
@@ -4627,6 +6204,16 @@ extern __inline__ int tcp_sequence(struct sock *sk, struct tcphdr *th, short len
 	 * problems unless someone is trying to forge packets.
 	 */
 
+	/*
+	 *	PAWS (RFC 1323): a timestamp older than the last one we took
+	 *	means an old duplicate, whatever its sequence number says. A
+	 *	ts_recent that has sat idle for 24 days is too old to judge by.
+	 */
+	 
+	if (sk->saw_tstamp && !th->rst && before(sk->rcv_tsval, sk->ts_recent) &&
+	    jiffies - sk->ts_recent_stamp < TCP_PAWS_24DAYS)
+		goto ignore_it;
+
 	/* have we already seen all of this packet? */
 	// 
 	if (!after(next_seq+1, sk->acked_seq))
@@ -4636,6 +6223,20 @@ extern __inline__ int tcp_sequence(struct sock *sk, struct tcphdr *th, short len
 	if (!before(th->seq, sk->acked_seq + sk->window + 1))
 		goto ignore_it;
 
+	/*
+	 *	Take the timestamp to echo from a segment that starts at or
+	 *	before the edge we have acked, so that after loss we echo
+	 *	the one that filled the hole and our peer's RTT includes
+	 *	the delay.
+	 */
+	 
+	if (sk->saw_tstamp && !before(sk->rcv_tsval, sk->ts_recent) &&
+	    !after(th->seq, sk->acked_seq))
+	{
+		sk->ts_recent = sk->rcv_tsval;
+		sk->ts_recent_stamp = jiffies;
+	}
+
 	/* ok, at least part of this packet would seem interesting.. */
 	return 1;
 
@@ -4759,6 +6360,11 @@ int tcp_rcv(struct sk_buff *skb, struct device *dev, struct options *opt,
 		}
 		th->seq = ntohl(th->seq);
 
+		/* A connection in TIME_WAIT has only a bucket left */
+		if ((sk == NULL || sk->state == TCP_LISTEN) &&
+		    tcp_tw_rcv(sk, skb, dev, opt, daddr, len, saddr))
+			return(0);
+
 		/* See if we know about the socket. */
 		// 找不到sock说明这个数据包无效，发送重置包
 		if (sk == NULL) 
@@ -4796,6 +6402,9 @@ int tcp_rcv(struct sk_buff *skb, struct device *dev, struct options *opt,
 	}
 	else
 	{
+		if ((sk == NULL || sk->state == TCP_LISTEN) &&
+		    tcp_tw_rcv(sk, skb, dev, opt, daddr, len, saddr))
+			return(0);
 		if (sk==NULL) 
 		{
 			tcp_reset(daddr, saddr, th, &tcp_prot, opt,dev,skb->ip_hdr->tos,255);
@@ -4828,6 +6437,15 @@ int tcp_rcv(struct sk_buff *skb, struct device *dev, struct options *opt,
 	// 增加读缓冲区已使用的内存的大小
 	sk->rmem_alloc += skb->mem_len;
 
+	/*
+	 *	Timestamps are negotiated on the SYNs, which tcp_options()
+	 *	looks at. After that every segment should carry one.
+	 */
+	 
+	sk->saw_tstamp = 0;
+	if (sk->tstamp_ok && !th->syn)
+		tcp_parse_tstamp(sk, th);
+
 	/*
 	 *	This basically follows the flow suggested by RFC793, with the corrections in RFC1122. We
 	 *	don't implement precedence and we process URG incorrectly (deliberately so) for BSD bug
@@ -4841,6 +6459,34 @@ int tcp_rcv(struct sk_buff *skb, struct device *dev, struct options *opt,
 		/*
 		 *	Now deal with unusual cases.
 		 */
+		/*
+		 *	An ack for a listener should complete a handshake. Go on
+		 *	with the socket it makes as if it had been there all along.
+		 */
+		if(sk->state==TCP_LISTEN && !th->syn && ip_chk_addr(daddr)==IS_MYADDR)
+		{
+			struct sock *newsk;
+
+			if(th->rst)
+				tcp_synq_reset(sk, th, daddr, saddr);
+			else if(th->ack)
+			{
+				newsk = tcp_synq_ack(sk, skb, daddr, saddr, opt, dev);
+				if(newsk == NULL)
+				{
+					kfree_skb(skb, FREE_READ);
+					release_sock(sk);
+					return 0;
+				}
+				sk->rmem_alloc -= skb->mem_len;
+				newsk->rmem_alloc += skb->mem_len;
+				skb->sk = newsk;
+				release_sock(sk);
+				sk = newsk;
+				if (sk->tstamp_ok)
+					tcp_parse_tstamp(sk, th);
+			}
+		}
 		// 是监听socket则可能是一个syn包	
 		if(sk->state==TCP_LISTEN)
 		{	// 不存在收到ack包的可能，发送重置包
@@ -4935,11 +6581,11 @@ int tcp_rcv(struct sk_buff *skb, struct device *dev, struct options *opt,
 				// 期待收到对端下一个的序列号
 				sk->acked_seq=th->seq+1;
 				sk->fin_seq=th->seq;
+				// 解析tcp选项，ack里的窗口要按协商的结果缩放
+				tcp_options(sk,th);
 				// 发送第三次握手的ack包，进入连接建立状态
 				tcp_send_ack(sk->sent_seq,sk->acked_seq,sk,th,sk->daddr);
 				tcp_set_state(sk, TCP_ESTABLISHED);
-				// 解析tcp选项
-				tcp_options(sk,th);
 				// 记录对端地址
 				sk->dummy_th.dest=th->source;
 				// 可以读取但是还没读取的序列号
@@ -4953,7 +6599,7 @@ int tcp_rcv(struct sk_buff *skb, struct device *dev, struct options *opt,
 				if(sk->max_window==0)
 				{
 					sk->max_window = 32;
-					sk->mss = min(sk->max_window, sk->mtu);
+					sk->mss = min(sk->max_window, tcp_seg_space(sk));
 				}
 			}
 			else
@@ -4972,6 +6618,7 @@ int tcp_rcv(struct sk_buff *skb, struct device *dev, struct options *opt,
 						return tcp_std_reset(sk,skb);
 					}
 					// 进入syn_recv状态，等待第二次握手的ack
+					tcp_options(sk,th);
 					tcp_set_state(sk,TCP_SYN_RECV);
 					
 					/*
@@ -5181,9 +6828,11 @@ static void tcp_write_wakeup(struct sock *sk)
 	// ack为期待对端发送的下一个序列号
 	t1->ack_seq = ntohl(sk->acked_seq);
 	// 本端的接收窗口大小
-	t1->window = ntohs(tcp_select_window(sk));
-	t1->doff = sizeof(*t1)/4;
-	tcp_send_check(t1, sk->saddr, sk->daddr, sizeof(*t1), sk);
+	t1->window = tcp_window_field(sk, tcp_select_window(sk));
+	tmp = tcp_tstamp_option(sk, t1);
+	t1->doff = (sizeof(*t1) + tmp)/4;
+	buff->len += tmp;
+	tcp_send_check(t1, sk->saddr, sk->daddr, sizeof(*t1) + tmp, sk);
 	 /*
 	  *	Send it and free it.
    	  *	This will prevent the timer from automatically being restarted.
@@ -5247,11 +6896,51 @@ int tcp_setsockopt(struct sock *sk, int level, int optname, char *optval, int op
 		case TCP_NODELAY:
 			sk->nonagle=(val==0)?0:1;
 			return 0;
+		// 只发满mss的报文，清除时把攒下的数据发出去
+		case TCP_CORK:
+			sk->cork=(val==0)?0:1;
+			if (!sk->cork && sk->partial)
+			{
+				sk->inuse = 1;
+				tcp_send_partial(sk);
+				release_sock(sk);
+			}
+			return 0;
 		default:
 			return(-ENOPROTOOPT);
 	}
 }
 
+/*
+ *	Copy the loss recovery counters out, as much as the caller has
+ *	room for.
+ */
+
+static int tcp_get_loss_stats(struct sock *sk, char *optval, int *optlen)
+{
+	struct tcp_loss_stats st;
+	int len, err;
+
+	err=verify_area(VERIFY_WRITE, optlen, sizeof(int));
+	if(err)
+		return err;
+	len = get_fs_long((unsigned long *) optlen);
+	if (len < 0)
+		return -EINVAL;
+	if (len > sizeof(st))
+		len = sizeof(st);
+	err=verify_area(VERIFY_WRITE, optval, len);
+	if(err)
+		return err;
+
+	st.dupacks = sk->nr_dupacks;
+	st.fast_retrans = sk->nr_fast_retrans;
+	st.timeouts = sk->nr_timeouts;
+	memcpy_tofs(optval, &st, len);
+	put_fs_long(len,(unsigned long *) optlen);
+	return 0;
+}
+
 int tcp_getsockopt(struct sock *sk, int level, int optname, char *optval, int *optlen)
 {
 	int val,err;
@@ -5260,14 +6949,20 @@ int tcp_getsockopt(struct sock *sk, int level, int optname, char *optval, int *o
 		return ip_getsockopt(sk,level,optname,optval,optlen);
 			
 	switch(optname)
-	{	// TCP报文的最大长度，不包括tcp头部，在握手阶段确定，取两端的最小值
-		case TCP_MAXSEG:
+	{
+		/* Loss recovery counters */
+		case TCP_LOSS_STATS:
+			return tcp_get_loss_stats(sk, optval, optlen);
+		case TCP_MAXSEG:	// TCP报文的最大长度，不包括tcp头部，在握手阶段确定，取两端的最小值
 			val=sk->user_mss;
 			break;
 		// 是否开启nagle算法
 		case TCP_NODELAY:
 			val=sk->nonagle;
 			break;
+		case TCP_CORK:
+			val=sk->cork;
+			break;
 		default:
 			return(-ENOPROTOOPT);
 	}
@@ -5311,6 +7006,9 @@ struct proto tcp_prot = {
 	tcp_shutdown,
 	tcp_setsockopt,
 	tcp_getsockopt,
+	tcp_sendfile,
+	NULL,
+	NULL,
 	128,
 	0,
 	{NULL,},
@@ -20,9 +20,9 @@
 
 #include <linux/tcp.h>
 
-#define MAX_SYN_SIZE	44 + MAX_HEADER
-#define MAX_FIN_SIZE	40 + MAX_HEADER
-#define MAX_ACK_SIZE	40 + MAX_HEADER
+#define MAX_SYN_SIZE	64 + MAX_HEADER
+#define MAX_FIN_SIZE	52 + MAX_HEADER
+#define MAX_ACK_SIZE	80 + MAX_HEADER	/* Room for SACK blocks */
 #define MAX_RESET_SIZE	40 + MAX_HEADER
 #define MAX_WINDOW	16384
 #define MIN_WINDOW	2048
@@ -56,6 +56,8 @@
 #define TCP_WRITE_TIME	3000	/* initial time to wait for an ACK,
 			         * after last transmit			*/
 #define TCP_TIMEOUT_INIT (3*HZ)	/* RFC 1122 initial timeout value	*/
+#define TCP_FASTRETRANS_THRESH 3 /* duplicate acks that trigger a fast
+				  * retransmit				*/
 #define TCP_SYN_RETRIES	5	/* number of times to retry opening a
 				 * connection 				*/
 #define TCP_PROBEWAIT_LEN 100	/* time to wait between probes when
@@ -73,12 +75,111 @@
 #define TCPOPT_NOP		1	/* Padding */
 #define TCPOPT_EOL		0	/* End of options */
 #define TCPOPT_MSS		2	/* Segment size negotiating */
-/*
- *	We don't use these yet, but they are for PAWS and big windows
- */
 #define TCPOPT_WINDOW		3	/* Window scaling */
+#define TCPOPT_SACK_PERM	4	/* SACK permitted */
+#define TCPOPT_SACK		5	/* Selective acknowledgement */
 #define TCPOPT_TIMESTAMP	8	/* Better RTT estimations/PAWS */
 
+#define TCPOLEN_TIMESTAMP	10
+#define TCPOLEN_TSTAMP_ALIGNED	12	/* Padded with two NOPs in front */
+#define TCPOLEN_SACK_PERM	2
+#define TCPOLEN_SACK_BASE	2	/* Kind and length, then the blocks */
+#define TCPOLEN_SACK_PERBLOCK	8
+#define TCPOPT_TSTAMP_HDR	\
+	((TCPOPT_NOP << 24) | (TCPOPT_NOP << 16) | (TCPOPT_TIMESTAMP << 8) | TCPOLEN_TIMESTAMP)
+
+#define TCP_MAX_WSCALE		14	/* RFC 1323 limit on the window shift */
+#define TCP_MAX_SACKS		4	/* SACK blocks that fit in the options */
+#define TCP_PAWS_24DAYS		(60*60*24*24*HZ) /* ts_recent older than this
+						  * is not trusted for PAWS	*/
+
+/*
+ *	Connection requests a listener has answered are kept in a small
+ *	table rather than as full sockets (see tcp_conn_request()).
+ */
+
+#define TCP_SYNQ_HSIZE		64	/* Hash buckets, a power of two */
+#define TCP_SYNQ_MAX		1024	/* Requests held in all */
+#define TCP_SYNQ_LISTEN		256	/* ...and for one listener */
+#define TCP_SYNQ_INTERVAL	(HZ/5)	/* How often the table is checked */
+#define TCP_SYNACK_RETRIES	3	/* SYN-ACK retransmits before a
+					 * request is dropped		*/
+#define TCP_COOKIE_AGE		2	/* Minutes a SYN cookie stays good */
+
+/*
+ *	The options of a segment, as tcp_parse_options() found them.
+ */
+
+struct tcp_opts
+{
+	unsigned short	mss;		/* 0 if none was sent */
+	unsigned char	wscale_ok;
+	unsigned char	snd_wscale;
+	unsigned char	sack_ok;
+	unsigned char	saw_tstamp;
+	unsigned long	rcv_tsval;
+	unsigned long	rcv_tsecr;
+};
+
+/*
+ *	A connection in SYN_RECV: what we need to answer a retransmitted
+ *	SYN and to build the socket when the handshake completes. The
+ *	addresses and ports are from our point of view, in network order.
+ */
+
+struct tcp_synreq
+{
+	struct tcp_synreq	*next;		/* Hash chain */
+	struct sock		*sk;		/* The listener */
+	unsigned long		laddr, raddr;
+	unsigned short		lport, rport;
+	unsigned long		rcv_isn;	/* Their ISN */
+	unsigned long		snt_isn;	/* Ours */
+	unsigned long		window;		/* Offered in the SYN-ACK */
+	unsigned long		window_clamp;
+	unsigned long		ts_recent;
+	unsigned long		expires;
+	unsigned short		mtu;
+	unsigned char		snd_wscale;
+	unsigned char		rcv_wscale;
+	unsigned char		wscale_ok;
+	unsigned char		tstamp_ok;
+	unsigned char		sack_ok;
+	unsigned char		tos;
+	unsigned char		retransmits;
+};
+
+/*
+ *	A connection in TIME_WAIT whose socket has been closed: just what
+ *	is needed to answer late segments (see tcp_time_wait()). Addresses
+ *	and ports are from our point of view, in network order, except num
+ *	which is the local port in host order as in sk->num.
+ */
+
+#define TCP_TW_SLOTS		8	/* Slots in the expiry wheel */
+#define TCP_TW_TICK		(TCP_TIMEWAIT_LEN/(TCP_TW_SLOTS-1))
+
+struct tcp_tw_bucket
+{
+	struct tcp_tw_bucket	*next, **pprev;		/* Connection hash */
+	struct tcp_tw_bucket	*bnext, **bpprev;	/* Port hash */
+	struct tcp_tw_bucket	*wnext, **wpprev;	/* Expiry wheel */
+	unsigned long		saddr, daddr;
+	unsigned short		sport, dport;
+	unsigned short		num;
+	unsigned short		window;		/* As sent in the header */
+	unsigned long		snd_nxt;
+	unsigned long		rcv_nxt;
+	unsigned long		rcv_wnd;	/* The window we last had */
+	unsigned long		ts_recent;
+	unsigned long		ts_recent_stamp;
+	unsigned char		tstamp_ok;
+	unsigned char		reuse;
+	unsigned char		localroute;
+	unsigned char		tos;
+	unsigned char		ttl;
+};
+
 
 /*
  * The next routines deal with comparing 32 bit unsigned ints
@@ -136,6 +237,8 @@ extern void tcp_send_check(struct tcphdr *th, unsigned long saddr,
 		unsigned long daddr, int len, struct sock *sk);
 extern void tcp_send_probe0(struct sock *sk);
 extern void tcp_enqueue_partial(struct sk_buff *, struct sock *);
+extern void tcp_ofo_purge(struct sock *sk);
+extern int tcp_tw_port_busy(unsigned short snum, unsigned long saddr, int reuse);
 extern struct sk_buff * tcp_dequeue_partial(struct sock *);
 
 
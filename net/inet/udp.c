@@ -154,89 +154,27 @@ void udp_err(int err, unsigned char *header, unsigned long daddr,
 
 static unsigned short udp_check(struct udphdr *uh, int len, unsigned long saddr, unsigned long daddr)
 {
-	unsigned long sum;
-
-	__asm__(  "\t addl %%ecx,%%ebx\n"
-		  "\t adcl %%edx,%%ebx\n"
-		  "\t adcl $0, %%ebx\n"
-		  : "=b"(sum)
-		  : "0"(daddr), "c"(saddr), "d"((ntohs(len) << 16) + IPPROTO_UDP*256)
-		  : "cx","bx","dx" );
-
-	if (len > 3) 
-	{
-		__asm__("\tclc\n"
-			"1:\n"
-			"\t lodsl\n"
-			"\t adcl %%eax, %%ebx\n"
-			"\t loop 1b\n"
-			"\t adcl $0, %%ebx\n"
-			: "=b"(sum) , "=S"(uh)
-			: "0"(sum), "c"(len/4) ,"1"(uh)
-			: "ax", "cx", "bx", "si" );
-	}
-
-	/*
-	 *	Convert from 32 bits to 16 bits. 
-	 */
-
-	__asm__("\t movl %%ebx, %%ecx\n"
-		"\t shrl $16,%%ecx\n"
-	  	"\t addw %%cx, %%bx\n"
-	  	"\t adcw $0, %%bx\n"
-	  	: "=b"(sum)
-	  	: "0"(sum)
-	  	: "bx", "cx");
-	
-	/* 
-	 *	Check for an extra word. 
-	 */
-	 
-	if ((len & 2) != 0) 
-	{
-		__asm__("\t lodsw\n"
-			"\t addw %%ax,%%bx\n"
-			"\t adcw $0, %%bx\n"
-			: "=b"(sum), "=S"(uh)
-			: "0"(sum) ,"1"(uh)
-			: "si", "ax", "bx");
-  	}
-
-  	/*
-  	 *	Now check for the extra byte. 
-  	 */
-  	 
-	if ((len & 1) != 0) 
-	{
-		__asm__("\t lodsb\n"
-			"\t movb $0,%%ah\n"
-			"\t addw %%ax,%%bx\n"
-			"\t adcw $0, %%bx\n"
-			: "=b"(sum)
-			: "0"(sum) ,"S"(uh)
-			: "si", "ax", "bx");
-  	}
-
-  	/* 
-  	 *	We only want the bottom 16 bits, but we never cleared the top 16. 
-  	 */
-
-	return((~sum) & 0xffff);
+	return csum_tcpudp_magic(saddr, daddr, len, IPPROTO_UDP,
+		csum_partial((unsigned char *) uh, len, 0));
 }
 
 /*
  *	Generate UDP checksums. These may be disabled, eg for fast NFS over ethernet
  *	We default them enabled.. if you turn them off you either know what you are
  *	doing or get burned...
+ *
+ *	csum is the partial sum of the data after the header, which the caller
+ *	got while copying it in.
  */
 
 static void udp_send_check(struct udphdr *uh, unsigned long saddr, 
-	       unsigned long daddr, int len, struct sock *sk)
+	       unsigned long daddr, int len, unsigned long csum, struct sock *sk)
 {
 	uh->check = 0;
 	if (sk && sk->no_check) 
 	  	return;
-	uh->check = udp_check(uh, len, saddr, daddr);
+	uh->check = csum_tcpudp_magic(saddr, daddr, len, IPPROTO_UDP,
+		csum_partial((unsigned char *) uh, sizeof(struct udphdr), csum));
 	
 	/*
 	 *	FFFF and 0 are the same, pick the right one as 0 in the
@@ -256,6 +194,7 @@ static int udp_send(struct sock *sk, struct sockaddr_in *sin,
 	struct udphdr *uh;
 	unsigned char *buff;
 	unsigned long saddr;
+	unsigned long csum = 0;
 	int size, tmp;
 	int ttl;
   
@@ -271,7 +210,7 @@ static int udp_send(struct sock *sk, struct sockaddr_in *sin,
 	if (skb == NULL) 
 		return tmp;
 
-	skb->sk       = NULL;	/* to avoid changing sk->saddr */
+	skb->sk       = sk;	/* For the route cache in build_header */
 	// 发送完可以销毁，不需要缓存
 	skb->free     = 1;
 	skb->localroute = sk->localroute|(rt&MSG_DONTROUTE);
@@ -292,8 +231,6 @@ static int udp_send(struct sock *sk, struct sockaddr_in *sin,
 	tmp = sk->prot->build_header(skb, saddr, sin->sin_addr.s_addr,
 			&dev, IPPROTO_UDP, sk->opt, skb->mem_len,sk->ip_tos,ttl);
 
-	skb->sk=sk;	/* So memory is freed correctly */
-	
 	/*
 	 *	Unable to put a header on the packet.
 	 */
@@ -323,16 +260,20 @@ static int udp_send(struct sock *sk, struct sockaddr_in *sin,
 	buff = (unsigned char *) (uh + 1);
 
 	/*
-	 *	Copy the user data. 
+	 *	Copy the user data, summing it on the way unless checksums
+	 *	are off.
 	 */
 	 
-	memcpy_fromfs(buff, from, len);
+	if (sk->no_check)
+		memcpy_fromfs(buff, from, len);
+	else
+		csum = csum_partial_copy_fromuser(from, buff, len, 0);
 
   	/*
   	 *	Set up the UDP checksum. 
   	 */
 	// 计算校验和
-	udp_send_check(uh, saddr, sin->sin_addr.s_addr, skb->len - tmp, sk);
+	udp_send_check(uh, saddr, sin->sin_addr.s_addr, skb->len - tmp, csum, sk);
 
 	/* 
 	 *	Send the datagram to the interface. 
@@ -345,29 +286,26 @@ static int udp_send(struct sock *sk, struct sockaddr_in *sin,
 }
 
 
-static int udp_sendto(struct sock *sk, unsigned char *from, int len, int noblock,
-	   unsigned flags, struct sockaddr_in *usin, int addr_len)
-{
-	struct sockaddr_in sin;
-	int tmp;
+/*
+ *	Work out where a datagram goes: the address given, or the one the
+ *	socket is connected to.
+ */
 
-	/* 
-	 *	Check the flags. We support no flags for UDP sending
-	 */
-	if (flags&~MSG_DONTROUTE) 
-	  	return(-EINVAL);
+static int udp_getaddr(struct sock *sk, struct sockaddr_in *usin, int addr_len,
+	struct sockaddr_in *sin)
+{
 	/*
 	 *	Get and verify the address. 
 	 */
 	// 目的地址信息
 	if (usin) 
 	{
-		if (addr_len < sizeof(sin)) 
+		if (addr_len < sizeof(*sin)) 
 			return(-EINVAL);
-		memcpy(&sin,usin,sizeof(sin));
-		if (sin.sin_family && sin.sin_family != AF_INET) 
+		memcpy(sin,usin,sizeof(*sin));
+		if (sin->sin_family && sin->sin_family != AF_INET) 
 			return(-EINVAL);
-		if (sin.sin_port == 0) 
+		if (sin->sin_port == 0) 
 			return(-EINVAL);
 	} 
 	else 
@@ -376,9 +314,9 @@ static int udp_sendto(struct sock *sk, unsigned char *from, int len, int noblock
 		if (sk->state != TCP_ESTABLISHED) 
 			return(-EINVAL);
 		// 从之前建立连接中获取目的信息
-		sin.sin_family = AF_INET;
-		sin.sin_port = sk->dummy_th.dest;
-		sin.sin_addr.s_addr = sk->daddr;
+		sin->sin_family = AF_INET;
+		sin->sin_port = sk->dummy_th.dest;
+		sin->sin_addr.s_addr = sk->daddr;
   	}
   
   	/*
@@ -386,11 +324,30 @@ static int udp_sendto(struct sock *sk, unsigned char *from, int len, int noblock
   	 *	broadcasting of data.
   	 */
   	 
-  	if(sin.sin_addr.s_addr==INADDR_ANY)
-  		sin.sin_addr.s_addr=ip_my_addr();
+  	if(sin->sin_addr.s_addr==INADDR_ANY)
+  		sin->sin_addr.s_addr=ip_my_addr();
   		
-  	if(!sk->broadcast && ip_chk_addr(sin.sin_addr.s_addr)==IS_BROADCAST)
+  	if(!sk->broadcast && ip_chk_addr(sin->sin_addr.s_addr)==IS_BROADCAST)
 	    	return -EACCES;			/* Must turn broadcast on first */
+	return 0;
+}
+
+
+static int udp_sendto(struct sock *sk, unsigned char *from, int len, int noblock,
+	   unsigned flags, struct sockaddr_in *usin, int addr_len)
+{
+	struct sockaddr_in sin;
+	int tmp;
+
+	/* 
+	 *	Check the flags. We support no flags for UDP sending
+	 */
+	if (flags&~MSG_DONTROUTE) 
+	  	return(-EINVAL);
+
+	tmp = udp_getaddr(sk, usin, addr_len, &sin);
+	if (tmp)
+		return tmp;
 
 	sk->inuse = 1;
 
@@ -402,6 +359,49 @@ static int udp_sendto(struct sock *sk, unsigned char *from, int len, int noblock
 	return(tmp);
 }
 
+
+/*
+ *	Send a vector of datagrams, holding the socket once for all of them.
+ *	Consecutive datagrams to one destination find the route and the
+ *	hardware header in the socket's cache (see ip_build_header()).
+ *	vec is in kernel space, msg_base points to (checked) user memory
+ *	and msg_name, if not NULL, to a kernel copy of the address.
+ *
+ *	Each datagram goes to ip_queue_xmit() as soon as it is built rather
+ *	than the batch going out together. Holding the built ones back
+ *	would pin send buffer space that a later allocation in the batch may
+ *	sleep waiting for, and the drivers take one frame per call anyway.
+ */
+
+static int udp_sendmmsg(struct sock *sk, struct mmsghdr *vec, int vlen,
+	int noblock, unsigned flags)
+{
+	struct sockaddr_in sin;
+	struct mmsghdr *m;
+	int i;
+	int err = 0;
+
+	if (flags&~MSG_DONTROUTE) 
+	  	return(-EINVAL);
+
+	sk->inuse = 1;
+	for (i = 0; i < vlen; i++)
+	{
+		m = vec + i;
+		err = udp_getaddr(sk, (struct sockaddr_in *) m->msg_name,
+			m->msg_namelen, &sin);
+		if (err)
+			break;
+		err = udp_send(sk, &sin, (unsigned char *) m->msg_base,
+			m->msg_size, flags);
+		if (err < 0)
+			break;
+		m->msg_len = err;
+	}
+	release_sock(sk);
+	return i ? i : err;
+}
+
 /*
  *	In BSD SOCK_DGRAM a write is just like a send.
  */
@@ -467,6 +467,40 @@ int udp_ioctl(struct sock *sk, int cmd, unsigned long arg)
 }
 
 
+/*
+ *	Hand one received datagram to the user and free it. Returns its
+ *	full size, even if it did not all fit.
+ */
+
+static int udp_copy_datagram(struct sock *sk, struct sk_buff *skb,
+	unsigned char *to, int len, struct sockaddr_in *sin)
+{
+  	int copied;
+  	int truesize;
+
+  	truesize = skb->len;
+  	copied = min(len, truesize);
+
+  	/*
+  	 *	FIXME : should use udp header size info value 
+  	 */
+  	 
+	skb_copy_datagram(skb,sizeof(struct udphdr),to,copied);
+	sk->stamp=skb->stamp;
+
+	/* Copy the address. */
+	// 复制源地址信息给应用层
+	if (sin) 
+	{
+		sin->sin_family = AF_INET;
+		sin->sin_port = skb->h.uh->source;
+		sin->sin_addr.s_addr = skb->daddr;
+  	}
+  
+  	skb_free_datagram(skb);
+  	return(truesize);
+}
+
 /*
  * 	This should be easy, if there is something there we\
  * 	return it, otherwise we block.
@@ -476,7 +510,6 @@ int udp_recvfrom(struct sock *sk, unsigned char *to, int len,
 	     int noblock, unsigned flags, struct sockaddr_in *sin,
 	     int *addr_len)
 {
-  	int copied = 0;
   	int truesize;
   	struct sk_buff *skb;
   	int er;
@@ -497,28 +530,51 @@ int udp_recvfrom(struct sock *sk, unsigned char *to, int len,
 	if(skb==NULL)
   		return er;
   
-  	truesize = skb->len;
-  	copied = min(len, truesize);
+	truesize = udp_copy_datagram(sk, skb, to, len, sin);
+  	release_sock(sk);
+  	return(truesize);
+}
 
-  	/*
-  	 *	FIXME : should use udp header size info value 
-  	 */
-  	 
-	skb_copy_datagram(skb,sizeof(struct udphdr),to,copied);
-	sk->stamp=skb->stamp;
+/*
+ *	Receive a vector of datagrams. The queue is taken UDP_RECV_BATCH
+ *	datagrams at a time while the socket is held, so a busy server pays
+ *	for the locking and the system call once per batch rather than once
+ *	per datagram. Only the first datagram is waited for. vec is in
+ *	kernel space, but msg_base points to (checked) user memory; msg_name
+ *	is a kernel buffer big enough for any address.
+ */
 
-	/* Copy the address. */
-	// 复制源地址信息给应用层
-	if (sin) 
+#define UDP_RECV_BATCH	8
+
+static int udp_recvmmsg(struct sock *sk, struct mmsghdr *vec, int vlen,
+	int noblock, unsigned flags)
+{
+	struct sk_buff *skbs[UDP_RECV_BATCH];
+	struct mmsghdr *m;
+	int done = 0;
+	int n, i;
+	int er = 0;
+
+	while (done < vlen)
 	{
-		sin->sin_family = AF_INET;
-		sin->sin_port = skb->h.uh->source;
-		sin->sin_addr.s_addr = skb->daddr;
-  	}
-  
-  	skb_free_datagram(skb);
-  	release_sock(sk);
-  	return(truesize);
+		n = skb_recv_datagrams(sk, skbs, min(vlen - done, UDP_RECV_BATCH),
+			flags, noblock || done, &er);
+		if (n == 0)
+			break;
+		for (i = 0; i < n; i++)
+		{
+			m = vec + done + i;
+			m->msg_namelen = sizeof(struct sockaddr_in);
+			m->msg_len = udp_copy_datagram(sk, skbs[i],
+				(unsigned char *) m->msg_base, m->msg_size,
+				(struct sockaddr_in *) m->msg_name);
+		}
+		release_sock(sk);
+		done += n;
+		if (flags & MSG_PEEK)
+			break;
+	}
+	return done ? done : er;
 }
 
 /*
@@ -553,6 +609,7 @@ int udp_connect(struct sock *sk, struct sockaddr_in *usin, int addr_len)
   	sk->saddr = sa;		/* Update source address */
 	sk->daddr = usin->sin_addr.s_addr;
 	sk->dummy_th.dest = usin->sin_port;
+	rehash_sock(sk);
 	sk->state = TCP_ESTABLISHED;
 	return(0);
 }
@@ -569,6 +626,26 @@ static void udp_close(struct sock *sk, int timeout)
 }
 
 
+#ifdef CONFIG_IP_MULTICAST
+/*
+ *	Next socket bound to the port of a multicast or broadcast datagram.
+ *	For a group's multicasts (members set) the sockets that only take
+ *	groups they joined are skipped; udp_rcv() has found those already.
+ */
+
+static struct sock *udp_mc_sock(struct sock *sk, struct udphdr *uh,
+	unsigned long saddr, unsigned long daddr, int members)
+{
+	while((sk=get_sock_mcast(sk, uh->dest, saddr, uh->source, daddr))!=NULL)
+	{
+		if(!members || sk->ip_mc_all)
+			return sk;
+		sk=sk->next;
+	}
+	return NULL;
+}
+#endif
+
 /*
  *	All we need to do is get the socket, and then do a checksum. 
  */
@@ -626,28 +703,49 @@ int udp_rcv(struct sk_buff *skb, struct device *dev, struct options *opt,
 	if (addr_type!=IS_MYADDR)
 	{
 		/*
-		 *	Multicasts and broadcasts go to each listener.
+		 *	Multicasts and broadcasts go to each listener. Sockets
+		 *	that turned IP_MULTICAST_ALL off only get multicasts for
+		 *	groups they joined, and are found through the group hash.
+		 *	The port is only walked if something on it still takes
+		 *	every multicast. The last receiver gets the original.
 		 */
-		struct sock *sknext=NULL;
-		sk=get_sock_mcast(udp_prot.sock_array[ntohs(uh->dest)&(SOCK_ARRAY_SIZE-1)], uh->dest,
-				saddr, uh->source, daddr);
-		if(sk)
-		{		
-			do
+		struct sock *last=NULL;
+		struct sk_buff *skb1;
+		int members=(addr_type==IS_MULTICAST && daddr!=IGMP_ALL_HOSTS);
+		int slot=ntohs(uh->dest)&(SOCK_ARRAY_SIZE-1);
+
+		if(members)
+		{
+			struct ip_mc_member *m;
+
+			for(m=get_mc_member(ip_mc_members(daddr), &udp_prot, uh->dest,
+					saddr, uh->source, daddr, dev);
+			    m!=NULL;
+			    m=get_mc_member(m->next, &udp_prot, uh->dest,
+					saddr, uh->source, daddr, dev))
 			{
-				struct sk_buff *skb1;
-
-				sknext=get_sock_mcast(sk->next, uh->dest, saddr, uh->source, daddr);
-				if(sknext)
-					skb1=skb_clone(skb,GFP_ATOMIC);
-				else
-					skb1=skb;
-				if(skb1)
-					udp_deliver(sk, uh, skb1, dev,saddr,daddr,len);
-				sk=sknext;
+				if(m->sk->ip_mc_all)
+					continue;	/* The port walk finds it */
+				if(last && (skb1=skb_clone(skb,GFP_ATOMIC))!=NULL)
+					udp_deliver(last, uh, skb1, dev,saddr,daddr,len);
+				last=m->sk;
 			}
-			while(sknext!=NULL);
 		}
+
+		if(!members || udp_prot.mc_all_inuse[slot])
+		{
+			for(sk=udp_mc_sock(udp_prot.sock_array[slot], uh, saddr, daddr, members);
+			    sk!=NULL;
+			    sk=udp_mc_sock(sk->next, uh, saddr, daddr, members))
+			{
+				if(last && (skb1=skb_clone(skb,GFP_ATOMIC))!=NULL)
+					udp_deliver(last, uh, skb1, dev,saddr,daddr,len);
+				last=sk;
+			}
+		}
+
+		if(last)
+			udp_deliver(last, uh, skb, dev,saddr,daddr,len);
 		else
 			kfree_skb(skb, FREE_READ);
 		return 0;
@@ -737,6 +835,9 @@ struct proto udp_prot = {
 	NULL,
 	ip_setsockopt,
 	ip_getsockopt,
+	NULL,
+	udp_recvmmsg,
+	udp_sendmmsg,
 	128,
 	0,
 	{NULL,},
@@ -1087,6 +1087,179 @@ static int sock_recvfrom(int fd, void * buff, int len, unsigned flags,
 	return len;
 }
 
+/*
+ *	recvmmsg() and sendmmsg() bring the user's vector in MMSG_CHUNK
+ *	entries at a time. Each chunk gets kernel buffers for the addresses.
+ */
+
+#define MMSG_CHUNK	8
+#define MMSG_MAXVEC	1024		/* Most entries taken per call */
+
+/*
+ *	Receive up to vlen datagrams in one call. The addresses are moved
+ *	out afterwards as for recvfrom(). Only the first datagram is waited
+ *	for. Returns the number of datagrams received, or the error if there
+ *	were none.
+ */
+
+static int sock_recvmmsg(int fd, struct mmsghdr *vec, int vlen, unsigned flags)
+{
+	struct socket *sock;
+	struct file *file;
+	struct mmsghdr kvec[MMSG_CHUNK];
+	struct sockaddr *uname[MMSG_CHUNK];
+	char *address;
+	int done = 0;
+	int n, i, got;
+	int err;
+
+	if (fd < 0 || fd >= NR_OPEN || ((file = current->files->fd[fd]) == NULL))
+		return(-EBADF);
+	if (!(sock = sockfd_lookup(fd, NULL))) 
+		return(-ENOTSOCK);
+	if (sock->ops->recvmmsg == NULL)
+		return(-EOPNOTSUPP);
+	if (vlen < 0)
+		return(-EINVAL);
+	if (vlen == 0)
+		return 0;
+	if (vlen > MMSG_MAXVEC)
+		vlen = MMSG_MAXVEC;
+	err = verify_area(VERIFY_WRITE, vec, vlen * sizeof(struct mmsghdr));
+	if (err)
+		return err;
+	address = kmalloc(MMSG_CHUNK * MAX_SOCK_ADDR, GFP_KERNEL);
+	if (address == NULL)
+		return(-ENOMEM);
+
+	while (done < vlen)
+	{
+		n = vlen - done;
+		if (n > MMSG_CHUNK)
+			n = MMSG_CHUNK;
+		memcpy_fromfs(kvec, vec + done, n * sizeof(struct mmsghdr));
+		for (i = 0; i < n; i++)
+		{
+			if (kvec[i].msg_size < 0)
+			{
+				err = -EINVAL;
+				goto out;
+			}
+			err = verify_area(VERIFY_WRITE, kvec[i].msg_base, kvec[i].msg_size);
+			if (err)
+				goto out;
+			uname[i] = kvec[i].msg_name;
+			kvec[i].msg_name = (struct sockaddr *) (address + i * MAX_SOCK_ADDR);
+			kvec[i].msg_namelen = 0;
+		}
+
+		got = sock->ops->recvmmsg(sock, kvec, n,
+			(file->f_flags & O_NONBLOCK) || done, flags);
+		if (got <= 0)
+		{
+			err = got;
+			break;
+		}
+
+		for (i = 0; i < got; i++)
+		{
+			put_fs_long(kvec[i].msg_len, (unsigned long *) &vec[done + i].msg_len);
+			if (uname[i] != NULL)
+			{
+				err = move_addr_to_user(kvec[i].msg_name, kvec[i].msg_namelen,
+					uname[i], &vec[done + i].msg_namelen);
+				if (err)
+					goto out;
+			}
+		}
+		done += got;
+		if (got < n)
+			break;
+	}
+out:
+	kfree_s(address, MMSG_CHUNK * MAX_SOCK_ADDR);
+	return done ? done : err;
+}
+
+/*
+ *	Send up to vlen datagrams in one call. Returns the number sent, or
+ *	the error if none were; msg_len is set for each one sent.
+ */
+
+static int sock_sendmmsg(int fd, struct mmsghdr *vec, int vlen, unsigned flags)
+{
+	struct socket *sock;
+	struct file *file;
+	struct mmsghdr kvec[MMSG_CHUNK];
+	char *address;
+	int done = 0;
+	int n, i, got;
+	int err;
+
+	if (fd < 0 || fd >= NR_OPEN || ((file = current->files->fd[fd]) == NULL))
+		return(-EBADF);
+	if (!(sock = sockfd_lookup(fd, NULL))) 
+		return(-ENOTSOCK);
+	if (sock->ops->sendmmsg == NULL)
+		return(-EOPNOTSUPP);
+	if (vlen < 0)
+		return(-EINVAL);
+	if (vlen == 0)
+		return 0;
+	if (vlen > MMSG_MAXVEC)
+		vlen = MMSG_MAXVEC;
+	err = verify_area(VERIFY_WRITE, vec, vlen * sizeof(struct mmsghdr));
+	if (err)
+		return err;
+	address = kmalloc(MMSG_CHUNK * MAX_SOCK_ADDR, GFP_KERNEL);
+	if (address == NULL)
+		return(-ENOMEM);
+
+	while (done < vlen)
+	{
+		n = vlen - done;
+		if (n > MMSG_CHUNK)
+			n = MMSG_CHUNK;
+		memcpy_fromfs(kvec, vec + done, n * sizeof(struct mmsghdr));
+		for (i = 0; i < n; i++)
+		{
+			if (kvec[i].msg_size < 0)
+			{
+				err = -EINVAL;
+				goto out;
+			}
+			err = verify_area(VERIFY_READ, kvec[i].msg_base, kvec[i].msg_size);
+			if (err)
+				goto out;
+			if (kvec[i].msg_name != NULL)
+			{
+				err = move_addr_to_kernel(kvec[i].msg_name, kvec[i].msg_namelen,
+					address + i * MAX_SOCK_ADDR);
+				if (err)
+					goto out;
+				kvec[i].msg_name = (struct sockaddr *) (address + i * MAX_SOCK_ADDR);
+			}
+		}
+
+		got = sock->ops->sendmmsg(sock, kvec, n,
+			(file->f_flags & O_NONBLOCK) || done, flags);
+		if (got <= 0)
+		{
+			err = got;
+			break;
+		}
+
+		for (i = 0; i < got; i++)
+			put_fs_long(kvec[i].msg_len, (unsigned long *) &vec[done + i].msg_len);
+		done += got;
+		if (got < n)
+			break;
+	}
+out:
+	kfree_s(address, MMSG_CHUNK * MAX_SOCK_ADDR);
+	return done ? done : err;
+}
+
 /*
  *	Set a socket option. Because we don't know the option lengths we have
  *	to pass the user mode parameter for the protocols to sort out.
@@ -1144,6 +1317,59 @@ static int sock_shutdown(int fd, int how)
 }
 
 
+/*
+ *	Send count bytes of the file in_fd down a socket without passing
+ *	them through user space. If offset is given the file is read from
+ *	there and the offset is moved on instead of the file position.
+ *	Only regular files and block devices: the protocol may hold its
+ *	socket while it reads, so the read must not wait for long.
+ */
+
+static int sock_sendfile(int fd, int in_fd, off_t *offset, int count)
+{
+	struct socket *sock;
+	struct file *file, *in;
+	struct inode *inode;
+	off_t pos = 0;
+	int err;
+
+	if (fd < 0 || fd >= NR_OPEN || ((file = current->files->fd[fd]) == NULL))
+		return(-EBADF);
+	if (!(sock = sockfd_lookup(fd, NULL))) 
+		return(-ENOTSOCK);
+	if (in_fd < 0 || in_fd >= NR_OPEN || ((in = current->files->fd[in_fd]) == NULL))
+		return(-EBADF);
+	if (!(in->f_mode & 1))
+		return(-EBADF);
+	inode = in->f_inode;
+	if (!inode || !in->f_op || !in->f_op->read)
+		return(-EINVAL);
+	if (!S_ISREG(inode->i_mode) && !S_ISBLK(inode->i_mode))
+		return(-EINVAL);
+	if (sock->ops->sendfile == NULL)
+		return(-EINVAL);
+	if (count < 0)
+		return(-EINVAL);
+	if (offset != NULL)
+	{
+		err = verify_area(VERIFY_WRITE, offset, sizeof(off_t));
+		if (err)
+			return err;
+		pos = in->f_pos;
+		in->f_pos = get_fs_long((unsigned long *) offset);
+	}
+
+	err = sock->ops->sendfile(sock, in, count, (file->f_flags & O_NONBLOCK));
+
+	if (offset != NULL)
+	{
+		put_fs_long(in->f_pos, (unsigned long *) offset);
+		in->f_pos = pos;
+	}
+	return err;
+}
+
+
 /*
  *	Perform a file control on a socket file descriptor.
  */
@@ -1290,6 +1516,30 @@ asmlinkage int sys_socketcall(int call, unsigned long *args)
 				get_fs_long(args+2),
 				(char *)get_fs_long(args+3),
 				(int *)get_fs_long(args+4)));
+		case SYS_SENDFILE:
+			er=verify_area(VERIFY_READ, args, 4*sizeof(unsigned long));
+			if(er)
+				return er;
+			return(sock_sendfile(get_fs_long(args+0),
+				get_fs_long(args+1),
+				(off_t *)get_fs_long(args+2),
+				get_fs_long(args+3)));
+		case SYS_RECVMMSG:
+			er=verify_area(VERIFY_READ, args, 4*sizeof(unsigned long));
+			if(er)
+				return er;
+			return(sock_recvmmsg(get_fs_long(args+0),
+				(struct mmsghdr *)get_fs_long(args+1),
+				get_fs_long(args+2),
+				get_fs_long(args+3)));
+		case SYS_SENDMMSG:
+			er=verify_area(VERIFY_READ, args, 4*sizeof(unsigned long));
+			if(er)
+				return er;
+			return(sock_sendmmsg(get_fs_long(args+0),
+				(struct mmsghdr *)get_fs_long(args+1),
+				get_fs_long(args+2),
+				get_fs_long(args+3)));
 		default:
 			return(-EINVAL);
 	}
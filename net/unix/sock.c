@@ -925,7 +925,10 @@ static struct proto_ops unix_proto_ops = {
 	unix_proto_shutdown,
 	unix_proto_setsockopt,
 	unix_proto_getsockopt,
-	NULL				/* unix_proto_fcntl	*/
+	NULL,				/* unix_proto_fcntl	*/
+	NULL,				/* unix_proto_sendfile	*/
+	NULL,				/* unix_proto_recvmmsg	*/
+	NULL				/* unix_proto_sendmmsg	*/
 };
 
 /*